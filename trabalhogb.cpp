@@ -8,6 +8,37 @@
 #include <sstream>
 #include <assert.h>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <random>
+#include <cstring>
+#include <cstdio>
+#include <cctype>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <bitset>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <sys/stat.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 using namespace std;
 
@@ -17,6 +48,13 @@ using namespace std;
 // GLFW
 #include <GLFW/glfw3.h>
 
+// EGL: contexto sem janela do --bench-render (-DSEM_EGL compila sem ele)
+#if !defined(_WIN32) && !defined(SEM_EGL)
+#define COM_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
 // STB_IMAGE
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
@@ -34,8 +72,8 @@ using namespace glm;
 
 // Sprite genérico para personagens, bandeira, etc.
 struct Sprite {
-    GLuint VAO;
     GLuint texID;
+    vec2 uvBase; // Canto da spritesheet no atlas
     vec3 position;
     vec3 dimensions; 
     float ds, dt;
@@ -43,10 +81,45 @@ struct Sprite {
     int nAnimations, nFrames;
 };
 
-// Tile do mapa
+// Tipos de objeto GL criados pelo gerenciador de recursos
+enum TipoRecursoGPU : uint8_t {
+    GPU_TEXTURA, GPU_BUFFER, GPU_VAO, GPU_FRAMEBUFFER, GPU_RENDERBUFFER, GPU_PROGRAMA
+};
+
+// Categorias da contagem de memória de GPU (cada objeto entra em uma)
+enum CategoriaGPU : uint8_t {
+    CATEGORIA_TEXTURAS,      // Atlas e páginas do chão
+    CATEGORIA_GEOMETRIA,     // Pool de vértices estáticos, índices dos quads e VAOs
+    CATEGORIA_STREAMING,     // Buffers reescritos a cada frame (lotes, instâncias, overlay)
+    CATEGORIA_ALVOS,         // Framebuffers e renderbuffers
+    CATEGORIA_TRANSFERENCIA, // PBOs do pipeline de texturas
+    CATEGORIA_UNIFORMES,     // Bloco Quadro
+    CATEGORIA_PROGRAMAS,
+    N_CATEGORIAS_GPU
+};
+const uint32_t SEM_RECURSO = UINT32_MAX;
+
+// Referência contada a um objeto GL do gerenciador (recursosGPU). Copiar soma
+// uma referência e destruir tira uma; a última apaga o objeto no GL e desconta
+// a memória da categoria. O handle vazio vale 0 em id().
+struct RecursoGPU {
+    uint32_t indice = SEM_RECURSO;
+
+    RecursoGPU() {}
+    explicit RecursoGPU(uint32_t i) : indice(i) {} // Assume a referência da criação
+    RecursoGPU(const RecursoGPU &outro);
+    RecursoGPU(RecursoGPU &&outro) noexcept : indice(outro.indice) { outro.indice = SEM_RECURSO; }
+    RecursoGPU &operator=(RecursoGPU outro) noexcept { swap(indice, outro.indice); return *this; }
+    ~RecursoGPU();
+    GLuint id() const;
+    explicit operator bool() const { return indice != SEM_RECURSO; }
+};
+
+// Tile do mapa (todos dividem o mesmo VAO do losango)
 struct Tile {
-    GLuint VAO;
+    RecursoGPU VAO;
     GLuint texID; 
+    vec2 uvBase;
     int iTile; 
     vec3 position;
     vec3 dimensions; 
@@ -54,664 +127,7862 @@ struct Tile {
     bool caminhavel;
 };  
 
-// Moeda animada
-struct Moeda {
-    GLuint VAO;
+// Tipos de entidade do armazenamento em SoA
+enum TipoEntidade : uint8_t {
+    ENTIDADE_MOEDA,
+    ENTIDADE_ATOR
+};
+
+// Aparência compartilhada pelas entidades de um tipo (handle de render):
+// região no atlas, tamanho, deslocamento do desenho em relação à célula e animação
+struct AparenciaEntidade {
     GLuint texID;
-    vec3 position;
-    vec3 dimensions;
-    float ds, dt;
-    bool coletada;
-    int frameAtual;
-    int totalFrames;
-    double tempoUltimoFrame;
+    vec2 uvBase, duv;
+    vec2 dimensoes;
+    vec2 deslocamento;
+    int nFrames;
+    float fps;
+};
+
+// Entidades em estrutura de arrays (SoA): cada componente é um vetor contíguo
+// indexado pelo id. As moedas ocupam os primeiros ids e os atores vêm depois,
+// então cada sistema percorre uma faixa contínua.
+struct Entidades {
+    size_t n = 0;
+    size_t inicioAtores = 0;
+    // Posição
+    vector<ivec2> celula;      // Tile atual (colisão e grade espacial)
+    vector<vec2> posicao;      // Posição contínua em tiles (desenho)
+    // Tipo, coleta e render
+    vector<uint8_t> tipo;
+    vector<uint8_t> viva;      // 0 = moeda coletada
+    vector<uint8_t> aparencia; // Índice em 'aparencias'
+    // Animação (o frame sai do shader; aqui ficam o início do ciclo e a linha)
+    vector<float> inicioAnimacao;
+    vector<uint8_t> linha;
+    // IA dos atores: célula de destino, progresso do passo e gerador próprio
+    vector<ivec2> destino;
+    vector<float> progresso;
+    vector<uint32_t> semente;
+};
+
+// Região de um spritesheet dentro do atlas (em pixels e em UV)
+struct RegiaoAtlas {
+    string arquivo;
+    uint64_t hash;
+    int x, y, w, h;
+    vec2 uv0, uvTam;
+};
+
+// Atlas único com todos os spritesheets (os sprites guardam textura.id()).
+// 'versao' sobe quando o conteúdo do atlas muda (as páginas do chão comparam).
+struct Atlas {
+    RecursoGPU textura;
+    size_t versao = 0;
+    int largura, altura;
+    vector<RegiaoAtlas> regioes;
+};
+
+// Spritesheet decodificada pelo pipeline assíncrono, aguardando envio ao atlas
+struct AssetTextura {
+    int regiao;
+    unsigned char *pixels;
+    double msDecodificacao, msEnvio;
+};
+
+// Pipeline de texturas: threads decodificam os PNGs em paralelo e a thread do GL
+// envia cada imagem pronta para sua região do atlas por PBOs alternados. Até lá a
+// região mostra a cor provisória; as margens ficam transparentes como no cache.
+struct PipelineTexturas {
+    bool ativo = false;
+    Atlas *atlas = nullptr;
+    vector<AssetTextura> assets;
+    atomic<size_t> proximo{0};
+    mutex mtx;
+    vector<int> prontos;               // Decodificados, ainda com as threads (protegido por mtx)
+    vector<int> paraEnviar;            // Já com a thread do GL
+    vector<thread> decodificadores;
+    RecursoGPU pbo[2];
+    int pboAtual = 0;
+    size_t enviados = 0;
+    atomic<bool> falhou{false};        // Alguma imagem não decodificou: atlas incompleto não vai para o cache
+    string cacheFile;
+    vector<unsigned char> pixelsAtlas; // Cópia do atlas para gravar o cache no final
+    chrono::steady_clock::time_point inicio;
+};
+
+// Dados por instância de um tile na camada do mapa (coluna, linha, índice no tileset)
+struct InstanciaTile {
+    GLfloat coluna, linha;
+    GLfloat iTile;
+};
+
+// Camada de tiles desenhada por instância (no bake das páginas do chão e,
+// a cada frame, só para os tiles animados). O losango fica no pool de geometria.
+struct TileLayer {
+    RecursoGPU VAO;
+    RecursoGPU VBOInstancias;
+    GLuint shaderID;
+    GLuint texID;
+    int nInstancias; // Tiles animados desenhados no último frame
+    vec2 origem;
+};
+
+// Chão estático pré-renderizado em páginas de PAGINA_CHAO x PAGINA_CHAO
+// pixels de mundo, cada uma numa textura com FBO próprio, alinhadas à origem
+// da camada. Ficam em cache (LRU) enquanto a câmera passa; tiles alterados
+// só refazem o próprio retângulo.
+const int PAGINA_CHAO = 1024;
+const size_t MAX_PAGINAS_CHAO = 16; // 4 MB cada
+
+struct PaginaChao {
+    ivec2 id;                  // Posição na grade de páginas
+    RecursoGPU fbo, textura;
+    bool assada = false;       // Conteúdo válido (fora as regiões sujas)
+    vector<vec4> sujos;        // Retângulos de mundo a refazer
+    size_t versaoAtlas = 0;    // atlas.versao quando foi assada
+    uint64_t ultimoUso = 0;
+};
+
+struct ChaoPreRenderizado {
+    deque<PaginaChao> paginas;          // deque: referências estáveis ao crescer
+    vector<PaginaChao *> visiveis;      // No frame atual
+    RecursoGPU VAO, VBO;
+    GLuint shaderID = 0;
+    vector<GLfloat> quads;
+    vector<InstanciaTile> instancias;   // Tiles do bake em andamento
+    bool haAnimados = false;            // Algum tipo de tile animado no tileset
+    vector<vector<InstanciaTile>> animadosChunk; // Tiles animados por chunk
+    vector<uint8_t> animadosValidos;
+    GLint viewportTela[4];
+    uint64_t frame = 0;
+};
+
+// Vértice do lote de sprites: posição já transformada, coordenada de textura
+// do frame 0 e os parâmetros da animação (o frame é escolhido no vertex shader)
+struct VerticeSprite {
+    GLfloat x, y, z;
+    GLfloat s, t;
+    GLfloat passo;   // Largura de um frame na textura
+    GLfloat inicio;  // Instante de início do ciclo
+    GLfloat nFrames;
+    GLfloat fps;     // 0 = frame fixo
+};
+
+// Animação de um sprite: início do ciclo, número de frames, frames por
+// segundo e linha da spritesheet
+struct AnimacaoSprite {
+    float inicio;
+    int nFrames;
+    float fps;
+    int linha;
+};
+
+// Sprite enfileirado no lote. A ordem isométrica vem de 'profundidade' (z do
+// vértice, testado no depth buffer); 'camada' só desempata sprites na mesma
+// profundidade (moedas, atores e bandeira, personagem) e dentro da camada os
+// itens são agrupados por textura.
+struct ItemSprite {
+    int camada;
+    GLuint texID;
+    float profundidade;
+    vec2 centro, dimensoes;
+    vec2 uv0, duv;
+    AnimacaoSprite animacao;
+};
+
+// Lote de sprites: um VBO com os quads; o padrão de índices é o EBO
+// compartilhado do gerenciador (eboQuads). Lotes persistentes guardam os
+// itens entre frames e só reenviam o VBO quando marcados como sujos.
+struct SpriteBatch {
+    RecursoGPU VAO, VBO;
+    GLuint shaderID;
+    bool persistente;
+    bool sujo;
+    vector<ItemSprite> itens;
+    vector<VerticeSprite> vertices;
+    bool preparado = false; // Vértices já escritos para os itens atuais (falta enviar)
+    GLint localModoAlfa = -1;
+    int modoAlfa = -1;      // Último valor enviado ao uniform
+};
+
+// Passadas do lote de sprites. Com a ordem pelo depth buffer, os texels
+// opacos escrevem profundidade numa passada e as bordas translúcidas vêm
+// depois, testando a profundidade sem escrevê-la, misturadas com o que já
+// está atrás. Na ordem de pintor tudo vai na passada dos opacos.
+enum PassadaSprites { SPRITES_OPACOS = 1, SPRITES_BORDAS = 2, SPRITES_AMBAS = 3 };
+
+// Contadores de renderização do frame atual
+struct EstatisticasRender {
+    int drawCalls;
+    int drawCallsMapa;
+    int chunksVisiveis;
+    int chunksDescartados;
+    int trocasEstado;   // Programa, VAO, buffer, textura, framebuffer, mistura e profundidade (contadas nas funções de ligação)
+    int trocasEvitadas; // Programa, VAO e textura que já estavam ligados (cache de estado)
+    int uploadsUniform; // enviarUniform e envios ao bloco Quadro
+    int paginasAssadas; // Páginas do chão refeitas inteiras
+    int tilesAssados;   // Tiles desenhados nas páginas do chão
+};
+
+// Arena linear de um frame: alocar é avançar 'usado' e tudo volta de uma vez
+// no reinício. O que não cabe vai para blocos avulsos até o fim do frame; no
+// reinício o bloco cresce para o total, e depois de alguns frames a gravação
+// não aloca mais nada.
+struct ArenaQuadro {
+    unique_ptr<uint8_t[]> bloco;
+    size_t capacidade = 0, usado = 0;
+    vector<unique_ptr<uint8_t[]>> avulsos;
+    size_t bytesAvulsos = 0;
+    size_t crescimentos = 0; // Alocações fora do bloco desde o início
+};
+
+// Lista que cresce dentro de uma arena (só tipos copiáveis com memcpy)
+template <typename T>
+struct ListaArena {
+    T *dados = nullptr;
+    uint32_t n = 0, capacidade = 0;
+};
+
+// Saída de uma faixa de trabalho da gravação do frame
+struct FaixaGravada {
+    ListaArena<InstanciaTile> animados; // Tiles animados dos chunks visíveis
+    ListaArena<ItemSprite> sprites;     // Moedas ou atores
+    int chunksVisiveis = 0, chunksDescartados = 0;
+    uint64_t acertos = 0, faltas = 0;   // Streaming
+    ListaArena<uint32_t> chunksUsados;  // Streaming: residentes visíveis (a LRU é atualizada na junção)
+};
+
+// Frame em duas fases: as threads do escalonador fazem o culling dos chunks e
+// das entidades e gravam listas compactas nas arenas (uma por thread); depois
+// a thread do GL junta as faixas, na ordem, e faz as chamadas de desenho
+struct GravacaoQuadro {
+    vector<ArenaQuadro> arenas;
+    vector<FaixaGravada> mapa, moedas, atores; // Uma por faixa, na ordem
+    size_t graoMapa = 1, graoMoedas = 1, graoAtores = 1;
+    ivec2 minChunk, maxChunk;                  // Chunks sob a visão (inclusivo); vazio se min > max
+    ivec2 centroAtores;
+    int raioAtores = 0;
+    size_t totalAnimados = 0;
+    double msGravacao = 0, msSubmissao = 0; // Último frame
+};
+
+// Uniform ativo de um programa (fora de blocos), lido por reflexão ao linkar
+struct UniformShader {
+    string nome;
+    GLint local;
+};
+
+// Programa de shader com os uniforms refletidos uma vez no setup. Quem desenha
+// guarda os locais que usa; nada é consultado no driver por nome no frame.
+struct ProgramaShader {
+    GLuint id;
+    vector<UniformShader> uniforms;
+};
+
+// Dados comuns a todos os programas no frame: o bloco 'Quadro' dos shaders,
+// em layout std140, num único uniform buffer
+struct DadosQuadro {
+    mat4 projection;
+    float tempo;
+    float preenchimento[3];
+};
+const GLuint PONTO_QUADRO = 0; // Binding point do bloco Quadro
+
+// Último programa, VAO e textura (unidade 0) ligados. Toda ligação desses
+// três passa por aqui, para o cache nunca divergir do estado do GL.
+struct CacheEstadoGL {
+    GLuint programa = 0, vao = 0, textura = 0;
+};
+
+// Objeto GL vivo no gerenciador. 'bloco' é a faixa do pool de geometria usada
+// por um VAO (solta junto com ele).
+struct EntradaRecursoGPU {
+    GLuint id = 0;
+    uint8_t tipo = 0, categoria = 0;
+    uint32_t referencias = 0; // 0 = entrada livre
+    size_t bytes = 0;
+    int32_t bloco = -1;
+};
+
+// Faixa do pool de geometria estática. Geometria com os mesmos bytes é o
+// mesmo bloco, contado pelos VAOs que o usam.
+struct BlocoGeometria {
+    size_t inicio;
+    vector<uint8_t> dados;
+    uint32_t referencias;
+};
+
+// Programa compilado de um par de fontes (o par não é compilado de novo)
+struct ProgramaCompilado {
+    const GLchar *vs, *fs;
+    RecursoGPU programa;
+};
+
+// Dono de todos os objetos GL: contagem de referências, memória viva por
+// categoria, um VBO grande para a geometria estática (blocos deduplicados,
+// faixas livres reaproveitadas), o EBO do padrão de índices dos quads e o
+// cache de programas. Entra em uso na primeira criação, já com o contexto.
+struct GerenciadorRecursos {
+    bool ativo = false;
+    vector<EntradaRecursoGPU> entradas;
+    vector<uint32_t> livres;                 // Entradas reaproveitáveis
+    size_t bytes[N_CATEGORIAS_GPU] = {};
+    size_t objetos[N_CATEGORIAS_GPU] = {};
+    RecursoGPU poolVertices;
+    size_t capacidadePool = 0, usadoPool = 0;
+    vector<BlocoGeometria> blocos;
+    vector<pair<size_t, size_t>> faixasLivres; // (início, bytes), em ordem, dentro de usadoPool
+    RecursoGPU indicesQuads;
+    size_t quadsIndexados = 0;
+    vector<ProgramaCompilado> programas;
+
+    // Na saída do programa, sem encerrarRecursos: os globais que a reflexão
+    // e o cache usam já se foram, então os handles restantes só são esquecidos
+    ~GerenciadorRecursos() { ativo = false; }
+};
+const size_t POOL_GEOMETRIA_INICIAL = 64 * 1024;
+const size_t ALINHAMENTO_GEOMETRIA = 16;
+
+// Mapa dividido em chunks de CHUNK_TAM x CHUNK_TAM tiles. Cada chunk ocupa um
+// bloco contíguo de tiles (chunk a chunk, linha a linha dentro do chunk); os
+// chunks da borda são completados com células fora do mapa.
+// A caminhabilidade de cada célula fica num bitset na mesma ordem dos tiles
+// (uma linha de chunk = 32 bits), recalculado a partir do tileset.
+// 'tiles' aponta para 'armazenamento' (mapa em texto), direto para o arquivo
+// binário mapeado em memória (sem cópia) ou para uma região anônima preenchida
+// aos poucos pelo streaming.
+// 'tiposNoChunk' tem o bit t ligado se o chunk pode ter tiles do tipo t (tipos
+// a partir de 63 dividem o último bit): trocar a caminhabilidade de um tipo
+// só revisita os chunks que o têm.
+// 'tiposOriginais' guarda, para cada célula já alterada durante o jogo
+// (índice y * largura + x), o tipo que ela tinha no arquivo: é a base das
+// células alteradas dos snapshots.
+const int CHUNK_TAM = 32;
+struct MapaChunks {
+    int chunksX, chunksY;
+    uint16_t *tiles;
+    size_t nCelulas;
+    vector<uint16_t> armazenamento;
+    void *mapeado;
+    size_t tamanhoMapeado;
+    bool anonimo;
+    vector<uint64_t> caminhavel;
+    vector<uint64_t> tiposNoChunk;
+    unordered_map<uint32_t, uint16_t> tiposOriginais;
+    uint64_t hashConteudo; // Dos tiles como carregados (ver hashConteudoMapa)
+    bool hashPendente;     // Streaming: calculado do arquivo no primeiro uso
+};
+
+// Cabeçalho do formato binário de mapa (.tmap). Depois do cabeçalho vêm os
+// tiles (uint16_t, já na ordem em chunks) e a lista de tiles bloqueados (int32_t).
+const char MAPA_BIN_MAGICA[4] = { 'T', 'M', 'A', 'P' };
+const uint32_t MAPA_BIN_VERSAO = 1;
+struct CabecalhoMapaBin {
+    char magica[4];
+    uint32_t versao;
+    char tileset[64];
+    int32_t nTiles, tileW, tileH;
+    int32_t largura, altura;
+    int32_t chunksX, chunksY;
+    uint32_t nBloqueados;
+    uint64_t offsetTiles;
+    uint64_t offsetBloqueados;
+};
+
+// Fila lock-free de produtor único e consumidor único com capacidade fixa
+template <typename T, size_t N>
+struct FilaSPSC {
+    T itens[N];
+    atomic<size_t> inicio{0}, fim{0};
+
+    bool inserir(const T &item) {
+        size_t f = fim.load(memory_order_relaxed);
+        if (f - inicio.load(memory_order_acquire) == N) return false;
+        itens[f % N] = item;
+        fim.store(f + 1, memory_order_release);
+        return true;
+    }
+    bool remover(T &item) {
+        size_t i = inicio.load(memory_order_relaxed);
+        if (i == fim.load(memory_order_acquire)) return false;
+        item = itens[i % N];
+        inicio.store(i + 1, memory_order_release);
+        return true;
+    }
+};
+
+// Chunk lido do disco pela thread de streaming, pronto para ser aplicado
+struct ChunkCarregado {
+    size_t chunk;
+    uint16_t tiles[CHUNK_TAM * CHUNK_TAM];
+};
+
+enum EstadoChunk : uint8_t { CHUNK_AUSENTE, CHUNK_PEDIDO, CHUNK_RESIDENTE };
+const uint32_t SEM_CHUNK = UINT32_MAX;
+
+// Streaming de chunks de um .tmap ao redor do personagem. A thread de carga lê
+// os chunks pedidos e os entrega pela fila; só a thread principal escreve no mapa.
+struct StreamingMapa {
+    bool ativo = false;
+    string arquivo;
+    uint64_t offsetTiles = 0;
+    int raio = 2;                  // Raio (em chunks) mantido ao redor do personagem
+    size_t orcamentoChunks = 0;    // Máximo de chunks residentes
+    unique_ptr<atomic<uint8_t>[]> estado;
+    vector<uint32_t> ultimoUso;    // Frame do último uso de cada chunk
+    // Residentes numa lista duplamente encadeada intrusiva (índices por
+    // chunk), do uso mais recente (cabeça) ao mais antigo (cauda): usar um
+    // chunk o leva para a cabeça e o descarte sai da cauda, ambos O(1)
+    vector<uint32_t> anteriorLRU, proximoLRU;
+    uint32_t cabecaLRU = SEM_CHUNK, caudaLRU = SEM_CHUNK;
+    size_t nResidentes = 0;
+    uint32_t frame = 0;
+
+    FilaSPSC<ChunkCarregado *, 256> prontos;
+    thread trabalhador;
+    mutex mtx;
+    condition_variable cv;
+    atomic<bool> parar{false};
+    ivec2 centro;                  // Chunk do personagem (protegido por mtx)
+    ivec2 direcao;                 // Última direção de movimento (protegido por mtx)
+    atomic<uint64_t> versaoPedido{0};
+
+    // Estatísticas
+    uint64_t acertos = 0, faltas = 0, travamentos = 0;
+    uint64_t carregados = 0, descartados = 0;
+    atomic<uint64_t> errosLeitura{0}; // Chunks que não vieram inteiros do disco (publicados zerados)
+};
+
+// Arquivos vigiados pela recarga a quente
+enum TipoArquivoVigiado : uint8_t { VIGIADO_MAPA, VIGIADO_BLOQUEADOS, VIGIADO_SPRITESHEET };
+
+struct ArquivoVigiado {
+    string caminho;
+    string diretorio, nome;  // O inotify vigia o diretório (editores gravam por cima com rename)
+    TipoArquivoVigiado tipo;
+    int regiao;              // Região do atlas (spritesheets)
+    int vigia;               // Watch descriptor do diretório
+    int64_t modificacao;     // Última data de modificação vista (sem inotify)
+    bool mudou;              // Aguardando releitura
+};
+
+// Tile do mapa diferente na nova versão do arquivo
+struct CelulaAlterada {
+    int x, y;
+    uint16_t tipo;
+};
+
+// Resultado de uma releitura feita pela thread da recarga
+struct ReleituraArquivo {
+    int arquivo;                     // Índice em RecargaQuente::arquivos
+    string erro;                     // Vazio = pode aplicar
+    vector<CelulaAlterada> celulas;  // Mapa: diferenças para a versão anterior do arquivo
+    vector<int> bloqueados;          // tiles_bloqueados.txt
+    unsigned char *pixels;           // Spritesheet decodificada (w x h da região)
+    double msLeitura;                // Leitura e comparação (ou decodificação)
+};
+
+// Recarga a quente (--observar): o inotify avisa quais arquivos foram
+// gravados (sem inotify, a data de modificação é conferida a cada meio
+// segundo); uma thread relê e compara um arquivo por vez e a thread principal
+// só aplica as diferenças
+struct RecargaQuente {
+    bool ativo = false;
+    int fd = -1;                 // inotify
+    vector<ArquivoVigiado> arquivos;
+    bool guardarTexto = false;   // loadMapConfig entrega o texto que interpretou em textoMapa
+    string textoMapa;            // Última versão aceita do arquivo do mapa (só a thread da recarga mexe)
+    thread trabalhador;
+    bool emAndamento = false;
+    atomic<bool> pronto{false};
+    ReleituraArquivo resultado;
+    chrono::steady_clock::time_point ultimaVerificacao;
+    double msUltimaAplicacao = 0.0; // Na thread principal
+    uint64_t aplicadas = 0;
+};
+
+// Snapshot binário do estado da partida (F5/F9 e rebobinar). O mapa entra
+// por referência (tileset, dimensões e hash do conteúdo carregado) mais as
+// células alteradas desde a carga. Depois do cabeçalho vêm, cada seção alinhada em 8 bytes: as moedas
+// coletadas (um bit por moeda), os atores em SoA (células, destinos,
+// progresso como base e tick de início, sementes e linhas), o caminho do
+// clique para mover e as células alteradas (índices y * largura + x em ordem
+// crescente, depois os tipos).
+// As seções de tamanho variável ficam no fim, para que snapshots seguidos
+// tenham os mesmos bytes nas mesmas posições.
+const char SNAPSHOT_MAGICA[4] = { 'T', 'G', 'S', 'S' };
+const uint32_t SNAPSHOT_VERSAO = 2;
+struct CabecalhoSnapshot {
+    char magica[4];
+    uint32_t versao;
+    uint64_t bytes;          // Snapshot inteiro, com o cabeçalho
+    char tileset[64];
+    int32_t nTiles, largura, altura;
+    int32_t flagReached;
+    uint64_t tick;
+    uint64_t nMoedas, nAtores;
+    uint64_t nCaminho, passoCaminho;
+    uint64_t nCelulasAlteradas;
+    vec2 pos, ultimaDirecao;
+    int32_t iAnimation, iFrame;
+    int32_t ticksAtePasso;
+    uint32_t reservado;
+    uint64_t hashMapa;       // hashConteudoMapa() na gravação
+};
+static_assert(sizeof(CabecalhoSnapshot) % 8 == 0, "As seções do snapshot começam alinhadas em 8 bytes");
+
+// Início de cada seção do snapshot (e o tamanho total), a partir do cabeçalho
+struct SecoesSnapshot {
+    size_t moedas, celulas, destinos, progressoBase, inicioPasso, sementes, linhas, caminho, indicesMapa, tiposMapa, total;
+};
+
+// Delta guardado no histórico: posição no anel de bytes
+struct EntradaHistorico {
+    size_t inicio, bytes;
+};
+
+// Histórico para rebobinar: o snapshot mais recente fica inteiro e cada
+// anterior vira um delta reverso (XOR com o seguinte, bytes nulos em RLE)
+// num anel de bytes de tamanho fixo. Voltar um passo desfaz o delta mais
+// novo; sem espaço ou com 'entradas' cheio, os mais antigos são descartados.
+struct HistoricoSnapshots {
+    bool ativo = false;
+    bool voltando = false;             // Backspace pressionado
+    vector<uint8_t> atual;             // Snapshot do último passo
+    vector<uint8_t> rascunho;          // Snapshot novo ou anterior reconstruído
+    vector<uint8_t> delta;
+    unique_ptr<uint8_t[]> dados;       // Anel de bytes dos deltas (páginas só usadas quando escritas)
+    size_t capacidade = 0;
+    vector<EntradaHistorico> entradas; // Anel de índices: um passo por entrada
+    size_t primeira = 0, nEntradas = 0;
+    size_t bytesUsados = 0;
+    uint64_t descartados = 0;
+    double orcamentoMs = 0;            // Média máxima por passo antes de desligar (0 = sem limite)
+    double msMedio = 0;                // Média móvel do custo de registrarSnapshot
+    size_t registros = 0;
+};
+
+// Câmera que segue o personagem, em coordenadas de mundo (pixels isométricos)
+struct Camera {
+    vec2 centro;
+    vec2 centroAnterior; // Centro no passo de simulação anterior
+    vec2 visao;          // Centro interpolado usado no desenho e no descarte
+    vec2 tamanho;
+};
+
+// Passo fixo da simulação (movimento, coleta e bandeira), independente do desenho
+const double PASSO_SIMULACAO = 1.0 / 60.0;
+
+// Guardar um passo custa proporcional ao número de entidades: acima deste
+// número de atores o histórico só liga com --rebobinar explícito
+const size_t ATORES_MAX_HISTORICO = 100000;
+// Fração do passo de simulação que o histórico pode gastar em média
+const double ORCAMENTO_HISTORICO_MS = PASSO_SIMULACAO * 1000.0 / 4.0;
+
+// Escalonador de tarefas com roubo de trabalho: cada thread tem sua fila de
+// faixas [início, fim); quem esvazia a própria fila rouba do início de outra.
+// A thread principal é a fila 0 e trabalha junto.
+struct FilaRoubo {
+    mutex mtx;
+    vector<pair<size_t, size_t>> tarefas; // Pendentes em [inicio, size()); vetor e não deque para
+    size_t inicio = 0;                    // não alocar a cada rodada (a capacidade fica)
+};
+
+struct EscalonadorTarefas {
+    vector<thread> threads;
+    vector<unique_ptr<FilaRoubo>> filas;
+    const function<void(size_t, size_t)> *corpo = nullptr; // Trabalho da rodada atual
+    atomic<size_t> pendentes{0};
+    mutex mtx;
+    condition_variable cv;
+    uint64_t geracao = 0; // Protegido por mtx: muda a cada rodada
+    bool parar = false;
+};
+
+// Velocidade dos atores, em tiles por segundo
+const float VELOCIDADE_ATOR = 2.0f;
+
+// Índice espacial por célula do mapa: tabela hash da célula para uma lista
+// duplamente encadeada de entidades (ids 0..n-1 escolhidos por quem usa).
+// Inserir, remover e mover são O(1); a tabela dobra quando passa de meia carga.
+struct GradeEspacial {
+    vector<int32_t> cabeca;   // Primeira entidade de cada balde (-1 = vazio)
+    vector<int32_t> proximo;  // Encadeamento por entidade dentro do balde
+    vector<int32_t> anterior;
+    vector<ivec2> celula;     // Célula atual de cada entidade
+    vector<uint8_t> presente;
+    uint32_t mascara = 0;
+    size_t nPresentes = 0;
+};
+
+// Entrada da lista aberta das buscas de caminho (heap mínimo por f = g + h)
+struct NoAberto {
+    float f;
+    uint32_t id;
+};
+
+// Memória reaproveitada entre buscas: nada é alocado depois que os vetores
+// atingem o tamanho da maior busca. As marcas de geração dizem se g e pai
+// valem para a busca atual, então não é preciso limpar nada entre buscas.
+struct PoolBusca {
+    vector<float> g;
+    vector<uint32_t> pai;
+    vector<uint32_t> vista;   // Geração em que o nó foi aberto
+    vector<uint32_t> fechada; // Geração em que o nó foi expandido
+    vector<NoAberto> aberta;
+    uint32_t geracao = 0;
+    size_t expandidos = 0;    // Da última busca
+};
+
+// Retângulo de células (inclusivo) a que uma busca fica restrita
+struct JanelaBusca {
+    ivec2 minimo, maximo;
+};
+
+struct ArestaAbstrata {
+    uint32_t destino;
+    float custo;
+};
+
+// Grafo da busca hierárquica: um nó em cada lado das travessias entre chunks
+// vizinhos, ligados entre si (custo 1) e aos outros nós do mesmo chunk (custo
+// do menor caminho por dentro dele)
+struct GrafoAbstrato {
+    bool valido = false;
+    vector<ivec2> celula;                   // Por nó
+    vector<vector<ArestaAbstrata>> arestas; // Por nó
+    vector<vector<uint32_t>> nosDoChunk;    // Por chunk
+    PoolBusca pool;
+    vector<PoolBusca> poolsThreads;         // Montagem: um por thread do escalonador
+};
+
+// Acima de tantas células alteradas de uma vez, refazer o campo de fluxo
+// inteiro sai mais barato que atualizar célula por célula
+const size_t MAX_CELULAS_FLUXO_INCREMENTAL = 4096;
+
+// Campo de fluxo até um objetivo comum: custo de integração (menor custo até
+// o objetivo) e direção de passo por célula, no mesmo layout em chunks dos
+// tiles. Cada ator só lê a direção da célula em que está.
+struct CampoFluxo {
+    ivec2 objetivo;
+    vector<float> custo;        // Por célula (INFINITY = sem caminho)
+    vector<uint8_t> direcao;    // Por célula: índice em DIRECOES_PASSO ou SEM_DIRECAO
+    vector<float> prioridade;   // Por chunk: menor custo novo a propagar (INFINITY = nada a fazer)
+    vector<uint8_t> semearTudo; // Por chunk: custos invalidados, o Dijkstra parte de todas as células
+    vector<uint8_t> alterado;   // Por chunk: direções a refazer
+    bool pendente = false;      // Há tiles alterados desde a última atualização
+    size_t chunksRelaxados = 0; // Na última atualização
+};
+const uint8_t SEM_DIRECAO = 255;
+
+#ifndef SEM_PERFIL
+// Escopos medidos pelo profiler de frame (--perfil). Compilando com
+// -DSEM_PERFIL o profiler some do executável.
+enum EscopoPerfil {
+    PERFIL_ENTRADA, PERFIL_SIMULACAO, PERFIL_MAPA, PERFIL_ENTIDADES,
+    PERFIL_FLAG, PERFIL_PERSONAGEM, PERFIL_SPRITES, PERFIL_SWAP, PERFIL_GRAVACAO, N_ESCOPOS_PERFIL
+};
+const int FRAMES_ANEL_GPU = 4;          // Frames de consultas GL_TIME_ELAPSED em voo
+const int FRAMES_HISTORICO_PERFIL = 240; // Barras do overlay
+
+struct EventoPerfil {
+    int64_t inicioNs, duracaoNs; // Desde o início do profiler
+    uint8_t escopo, gpu;
+};
+
+struct Perfilador {
+    bool ativo = false;
+    bool overlay = false; // F3 liga e desliga
+    uint64_t frame = 0;
+    chrono::steady_clock::time_point origem;
+    int64_t inicioEscopo[N_ESCOPOS_PERFIL] = {};
+    float msCpu[N_ESCOPOS_PERFIL] = {}, msGpu[N_ESCOPOS_PERFIL] = {}; // Médias móveis
+    float cpuFrame[N_ESCOPOS_PERFIL] = {};                            // Frame atual
+    float historicoCpu[FRAMES_HISTORICO_PERFIL][N_ESCOPOS_PERFIL] = {};
+    float historicoGpu[FRAMES_HISTORICO_PERFIL] = {};
+    GLuint consultas[FRAMES_ANEL_GPU][N_ESCOPOS_PERFIL] = {};
+    int64_t inicioConsulta[FRAMES_ANEL_GPU][N_ESCOPOS_PERFIL]; // -1 = consulta não usada no frame
+    uint64_t consultasPerdidas = 0; // Resultados que não ficaram prontos a tempo
+    vector<EventoPerfil> eventos;   // Para o trace (reservado no início)
+    size_t maxEventos = 0;
+    string arquivoTrace;
+    RecursoGPU VAO, VBO; // Overlay
+    GLuint shaderID = 0;
+    GLint localProjecao = -1;
+    vector<GLfloat> vertices;
+};
+#endif
+
+// Níveis do log de eventos. Chamadas abaixo de NIVEL_LOG_MINIMO somem na
+// compilação (-DNIVEL_LOG_MINIMO=1 tira o movimento, =4 tira tudo).
+enum NivelLog { LOG_DEPURACAO, LOG_INFO, LOG_AVISO, LOG_ERRO, LOG_DESLIGADO };
+#ifndef NIVEL_LOG_MINIMO
+#define NIVEL_LOG_MINIMO LOG_DEPURACAO
+#endif
+
+enum TipoEventoLog {
+    EVENTO_MOVIMENTO, EVENTO_MOEDA, EVENTO_BANDEIRA, EVENTO_CAMINHO, EVENTO_SEM_CAMINHO, N_TIPOS_EVENTO_LOG
+};
+
+// Registro binário de tamanho fixo: é o que passa pelo anel e o que vai para
+// o arquivo de --log
+struct RegistroLog {
+    uint64_t tempoNs; // Desde iniciarLog
+    uint64_t tick;    // tickSimulacao no momento do evento
+    int32_t a, b, c;  // Dados do evento: célula, id da moeda, passos...
+    float valor;
+    uint8_t nivel, tipo;
+    uint16_t thread;  // Ordem em que a thread registrou o primeiro evento
+    uint32_t reservado;
+};
+static_assert(sizeof(RegistroLog) == 40, "RegistroLog faz parte do formato do arquivo de log");
+
+struct CabecalhoLog {
+    char magica[4];
+    uint32_t versao;
+    uint32_t tamanhoRegistro;
+    uint32_t reservado;
+};
+const uint32_t VERSAO_LOG = 1;
+
+// Anel de uma thread: só ela escreve (avança 'cabeca') e só o escritor lê
+// (avança 'cauda'). Cheio, o registro é descartado e contado; quem loga nunca
+// espera. 'caudaVista' é a cópia da cauda do lado de quem escreve, relida só
+// quando o anel parece cheio, para não disputar a linha de cache com o escritor.
+const uint32_t CAPACIDADE_ANEL_LOG = 1 << 16;
+struct AnelLog {
+    alignas(64) atomic<uint32_t> cabeca{0};
+    uint32_t caudaVista = 0;
+    atomic<uint64_t> descartados{0};
+    uint16_t thread = 0;
+    alignas(64) atomic<uint32_t> cauda{0};
+    RegistroLog registros[CAPACIDADE_ANEL_LOG];
+};
+
+struct LogEventos {
+    atomic<bool> ativo{false}; // Algum destino ligado
+    bool texto = false;        // Mensagens no terminal
+    FILE *arquivo = nullptr;   // Registros binários (--log)
+    chrono::steady_clock::time_point inicio;
+    mutex mtxAneis;            // Só para criar anéis e para o escritor listá-los
+    vector<unique_ptr<AnelLog>> aneis;
+    thread escritor;
+    atomic<bool> parar{false};
 };
 
 // ------------------------------
 // Variáveis globais
 // ------------------------------
+GerenciadorRecursos recursosGPU; // Antes de tudo que guarda handles (destruído por último)
 Sprite flag;
 bool flagReached = false;
 
 string tilesetFile;
 int nTiles, tileW, tileH;
 int tilemapWidth, tilemapHeight;
-vector<vector<int>> mapConfig;
+MapaChunks mapa;
 vector<Tile> tileset;
 vec2 pos; // Posição do personagem no mapa
+vector<int> tilesBloqueados; // Índices de tiles não caminháveis
+bool bloqueadosNoMapa = false; // Lista veio junto com o mapa binário
 
 Sprite personagem; // Sprite do personagem
 
-vector<Moeda> moedas; // Vetor de moedas
-GLuint moedaTexID;
-int moedaW, moedaH;
+Entidades entidades;                  // Moedas e atores (SoA)
+vector<AparenciaEntidade> aparencias(2); // Por TipoEntidade
+GradeEspacial gradeEntidades;         // Moedas não coletadas e atores, por célula (id = entidade)
+ivec2 celulaBandeira;                 // Tile em que o personagem alcança a bandeira
+EscalonadorTarefas escalonador;       // Sistemas paralelos da simulação e gravação do frame
+thread_local size_t indiceThreadEscalonador = 0; // Fila da thread atual (0 = principal)
+int threadsSimulacao = 0;             // 0 = uma thread por núcleo
+
+Atlas atlas; // Todas as spritesheets numa textura só
+PipelineTexturas pipelineTexturas;
+int threadsDecodificacao = 0; // 0 = uma thread por núcleo
+TileLayer camadaMapa; // Camada instanciada do chão
+ChaoPreRenderizado chao; // Páginas do chão já desenhadas
+SpriteBatch loteSprites; // Lote por frame: bandeira e personagem
+SpriteBatch loteMoedas;  // Lote persistente das moedas (refeito só na coleta)
+                         // (os atores visíveis entram no loteSprites a cada frame)
+GravacaoQuadro gravacao; // Listas do frame gravadas em paralelo
+vector<vec2> tilesAnimados; // (nFrames, fps) por índice de tile; fps 0 = estático
+EstatisticasRender estatisticas;
+GLuint framebufferTela = 0;       // Onde a cena é desenhada: 0 na janela, o FBO do --bench-render
+vector<RecursoGPU> alvoOffscreen; // FBO e renderbuffers do contexto sem janela
+vector<ProgramaShader> programasShader; // Uniforms refletidos de cada programa
+CacheEstadoGL cacheEstado;
+RecursoGPU uboQuadro;             // Projeção e tempo do frame (bloco Quadro)
+GLint localModel = -1, localOffsetTex = -1; // Uniforms do programa principal (desenharAtualTile)
+bool ordemNaCpu = false;          // Sprites ordenados na CPU (pintor) em vez do depth buffer (--bench-ordem)
+Camera camera;
+StreamingMapa streaming;
+RecargaQuente recargaQuente;      // --observar
+HistoricoSnapshots historico;     // Rebobinar (Backspace)
+string arquivoSnapshot = "partida.tgs"; // F5 salva, F9 carrega
+vec2 ultimaDirecao; // Direção do último movimento (pré-carga do streaming)
+vec2 posAnterior;   // Posição do personagem no passo anterior (interpolação)
+vector<int> comandosPendentes; // Teclas recebidas desde o último passo de simulação
+vector<uint8_t> tiposCaminhaveis; // Caminhabilidade por tipo de tile (base do bitset, sem GL)
+uint64_t tickSimulacao = 0;       // Passos de regras desde o início da partida
+bool logSimulacao = true;         // Eventos do log (movimento, coleta...) também no terminal
+ofstream roteiroGravacao;         // Aberto com --gravar-roteiro: teclas por tick
+PoolBusca poolBusca;              // A* e JPS no mapa inteiro
+PoolBusca poolJanela;             // Buscas dentro de um chunk
+GrafoAbstrato grafoAbstrato;      // Refeito quando a caminhabilidade muda
+vector<ivec2> caminhoAtual;       // Clique para mover: caminho do personagem até o alvo
+bool haPedidoCaminho = false;     // Clique ainda não atendido (a busca roda no passo de simulação)
+ivec2 pedidoCaminho;
+size_t passoCaminho = 0;          // Próxima célula de caminhoAtual
+int ticksAtePasso = 0;
+const int TICKS_POR_PASSO = 8;    // Ritmo da caminhada (~7,5 tiles/s)
+CampoFluxo campoFluxo;            // Até a bandeira (montado com --multidao)
+bool multidao = false;            // Atores seguem o campo de fluxo em vez de andar ao acaso
+#ifndef SEM_PERFIL
+Perfilador perfil;                // Profiler de frame (--perfil)
+#endif
+LogEventos logEventos;            // Movimento, coleta e caminhos (terminal e --log)
+thread_local AnelLog *anelLog = nullptr; // Anel da thread atual (criado no primeiro evento)
 
 // ------------------------------
 // Protótipos de funções
 // ------------------------------
 int setupShader();
-int setupSprite(int nAnimations, int nFrames, float &ds, float &dt);
-int setupTile(int nTiles, float &ds, float &dt);
+int setupShaderProgram(const GLchar *vsSource, const GLchar *fsSource);
+GLint localUniform(GLuint programa, const char *nome);
+void usarPrograma(GLuint programa);
+void ligarVAO(GLuint vao);
+void ligarTextura(GLuint textura);
+void ligarBuffer(GLenum alvo, GLuint buffer);
+void ligarFramebuffer(GLuint fbo);
+void escreverProfundidade(bool escreve);
+void funcaoProfundidade(GLenum funcao);
+void definirMistura(GLenum origem, GLenum destino, GLenum origemAlfa, GLenum destinoAlfa);
+void definirMistura(GLenum origem, GLenum destino);
+void enviarUniform(GLint local, int valor);
+void enviarUniform(GLint local, const mat4 &valor);
+void setupQuadro();
+RecursoGPU criarRecursoGPU(TipoRecursoGPU tipo, CategoriaGPU categoria);
+void definirBytesRecurso(const RecursoGPU &recurso, size_t bytes);
+size_t alocarGeometria(const RecursoGPU &vao, const void *dados, size_t bytes);
+GLuint eboQuads(size_t nQuads);
+size_t bytesGPU();
+string resumoRecursosGPU();
+void encerrarRecursos();
+void enviarQuadro(const mat4 &projecao, float tempo);
+void enviarProjecaoQuadro(const mat4 &projecao);
+void setupSpriteBatch(SpriteBatch &lote, bool persistente);
+void adicionarSprite(SpriteBatch &lote, int camada, GLuint texID, vec3 position, vec3 dimensions, vec2 uvBase, float ds, float dt, AnimacaoSprite animacao);
+void prepararSpriteBatch(SpriteBatch &lote);
+void desenharSpriteBatch(SpriteBatch &lote, PassadaSprites passada = SPRITES_AMBAS);
+void carregarTilesAnimados(const string& filename);
+RecursoGPU setupTile(int nTiles, vec2 uvTam, float &ds, float &dt);
 int loadTexture(string filePath, int &width, int &height);
-void desenharMapa(GLuint shaderID);
+void carregarAtlas(Atlas &atlas, const vector<string> &arquivos, const string& cacheFile);
+const RegiaoAtlas &regiaoAtlas(const string& arquivo);
+void atualizarPipelineTexturas(double orcamentoMs);
+void encerrarPipelineTexturas();
+void alocarMapa(int largura, int altura);
+void setupTileLayer(TileLayer &layer, const RegiaoAtlas &regiao, GLuint texID);
+bool chunkVisivel(const TileLayer &layer, int cx, int cy);
+void chunksSobVisao(const TileLayer &layer, ivec2 &minimo, ivec2 &maximo);
+void atualizarCamera(float dt);
+void interpolarCamera(float alfa);
+mat4 projecaoCamera();
+float profundidadeIsometrica(vec2 c);
+bool passoSimulacao(float dt);
+void iniciarSimulacao(int moedasExtras, int nAtores);
+void atualizarEntidades(float dt);
+bool tickRegras(const int *teclas, size_t nTeclas);
+void moverPersonagem(int key);
+void verificarColisoes();
+uint64_t hashEstadoSimulacao();
+int simulacaoHeadless(int argc, char **argv);
+double proximaTrocaAnimacao(double agora);
+void desenharMapa();
+const vector<InstanciaTile> &animadosDoChunk(ChaoPreRenderizado &C, size_t chunk);
+void prepararAnimadosChunks(ChaoPreRenderizado &C);
+void gravarListasQuadro();
+int benchmarkGravacao(int argc, char **argv);
+void setupChao(ChaoPreRenderizado &C);
+void marcarChaoSujo(int x, int y);
+void marcarChunkChaoSujo(size_t chunk);
 void desenharAtualTile(GLuint shaderID);
-void desenharPersonagem(GLuint shaderID);
-void setupMoedas();
-void desenharMoedas(GLuint shaderID);
+void desenharPersonagem(float alfa);
+void setupAparencias();
+void desenharEntidades(PassadaSprites passada);
 void setupFlag();
-void desenharFlag(GLuint shaderID);
+void desenharFlag();
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mode);
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods);
+bool encontrarCaminho(ivec2 inicio, ivec2 fim, vector<ivec2> &caminho);
+void benchmarkMapa(int lado);
+void benchmarkCargaMapa();
+void benchmarkColisao(size_t nMoedas);
+void benchmarkEntidades(size_t nAtores, int maxThreads);
+void benchmarkCaminhos(int lado, int nPares);
+void benchmarkFluxo(size_t maxAtores, int maxThreads);
+void benchmarkLog(size_t nChamadas);
+int benchmarkRender(int argc, char **argv);
+int benchmarkOrdem(int argc, char **argv);
+int benchmarkRecargas(int argc, char **argv);
+bool loadMapConfig(const string& filename);
+bool lerTextoArquivo(const string& caminho, string &texto);
+void carregarTilesBloqueados(const string& filename);
+void aplicarTilesBloqueados();
+bool iniciarRecargaQuente(const string& arquivoMapa);
+bool atualizarRecargaQuente();
+void encerrarRecargaQuente();
+int benchmarkRecargaQuente(int argc, char **argv);
+void iniciarHistorico(HistoricoSnapshots &H, double segundos, size_t orcamentoMB, double orcamentoMs);
+void registrarSnapshot(HistoricoSnapshots &H);
+bool voltarSnapshot(HistoricoSnapshots &H);
+bool salvarSnapshot(const string& filename);
+bool carregarSnapshot(const string& filename);
+int benchmarkSnapshots(int argc, char **argv);
 
 // ------------------------------
-// Função para carregar configuração do mapa
+// Acesso ao mapa em chunks
 // ------------------------------
-bool loadMapConfig(const string& filename) {
-    ifstream file(filename);
-    if (!file.is_open()) {
-        cerr << "Erro ao abrir " << filename << endl;
-        return false;
-    }
-    string line;
-    // Linha 1: tilesetIso.png 7 57 114
-    getline(file, line);
-    stringstream ss(line);
-    ss >> tilesetFile >> nTiles >> tileW >> tileH;
+// Sem sinal: divisão e resto viram deslocamento e máscara
+inline size_t indiceTileChunks(unsigned ux, unsigned uy, size_t chunksX) {
+    size_t chunk = (size_t)(uy / CHUNK_TAM) * chunksX + (ux / CHUNK_TAM);
+    return chunk * CHUNK_TAM * CHUNK_TAM + (uy % CHUNK_TAM) * CHUNK_TAM + (ux % CHUNK_TAM);
+}
 
-    // Linha 2: largura altura
-    getline(file, line);
-    ss.clear(); ss.str(line);
-    ss >> tilemapWidth >> tilemapHeight;
+inline size_t indiceTile(int x, int y) {
+    return indiceTileChunks(x, y, mapa.chunksX);
+}
 
-    // Linhas seguintes: mapa
-    mapConfig.clear();
-    for (int i = 0; i < tilemapHeight; ++i) {
-        getline(file, line);
-        ss.clear(); ss.str(line);
-        vector<int> row;
-        for (int j = 0; j < tilemapWidth; ++j) {
-            int v; ss >> v;
-            row.push_back(v);
+// Mapas fora do modo streaming estão sempre inteiros na memória
+inline bool chunkResidente(size_t chunk) {
+    return !streaming.ativo || streaming.estado[chunk] == CHUNK_RESIDENTE;
+}
+
+inline int tileEm(int x, int y) {
+    return mapa.tiles[indiceTile(x, y)];
+}
+
+// Consulta o bitset de caminhabilidade; células fora do mapa não são caminháveis
+inline bool celulaCaminhavel(int x, int y) {
+    if (x < 0 || y < 0 || x >= tilemapWidth || y >= tilemapHeight) return false;
+    size_t i = indiceTile(x, y);
+    return (mapa.caminhavel[i >> 6] >> (i & 63)) & 1;
+}
+
+// Consulta em lote: escreve 1/0 em resultado[k] para cada célula e retorna
+// quantas são caminháveis. Dimensões e bitset vão para locais uma vez: as escritas
+// em resultado (uint8_t) podem apelidar os globais e forçariam releituras por célula
+size_t consultarCaminhaveis(const ivec2 *celulas, size_t n, uint8_t *resultado) {
+    const unsigned largura = tilemapWidth, altura = tilemapHeight;
+    const size_t chunksX = mapa.chunksX;
+    const uint64_t *bits = mapa.caminhavel.data();
+    size_t total = 0;
+    for (size_t k = 0; k < n; k++) {
+        unsigned x = celulas[k].x, y = celulas[k].y; // Negativos viram enormes: um teste por eixo
+        uint8_t v = 0;
+        if (x < largura && y < altura) {
+            size_t i = indiceTileChunks(x, y, chunksX);
+            v = (bits[i >> 6] >> (i & 63)) & 1;
         }
-        mapConfig.push_back(row);
+        resultado[k] = v;
+        total += v;
     }
-    file.close();
+    return total;
+}
+
+// Consulta em lote de uma faixa horizontal: o bit k de 'saida' diz se (x0 + k, y)
+// é caminhável. A faixa é recortada no mapa uma vez e cada linha de chunk sai do
+// bitset numa palavra só (CHUNK_TAM bits contíguos); retorna quantas são caminháveis
+static_assert(64 % CHUNK_TAM == 0, "Cada linha de chunk precisa caber numa palavra do bitset");
+size_t consultarCaminhaveisLinha(int x0, int y, int n, uint64_t *saida) {
+    fill(saida, saida + ((size_t) glm::max(n, 0) + 63) / 64, 0);
+    if (y < 0 || y >= tilemapHeight) return 0;
+    const uint64_t *bits = mapa.caminhavel.data();
+    size_t total = 0;
+    for (int x = glm::max(x0, 0), fim = glm::min(x0 + n, tilemapWidth); x < fim; ) {
+        int trecho = glm::min(fim - x, CHUNK_TAM - x % CHUNK_TAM);
+        size_t i = indiceTile(x, y);
+        uint64_t v = bits[i >> 6] >> (i & 63);
+        if (trecho < 64) v &= (1ULL << trecho) - 1;
+        total += bitset<64>(v).count();
+        size_t k = (size_t)(x - x0);
+        saida[k >> 6] |= v << (k & 63);
+        if ((k & 63) + trecho > 64) saida[(k >> 6) + 1] |= v >> (64 - (k & 63));
+        x += trecho;
+    }
+    return total;
+}
+
+// Verdadeiro se todas as n células forem caminháveis (para no primeiro bloqueio)
+bool todasCaminhaveis(const ivec2 *celulas, size_t n) {
+    for (size_t k = 0; k < n; k++)
+        if (!celulaCaminhavel(celulas[k].x, celulas[k].y)) return false;
     return true;
 }
 
-// ------------------------------
-// Função para carregar tiles não caminháveis de um arquivo
-// ------------------------------
-void carregarTilesBloqueados(const string& filename) {
-    ifstream file(filename);
-    if (!file.is_open()) {
-        cerr << "Erro ao abrir " << filename << endl;
-        return;
+// Bit do tipo de tile em MapaChunks::tiposNoChunk
+inline uint64_t bitTipo(int t) {
+    return (uint64_t)1 << glm::min(t, 63);
+}
+
+// Recalcula os bits de caminhabilidade de um chunk a partir do tileset atual
+// (e os tipos presentes nele)
+void reconstruirCaminhabilidadeChunk(size_t chunk) {
+    const size_t tilesPorChunk = CHUNK_TAM * CHUNK_TAM;
+    grafoAbstrato.valido = false;
+    uint64_t tipos = 0;
+    for (size_t i = chunk * tilesPorChunk; i < (chunk + 1) * tilesPorChunk; i++) {
+        int t = mapa.tiles[i];
+        uint64_t bit = (uint64_t)1 << (i & 63);
+        if (t < (int)tiposCaminhaveis.size() && tiposCaminhaveis[t]) mapa.caminhavel[i >> 6] |= bit;
+        else mapa.caminhavel[i >> 6] &= ~bit;
+        tipos |= bitTipo(t);
     }
-    int idx;
-    while (file >> idx) {
-        if (idx >= 0 && idx < (int)tileset.size())
-            tileset[idx].caminhavel = false;
+    if (chunk < mapa.tiposNoChunk.size()) mapa.tiposNoChunk[chunk] = tipos;
+}
+
+// Recalcula o bitset de caminhabilidade dos chunks residentes
+void reconstruirCaminhabilidade() {
+    grafoAbstrato.valido = false;
+    mapa.caminhavel.assign((mapa.nCelulas + 63) / 64, 0);
+    size_t nChunks = (size_t) mapa.chunksX * mapa.chunksY;
+    mapa.tiposNoChunk.assign(nChunks, ~(uint64_t)0);
+    for (size_t c = 0; c < nChunks; c++)
+        if (chunkResidente(c)) reconstruirCaminhabilidadeChunk(c);
+}
+
+// Desfaz o mapeamento do arquivo binário (ou a região do streaming), se houver
+void liberarMapa() {
+    if (mapa.mapeado) {
+#ifdef _WIN32
+        if (mapa.anonimo) VirtualFree(mapa.mapeado, 0, MEM_RELEASE);
+        else UnmapViewOfFile(mapa.mapeado);
+#else
+        munmap(mapa.mapeado, mapa.tamanhoMapeado);
+#endif
+        mapa.mapeado = nullptr;
+        mapa.tamanhoMapeado = 0;
+        mapa.anonimo = false;
     }
-    file.close();
+    mapa.tiles = nullptr;
+    mapa.nCelulas = 0;
+    mapa.tiposOriginais.clear();
+    mapa.hashConteudo = 0;
+    mapa.hashPendente = false;
 }
 
-// ------------------------------
-// Shaders (GLSL)
-// ------------------------------
-const GLchar *vertexShaderSource = R"(
- #version 400
- layout (location = 0) in vec3 position;
- layout (location = 1) in vec2 texc;
- out vec2 tex_coord;
- uniform mat4 model;
- uniform mat4 projection;
- void main()
- {
-    tex_coord = texc;
-    gl_Position = projection * model * vec4(position, 1.0);
- }
- )";
+void definirDimensoesMapa(int largura, int altura) {
+    tilemapWidth = largura;
+    tilemapHeight = altura;
+    mapa.chunksX = (largura + CHUNK_TAM - 1) / CHUNK_TAM;
+    mapa.chunksY = (altura + CHUNK_TAM - 1) / CHUNK_TAM;
+    mapa.nCelulas = (size_t)mapa.chunksX * mapa.chunksY * CHUNK_TAM * CHUNK_TAM;
+}
 
-const GLchar *fragmentShaderSource = R"(
- #version 400
- in vec2 tex_coord;
- out vec4 color;
- uniform sampler2D tex_buff;
- uniform vec2 offsetTex;
- void main()
- {
-     color = texture(tex_buff,tex_coord + offsetTex);
- }
- )";
+void alocarMapa(int largura, int altura) {
+    liberarMapa();
+    definirDimensoesMapa(largura, altura);
+    mapa.armazenamento.assign(mapa.nCelulas, 0);
+    mapa.tiles = mapa.armazenamento.data();
+    mapa.caminhavel.assign((mapa.nCelulas + 63) / 64, 0);
+}
 
-// ------------------------------
-// Função para configurar a bandeira animada
-// ------------------------------
-void setupFlag() {
-    int flagW, flagH;
-    GLuint flagTexID = loadTexture("flag animation.png", flagW, flagH); 
-    flag.nAnimations = 1; // Número de linhas no spritesheet
-    flag.nFrames = 5;     // Número de frames de animação
-    flag.iAnimation = 0;
-    flag.iFrame = 0;
-    flag.dimensions = vec3(tileH/1.3, tileW/1.3, 1.0); // Tamanho da flag
-    flag.texID = flagTexID;
-    float ds, dt;
-    flag.VAO = setupSprite(flag.nAnimations, flag.nFrames, ds, dt);
-    flag.ds = ds;
-    flag.dt = dt;
-    float x0 = 470, y0 = 100;
-    int lastX = tilemapWidth - 1, lastY = tilemapHeight - 1;
-    flag.position = vec3(
-        x0 + (lastX-lastY) * tileset[0].dimensions.x/2.0,
-        y0 + (lastX+lastY) * tileset[0].dimensions.y/2.0 - 10,
-        0.0
-    );
+// Parcela de uma célula (índice na ordem em chunks) no hash do conteúdo do
+// mapa. O hash é a soma das parcelas, então não depende da ordem de leitura.
+inline uint64_t parcelaHashMapa(size_t i, uint16_t tipo) {
+    uint64_t x = ((uint64_t) i << 16 | tipo) + 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
 }
 
-// ------------------------------
-// Função para desenhar a bandeira animada
-// ------------------------------
-void desenharFlag(GLuint shaderID) {
-    static double lastFrameTime = glfwGetTime();
-    double now = glfwGetTime();
-    if (now - lastFrameTime > 0.1) { // 10 FPS
-        flag.iFrame = (flag.iFrame + 1) % flag.nFrames;
-        lastFrameTime = now;
-    }
-    if (flagReached) return;
-    mat4 model = mat4(1);
-    model = translate(model, flag.position);
-    model = scale(model, flag.dimensions);
-    glUniformMatrix4fv(glGetUniformLocation(shaderID, "model"), 1, GL_FALSE, value_ptr(model));
-    glUniform2f(glGetUniformLocation(shaderID, "offsetTex"), flag.iFrame * flag.ds, flag.iAnimation * flag.dt);
-    glBindVertexArray(flag.VAO);
-    glBindTexture(GL_TEXTURE_2D, flag.texID);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+uint64_t somarHashMapa(const uint16_t *tiles, size_t inicio, size_t n) {
+    uint64_t h = 0;
+    for (size_t k = 0; k < n; k++) h += parcelaHashMapa(inicio + k, tiles[k]);
+    return h;
 }
 
-// ------------------------------
-// Função para configurar as moedas animadas
-// ------------------------------
-void setupMoedas() {
-    moedaTexID = loadTexture("coin_Sheet.png", moedaW, moedaH);
-    vector<vec2> posicoesMoedas = {
-        {1, 1}, {3, 2}, {5, 3}, {2, 4}, {4, 5}
-    };
-    for (auto& pos : posicoesMoedas) {
-        Moeda moeda;
-        moeda.dimensions = vec3(tileH/2, tileW/2, 1.0);
-        moeda.texID = moedaTexID;
-        moeda.coletada = false;
-        moeda.totalFrames = 10;
-        moeda.frameAtual = 0;
-        moeda.tempoUltimoFrame = glfwGetTime();
-        float ds, dt;
-        moeda.VAO = setupSprite(1, moeda.totalFrames, ds, dt);
-        moeda.ds = ds;
-        moeda.dt = dt;
-        float x0 = 340;
-        float y0 = 100;
-        moeda.position = vec3(
-            x0 + (pos.x-pos.y) * tileset[0].dimensions.x/2.0,
-            y0 + (pos.x+pos.y) * tileset[0].dimensions.y/2.0 - 10,
-            0.0
-        );
-        moedas.push_back(moeda);
-    }
-}
-
-// ------------------------------
-// Função para desenhar as moedas animadas
-// ------------------------------
-void desenharMoedas(GLuint shaderID) {
-    double tempoAtual = glfwGetTime();
-    double intervaloFrame = 0.1; // 10 FPS
-    for (auto& moeda : moedas) {
-        if (!moeda.coletada) {
-            if (tempoAtual - moeda.tempoUltimoFrame > intervaloFrame) {
-                moeda.frameAtual = (moeda.frameAtual + 1) % moeda.totalFrames;
-                moeda.tempoUltimoFrame = tempoAtual;
-            }
-            mat4 model = mat4(1);
-            model = translate(model, moeda.position);
-            model = scale(model, moeda.dimensions);
-            glUniformMatrix4fv(glGetUniformLocation(shaderID, "model"), 1, GL_FALSE, value_ptr(model));
-            vec2 offsetTex;
-            offsetTex.s = moeda.frameAtual * moeda.ds;
-            offsetTex.t = 0.0;
-            glUniform2f(glGetUniformLocation(shaderID, "offsetTex"), offsetTex.s, offsetTex.t);
-            glBindVertexArray(moeda.VAO);
-            glBindTexture(GL_TEXTURE_2D, moeda.texID);
-            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-        }
-    }
+// Chamada pelos carregadores logo depois de preencher os tiles
+void calcularHashMapa() {
+    mapa.hashConteudo = somarHashMapa(mapa.tiles, 0, mapa.nCelulas);
+    mapa.hashPendente = false;
 }
 
 // ------------------------------
-// Função principal (main)
+// Índice espacial (grade hash por célula)
 // ------------------------------
-int main()
-{
-    // Carrega configuração do mapa
-    if (!loadMapConfig("map.txt")) return -1;
+inline uint32_t baldeGrade(const GradeEspacial &g, ivec2 c) {
+    return ((uint32_t) c.x * 73856093u ^ (uint32_t) c.y * 19349663u) & g.mascara;
+}
 
-    // Inicialização da GLFW
-    glfwInit();
-    glfwWindowHint(GLFW_SAMPLES, 8);
+// Prepara a grade para ids em [0, nEntidades), sem nenhuma entidade presente
+void reservarGrade(GradeEspacial &g, size_t nEntidades) {
+    size_t baldes = 16;
+    while (baldes < nEntidades * 2) baldes *= 2;
+    g.cabeca.assign(baldes, -1);
+    g.mascara = (uint32_t)(baldes - 1);
+    g.proximo.assign(nEntidades, -1);
+    g.anterior.assign(nEntidades, -1);
+    g.celula.assign(nEntidades, ivec2(0));
+    g.presente.assign(nEntidades, 0);
+    g.nPresentes = 0;
+}
 
-    // Criação da janela GLFW
-    const GLuint WIDTH = 800, HEIGHT = 600;
-    GLFWwindow *window = glfwCreateWindow(WIDTH, HEIGHT, "Jogo com Moedas Animadas", nullptr, nullptr);
-    if (!window)
-    {
-        std::cerr << "Falha ao criar a janela GLFW" << std::endl;
-        glfwTerminate();
-        return -1;
+inline void ligarNoBalde(GradeEspacial &g, int id) {
+    int32_t &cab = g.cabeca[baldeGrade(g, g.celula[id])];
+    g.anterior[id] = -1;
+    g.proximo[id] = cab;
+    if (cab >= 0) g.anterior[cab] = id;
+    cab = id;
+}
+
+inline void desligarDoBalde(GradeEspacial &g, int id) {
+    if (g.anterior[id] >= 0) g.proximo[g.anterior[id]] = g.proximo[id];
+    else g.cabeca[baldeGrade(g, g.celula[id])] = g.proximo[id];
+    if (g.proximo[id] >= 0) g.anterior[g.proximo[id]] = g.anterior[id];
+}
+
+void inserirNaGrade(GradeEspacial &g, int id, ivec2 c) {
+    if (id < 0) return;
+    if ((size_t) id >= g.presente.size()) {
+        size_t n = glm::max((size_t) id + 1, g.presente.size() * 2);
+        g.proximo.resize(n, -1);
+        g.anterior.resize(n, -1);
+        g.celula.resize(n, ivec2(0));
+        g.presente.resize(n, 0);
     }
-    glfwMakeContextCurrent(window);
+    if (g.presente[id]) return;
+    // Meia carga: dobra a tabela e reencadeia os presentes
+    if ((g.nPresentes + 1) * 2 > g.cabeca.size()) {
+        g.cabeca.assign(glm::max(g.cabeca.size() * 2, (size_t) 16), -1);
+        g.mascara = (uint32_t)(g.cabeca.size() - 1);
+        for (size_t e = 0; e < g.presente.size(); e++)
+            if (g.presente[e]) ligarNoBalde(g, (int) e);
+    }
+    g.celula[id] = c;
+    g.presente[id] = 1;
+    g.nPresentes++;
+    ligarNoBalde(g, id);
+}
 
-    // Callback de teclado
-    glfwSetKeyCallback(window, key_callback);
+void removerDaGrade(GradeEspacial &g, int id) {
+    if ((size_t) id >= g.presente.size() || !g.presente[id]) return;
+    desligarDoBalde(g, id);
+    g.presente[id] = 0;
+    g.nPresentes--;
+}
 
-    // Inicialização do GLAD
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
-    {
-        std::cerr << "Falha ao inicializar GLAD" << std::endl;
-        return -1;
+void moverNaGrade(GradeEspacial &g, int id, ivec2 c) {
+    if (id < 0) return;
+    if ((size_t) id >= g.presente.size() || !g.presente[id]) { inserirNaGrade(g, id, c); return; }
+    if (g.celula[id] == c) return;
+    if (baldeGrade(g, g.celula[id]) == baldeGrade(g, c)) { g.celula[id] = c; return; }
+    desligarDoBalde(g, id);
+    g.celula[id] = c;
+    ligarNoBalde(g, id);
+}
+
+// Chama f(id) para cada entidade na célula c. O próximo da lista é lido antes
+// de f, então f pode remover a entidade atual.
+template <typename F>
+void paraCadaNaCelula(const GradeEspacial &g, ivec2 c, F f) {
+    if (g.cabeca.empty()) return;
+    for (int32_t id = g.cabeca[baldeGrade(g, c)]; id >= 0; ) {
+        int32_t prox = g.proximo[id];
+        if (g.celula[id] == c) f(id);
+        id = prox;
     }
+}
 
-    // Informações de versão
-    const GLubyte *renderer = glGetString(GL_RENDERER);
-    const GLubyte *version = glGetString(GL_VERSION);
-    cout << "Renderer: " << renderer << endl;
-    cout << "OpenGL version supported " << version << endl;
+// Entidades nas células a até 'raio' tiles de c (em x e em y)
+template <typename F>
+void paraCadaNoRaio(const GradeEspacial &g, ivec2 c, int raio, F f) {
+    for (int y = c.y - raio; y <= c.y + raio; y++)
+        for (int x = c.x - raio; x <= c.x + raio; x++)
+            paraCadaNaCelula(g, ivec2(x, y), f);
+}
 
-    // Viewport
-    int width, height;
-    glfwGetFramebufferSize(window, &width, &height);
-    glViewport(0, 0, width, height);
+// ------------------------------
+// Escalonador de tarefas com roubo de trabalho
+// ------------------------------
 
-    // Compila shaders
-    GLuint shaderID = setupShader();
+// Pega uma tarefa: primeiro do fim da própria fila, senão rouba do início de outra
+bool pegarTarefa(EscalonadorTarefas &e, size_t indice, pair<size_t, size_t> &tarefa) {
+    size_t nFilas = e.filas.size();
+    for (size_t k = 0; k < nFilas; k++) {
+        FilaRoubo &f = *e.filas[(indice + k) % nFilas];
+        lock_guard<mutex> trava(f.mtx);
+        if (f.inicio == f.tarefas.size()) continue;
+        if (k == 0) { tarefa = f.tarefas.back(); f.tarefas.pop_back(); }
+        else tarefa = f.tarefas[f.inicio++];
+        if (f.inicio == f.tarefas.size()) { f.tarefas.clear(); f.inicio = 0; }
+        return true;
+    }
+    return false;
+}
 
-    // Carrega textura do tileset
-    int imgWidth, imgHeight;
-    GLuint texID = loadTexture(tilesetFile, imgWidth, imgHeight);
+// Quem termina a última tarefa da rodada acorda quem a pediu (na mesma cv;
+// as threads que dormem esperando outra rodada voltam a dormir)
+void executarTarefas(EscalonadorTarefas &e, size_t indice) {
+    pair<size_t, size_t> tarefa;
+    while (pegarTarefa(e, indice, tarefa)) {
+        (*e.corpo)(tarefa.first, tarefa.second);
+        if (--e.pendentes == 0) {
+            lock_guard<mutex> trava(e.mtx);
+            e.cv.notify_all();
+        }
+    }
+}
 
-    // Configura tileset
-    tileset.clear();
-    for (int i=0; i < nTiles; i++)
+void trabalhadorEscalonador(EscalonadorTarefas &e, size_t indice) {
+    indiceThreadEscalonador = indice;
+    uint64_t vista = 0;
+    while (true) {
+        {
+            unique_lock<mutex> trava(e.mtx);
+            e.cv.wait(trava, [&]() { return e.parar || e.geracao != vista; });
+            if (e.parar) return;
+            vista = e.geracao;
+        }
+        executarTarefas(e, indice);
+    }
+}
+
+int numeroThreadsSimulacao() {
+    if (threadsSimulacao > 0) return threadsSimulacao;
+    return glm::max((int) thread::hardware_concurrency(), 1);
+}
+
+void iniciarEscalonador(EscalonadorTarefas &e, int nThreads) {
+    nThreads = glm::max(nThreads, 1);
+    for (int t = 0; t < nThreads; t++) e.filas.emplace_back(new FilaRoubo());
+    for (int t = 1; t < nThreads; t++) e.threads.emplace_back(trabalhadorEscalonador, ref(e), (size_t) t);
+}
+
+void encerrarEscalonador(EscalonadorTarefas &e) {
     {
-        Tile tile;
-        tile.dimensions = vec3(tileH, tileW, 1.0);
-        tile.iTile = i;
-        tile.texID = texID;
-        tile.VAO = setupTile(nTiles, tile.ds, tile.dt);
-        tile.caminhavel = true;
-        tileset.push_back(tile);
+        lock_guard<mutex> trava(e.mtx);
+        e.parar = true;
+    }
+    e.cv.notify_all();
+    for (auto &t : e.threads) t.join();
+    e.threads.clear();
+    e.filas.clear();
+    e.parar = false;
+}
+
+// Divide [0, n) em faixas de até 'grao' itens distribuídas entre as filas e
+// espera todas terminarem. Sem threads extras, roda as mesmas faixas em ordem.
+void paraCadaFaixa(EscalonadorTarefas &e, size_t n, size_t grao, const function<void(size_t, size_t)> &f) {
+    if (e.filas.size() <= 1 || n <= grao) {
+        for (size_t k = 0; k < n; k += grao) f(k, glm::min(n, k + grao));
+        return;
+    }
+    size_t nTarefas = (n + grao - 1) / grao;
+    e.corpo = &f;
+    e.pendentes += nTarefas;
+    for (size_t k = 0; k < nTarefas; k++) {
+        FilaRoubo &fila = *e.filas[k % e.filas.size()];
+        lock_guard<mutex> trava(fila.mtx);
+        fila.tarefas.push_back({ k * grao, glm::min(n, (k + 1) * grao) });
     }
-    // Define tiles não caminháveis
-    carregarTilesBloqueados("tiles_bloqueados.txt");
+    {
+        lock_guard<mutex> trava(e.mtx);
+        e.geracao++;
+    }
+    e.cv.notify_all();
+    executarTarefas(e, 0);
+    unique_lock<mutex> trava(e.mtx);
+    e.cv.wait(trava, [&]() { return e.pendentes == 0; });
+}
 
-    // Inicializa posição do personagem
-    pos.x = 0;
-    pos.y = 0;
+// ------------------------------
+// Entidades (SoA) e sistemas
+// ------------------------------
+size_t criarEntidade(Entidades &E, TipoEntidade tipo, ivec2 celula) {
+    size_t id = E.n++;
+    E.celula.push_back(celula);
+    E.posicao.push_back(vec2(celula.x, celula.y));
+    E.tipo.push_back(tipo);
+    E.viva.push_back(1);
+    E.aparencia.push_back(tipo);
+    E.inicioAnimacao.push_back(0.0f); // Em fase com o relógio global (o modo ocioso conta com isso)
+    E.linha.push_back(0);
+    E.destino.push_back(celula);
+    E.progresso.push_back(0.0f);
+    E.semente.push_back(1);
+    return id;
+}
 
-    // Configuração do sprite do personagem
-    int spriteW, spriteH;
-    GLuint spriteTexID = loadTexture("personagem_spritesheet.png", spriteW, spriteH);
-    personagem.nAnimations = 4;
-    personagem.nFrames = 6;
-    personagem.iAnimation = 0;
-    personagem.iFrame = 0;
-    personagem.position = vec3(0, 0, 0);
-    personagem.dimensions = vec3(tileH, tileW, 1.0);
-    personagem.texID = spriteTexID;
-    personagem.VAO = setupSprite(personagem.nAnimations, personagem.nFrames, personagem.ds, personagem.dt);
+inline uint32_t xorshift32(uint32_t &s) {
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    return s;
+}
 
-    // Configura moedas e flag
-    setupMoedas();
-    setupFlag();
+// Direções de passo (as das teclas W A S D Q E Z X, nessa ordem), usadas pelos
+// atores e pela busca de caminhos, e a linha da spritesheet do personagem em cada uma
+const ivec2 DIRECOES_PASSO[8] = { {-1,-1}, {-1,1}, {1,1}, {1,-1}, {-1,0}, {0,-1}, {0,1}, {1,0} };
+const char TECLAS_PASSO[8] = { 'W', 'A', 'S', 'D', 'Q', 'E', 'Z', 'X' };
+const uint8_t LINHAS_ATOR[8] = { 1, 2, 0, 3, 2, 3, 2, 3 };
 
-    glUseProgram(shaderID);
+// Sistema de IA e animação dos atores [inicio, fim): avança cada um rumo ao
+// destino e, ao chegar, segue o campo de fluxo (--multidao) ou sorteia um
+// vizinho caminhável com o gerador do próprio ator. Só escreve no próprio
+// ator; quem trocou de célula vai para 'mudancas'.
+void sistemaIA(Entidades &E, size_t inicio, size_t fim, float dt, vector<uint32_t> &mudancas) {
+    for (size_t i = inicio; i < fim; i++) {
+        E.progresso[i] += VELOCIDADE_ATOR * dt;
+        if (E.progresso[i] >= 1.0f) {
+            E.progresso[i] = 0.0f;
+            if (E.destino[i] != E.celula[i]) {
+                E.celula[i] = E.destino[i];
+                mudancas.push_back((uint32_t) i);
+            }
+            if (multidao) {
+                uint8_t d = campoFluxo.direcao[indiceTile(E.celula[i].x, E.celula[i].y)];
+                if (d != SEM_DIRECAO) {
+                    E.destino[i] = E.celula[i] + DIRECOES_PASSO[d];
+                    E.linha[i] = LINHAS_ATOR[d];
+                }
+            } else {
+                uint32_t semente = E.semente[i];
+                for (int tentativa = 0; tentativa < 4; tentativa++) {
+                    int d = xorshift32(semente) & 7;
+                    ivec2 c = E.celula[i] + DIRECOES_PASSO[d];
+                    if (celulaCaminhavel(c.x, c.y)) {
+                        E.destino[i] = c;
+                        E.linha[i] = LINHAS_ATOR[d];
+                        break;
+                    }
+                }
+                E.semente[i] = semente;
+            }
+        }
+        vec2 a(E.celula[i].x, E.celula[i].y), b(E.destino[i].x, E.destino[i].y);
+        E.posicao[i] = mix(a, b, E.progresso[i]);
+    }
+}
 
-    // Uniforms e projeção
-    glActiveTexture(GL_TEXTURE0);
-    glUniform1i(glGetUniformLocation(shaderID, "tex_buff"), 0);
-    mat4 projection = ortho(0.0, 800.0, 600.0, 0.0, -1.0, 1.0);
-    glUniformMatrix4fv(glGetUniformLocation(shaderID, "projection"), 1, GL_FALSE, value_ptr(projection));
+// Um tick dos sistemas das entidades: IA em paralelo por faixas de atores e,
+// depois, as trocas de célula aplicadas na grade em ordem de faixa (determinístico)
+void atualizarEntidades(float dt) {
+    Entidades &E = entidades;
+    size_t nAtores = E.n - E.inicioAtores;
+    if (nAtores == 0) return;
+    const size_t grao = 4096;
+    size_t nFaixas = (nAtores + grao - 1) / grao;
+    static vector<vector<uint32_t>> mudancas;
+    if (mudancas.size() < nFaixas) mudancas.resize(nFaixas);
+    paraCadaFaixa(escalonador, nAtores, grao, [&](size_t inicio, size_t fim) {
+        vector<uint32_t> &m = mudancas[inicio / grao];
+        m.clear();
+        sistemaIA(E, E.inicioAtores + inicio, E.inicioAtores + fim, dt, m);
+    });
+    for (size_t k = 0; k < nFaixas; k++)
+        for (uint32_t id : mudancas[k]) moverNaGrade(gradeEntidades, (int) id, E.celula[id]);
+}
 
-    // OpenGL states
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_ALWAYS);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+// Posição de desenho de uma entidade (mesma projeção do personagem)
+// Profundidade isométrica de quem está na célula (contínua) c: quanto maior
+// x + y, mais à frente. Vai no z do vértice, em (-1, 1); com a projeção
+// (near -1, far 1) z maior vira profundidade menor no depth buffer.
+float profundidadeIsometrica(vec2 c) {
+    float maxChave = (float)(tilemapWidth + tilemapHeight);
+    return 2.0f * (c.x + c.y + 1.0f) / maxChave - 1.0f;
+}
 
-    // ------------------------------
-    // Loop principal do jogo
-    // ------------------------------
-    while (!glfwWindowShouldClose(window))
-    {
-        glfwPollEvents();
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+vec2 posicaoEntidade(size_t id) {
+    vec2 q = entidades.posicao[id];
+    return vec2(400 + (q.x - q.y) * tileH/2.0f, 130 + (q.x + q.y) * tileW/2.0f)
+         + aparencias[entidades.aparencia[id]].deslocamento;
+}
+
+// Em tela, a moeda do ponto p fica 60 px à esquerda e 40 px acima do
+// personagem parado em p. Ela é coletada na célula da grade mais próxima desse
+// ponto, que depende do tamanho do tile: p + (-1, 0) no tileset 114x57.
+const vec2 DESLOCAMENTO_TELA_MOEDA(-60.0f, -40.0f);
+
+ivec2 deslocamentoColetaMoeda() {
+    float a = DESLOCAMENTO_TELA_MOEDA.x / (tileH / 2.0f), b = DESLOCAMENTO_TELA_MOEDA.y / (tileW / 2.0f);
+    return ivec2((int) round((a + b) / 2.0f), (int) round((b - a) / 2.0f));
+}
+
+// ------------------------------
+// Busca de caminhos (A*, JPS e hierárquica por chunks)
+// ------------------------------
+const float CUSTO_DIAGONAL = 1.41421356f;
+// A heurística do grafo abstrato é inflada: com custos de aresta quase iguais
+// o A* exato expande boa parte do grafo; com o peso, a busca segue direto ao
+// objetivo e o custo fica alguns por cento acima do ótimo
+const float PESO_HEURISTICA_ABSTRATA = 1.3f;
+
+// Heurística octil: custo exato num mapa sem obstáculos com passos em 8 direções
+inline float distanciaOctil(ivec2 a, ivec2 b) {
+    int dx = abs(a.x - b.x), dy = abs(a.y - b.y);
+    return (float) glm::max(dx, dy) + (CUSTO_DIAGONAL - 1.0f) * glm::min(dx, dy);
+}
+
+inline ivec2 sinal(ivec2 d) {
+    return ivec2((d.x > 0) - (d.x < 0), (d.y > 0) - (d.y < 0));
+}
+
+// Prepara o pool para uma busca com n nós. Os vetores só crescem; trocar a
+// geração invalida as marcas da busca anterior sem varrer nada.
+void prepararPool(PoolBusca &p, size_t n) {
+    if (p.g.size() < n) {
+        p.g.resize(n);
+        p.pai.resize(n);
+        p.vista.assign(n, 0);
+        p.fechada.assign(n, 0);
+        p.geracao = 0;
+    }
+    if (++p.geracao == 0) {
+        fill(p.vista.begin(), p.vista.end(), 0);
+        fill(p.fechada.begin(), p.fechada.end(), 0);
+        p.geracao = 1;
+    }
+    p.aberta.clear();
+    p.expandidos = 0;
+}
+
+inline bool maiorF(const NoAberto &a, const NoAberto &b) { return a.f > b.f; }
+
+// Abre (ou reabre com custo menor) o nó id. Entradas antigas ficam no heap e
+// são descartadas ao sair, quando o nó já estiver fechado.
+inline void relaxar(PoolBusca &p, uint32_t id, uint32_t pai, float g, float h) {
+    if (p.fechada[id] == p.geracao) return;
+    if (p.vista[id] == p.geracao && p.g[id] <= g) return;
+    p.vista[id] = p.geracao;
+    p.g[id] = g;
+    p.pai[id] = pai;
+    p.aberta.push_back({ g + h, id });
+    push_heap(p.aberta.begin(), p.aberta.end(), maiorF);
+}
+
+// Próximo nó a expandir, ou UINT32_MAX quando a lista aberta acaba
+inline uint32_t fecharProximo(PoolBusca &p) {
+    while (!p.aberta.empty()) {
+        pop_heap(p.aberta.begin(), p.aberta.end(), maiorF);
+        uint32_t id = p.aberta.back().id;
+        p.aberta.pop_back();
+        if (p.fechada[id] == p.geracao) continue;
+        p.fechada[id] = p.geracao;
+        p.expandidos++;
+        return id;
+    }
+    return UINT32_MAX;
+}
+
+inline JanelaBusca janelaMapa() {
+    return { ivec2(0, 0), ivec2(tilemapWidth - 1, tilemapHeight - 1) };
+}
+
+inline JanelaBusca janelaChunk(ivec2 chunk) {
+    ivec2 minimo(chunk.x * CHUNK_TAM, chunk.y * CHUNK_TAM);
+    return { minimo, ivec2(glm::min(minimo.x + CHUNK_TAM, tilemapWidth) - 1,
+                           glm::min(minimo.y + CHUNK_TAM, tilemapHeight) - 1) };
+}
+
+inline ivec2 chunkDaCelula(ivec2 c) {
+    return ivec2(c.x / CHUNK_TAM, c.y / CHUNK_TAM);
+}
+
+inline bool dentroDaJanela(const JanelaBusca &j, ivec2 c) {
+    return c.x >= j.minimo.x && c.y >= j.minimo.y && c.x <= j.maximo.x && c.y <= j.maximo.y;
+}
+
+inline int larguraJanela(const JanelaBusca &j) { return j.maximo.x - j.minimo.x + 1; }
+
+inline uint32_t idNaJanela(const JanelaBusca &j, ivec2 c) {
+    return (uint32_t)((c.y - j.minimo.y) * larguraJanela(j) + (c.x - j.minimo.x));
+}
+
+inline ivec2 celulaNaJanela(const JanelaBusca &j, uint32_t id) {
+    int largura = larguraJanela(j);
+    return ivec2(j.minimo.x + (int)(id % largura), j.minimo.y + (int)(id / largura));
+}
+
+// Acrescenta a 'caminho' as células de pai em pai até 'id', do início para o
+// fim. Os pais podem estar a mais de um passo (pontos de salto): o trecho entre
+// eles é sempre reto ou diagonal e é preenchido célula a célula.
+void reconstruirCaminho(const PoolBusca &p, const JanelaBusca &j, uint32_t id, vector<ivec2> &caminho) {
+    size_t inicio = caminho.size();
+    ivec2 atual = celulaNaJanela(j, id);
+    caminho.push_back(atual);
+    for (uint32_t pai = p.pai[id]; pai != UINT32_MAX; pai = p.pai[pai]) {
+        ivec2 alvo = celulaNaJanela(j, pai);
+        ivec2 passo = sinal(alvo - atual);
+        while (atual != alvo) {
+            atual = atual + passo;
+            caminho.push_back(atual);
+        }
+    }
+    reverse(caminho.begin() + inicio, caminho.end());
+}
+
+// A* nos 8 vizinhos (as direções das teclas) restrito à janela j. Retorna o
+// custo do caminho ou -1 se não houver. Com fim = (-1, -1) vira um Dijkstra
+// que explora toda a janela (o pool guarda o custo até cada célula).
+float buscarAEstrela(ivec2 inicio, ivec2 fim, const JanelaBusca &j, PoolBusca &p, vector<ivec2> *caminho) {
+    prepararPool(p, (size_t) larguraJanela(j) * (j.maximo.y - j.minimo.y + 1));
+    bool comObjetivo = fim.x >= 0;
+    if (!celulaCaminhavel(inicio.x, inicio.y) || (comObjetivo && !celulaCaminhavel(fim.x, fim.y))) return -1;
+    uint32_t idFim = comObjetivo ? idNaJanela(j, fim) : UINT32_MAX;
+    relaxar(p, idNaJanela(j, inicio), UINT32_MAX, 0.0f, comObjetivo ? distanciaOctil(inicio, fim) : 0.0f);
+    for (uint32_t id; (id = fecharProximo(p)) != UINT32_MAX; ) {
+        if (id == idFim) {
+            if (caminho) reconstruirCaminho(p, j, id, *caminho);
+            return p.g[id];
+        }
+        ivec2 c = celulaNaJanela(j, id);
+        for (const ivec2 &d : DIRECOES_PASSO) {
+            ivec2 v = c + d;
+            if (!dentroDaJanela(j, v) || !celulaCaminhavel(v.x, v.y)) continue;
+            float custo = (d.x != 0 && d.y != 0) ? CUSTO_DIAGONAL : 1.0f;
+            relaxar(p, idNaJanela(j, v), id, p.g[id] + custo, comObjetivo ? distanciaOctil(v, fim) : 0.0f);
+        }
+    }
+    return -1;
+}
+
+// Salto da JPS a partir de c na direção (dx, dy). Devolve o próximo ponto de
+// salto (o objetivo, uma célula com vizinho forçado ou, na diagonal, uma célula
+// de onde um salto reto encontra algo) ou (-1, -1). Como o personagem pode
+// cortar quinas, os vizinhos forçados são os da JPS original.
+ivec2 saltar(ivec2 c, int dx, int dy, ivec2 fim) {
+    while (true) {
+        c.x += dx;
+        c.y += dy;
+        if (!celulaCaminhavel(c.x, c.y)) return ivec2(-1, -1);
+        if (c == fim) return c;
+        if (dx != 0 && dy != 0) {
+            if ((!celulaCaminhavel(c.x - dx, c.y) && celulaCaminhavel(c.x - dx, c.y + dy)) ||
+                (!celulaCaminhavel(c.x, c.y - dy) && celulaCaminhavel(c.x + dx, c.y - dy)))
+                return c;
+            if (saltar(c, dx, 0, fim).x >= 0 || saltar(c, 0, dy, fim).x >= 0) return c;
+        } else if (dx != 0) {
+            if ((!celulaCaminhavel(c.x, c.y + 1) && celulaCaminhavel(c.x + dx, c.y + 1)) ||
+                (!celulaCaminhavel(c.x, c.y - 1) && celulaCaminhavel(c.x + dx, c.y - 1)))
+                return c;
+        } else {
+            if ((!celulaCaminhavel(c.x + 1, c.y) && celulaCaminhavel(c.x + 1, c.y + dy)) ||
+                (!celulaCaminhavel(c.x - 1, c.y) && celulaCaminhavel(c.x - 1, c.y + dy)))
+                return c;
+        }
+    }
+}
+
+// Direções a seguir de c chegando na direção d (poda da JPS). Retorna quantas.
+int direcoesPodadas(ivec2 c, ivec2 d, ivec2 *saida) {
+    int n = 0;
+    if (d.x == 0 && d.y == 0) {
+        for (const ivec2 &p : DIRECOES_PASSO) saida[n++] = p;
+    } else if (d.x != 0 && d.y != 0) {
+        saida[n++] = d;
+        saida[n++] = ivec2(d.x, 0);
+        saida[n++] = ivec2(0, d.y);
+        if (!celulaCaminhavel(c.x - d.x, c.y)) saida[n++] = ivec2(-d.x, d.y);
+        if (!celulaCaminhavel(c.x, c.y - d.y)) saida[n++] = ivec2(d.x, -d.y);
+    } else if (d.x != 0) {
+        saida[n++] = d;
+        if (!celulaCaminhavel(c.x, c.y + 1)) saida[n++] = ivec2(d.x, 1);
+        if (!celulaCaminhavel(c.x, c.y - 1)) saida[n++] = ivec2(d.x, -1);
+    } else {
+        saida[n++] = d;
+        if (!celulaCaminhavel(c.x + 1, c.y)) saida[n++] = ivec2(1, d.y);
+        if (!celulaCaminhavel(c.x - 1, c.y)) saida[n++] = ivec2(-1, d.y);
+    }
+    return n;
+}
+
+// Jump point search no mapa inteiro: mesmo custo ótimo do A*, mas em áreas
+// abertas só os pontos de salto entram na lista aberta
+float buscarJPS(ivec2 inicio, ivec2 fim, PoolBusca &p, vector<ivec2> *caminho) {
+    JanelaBusca j = janelaMapa();
+    prepararPool(p, (size_t) tilemapWidth * tilemapHeight);
+    if (!celulaCaminhavel(inicio.x, inicio.y) || !celulaCaminhavel(fim.x, fim.y)) return -1;
+    uint32_t idFim = idNaJanela(j, fim);
+    relaxar(p, idNaJanela(j, inicio), UINT32_MAX, 0.0f, distanciaOctil(inicio, fim));
+    ivec2 direcoes[8];
+    for (uint32_t id; (id = fecharProximo(p)) != UINT32_MAX; ) {
+        if (id == idFim) {
+            if (caminho) reconstruirCaminho(p, j, id, *caminho);
+            return p.g[id];
+        }
+        ivec2 c = celulaNaJanela(j, id);
+        ivec2 chegada = p.pai[id] == UINT32_MAX ? ivec2(0, 0) : sinal(c - celulaNaJanela(j, p.pai[id]));
+        int n = direcoesPodadas(c, chegada, direcoes);
+        for (int k = 0; k < n; k++) {
+            ivec2 s = saltar(c, direcoes[k].x, direcoes[k].y, fim);
+            if (s.x < 0) continue;
+            relaxar(p, idNaJanela(j, s), id, p.g[id] + distanciaOctil(c, s), distanciaOctil(s, fim));
+        }
+    }
+    return -1;
+}
+
+// Nó abstrato na célula c (criado na primeira vez)
+uint32_t noAbstrato(GrafoAbstrato &G, ivec2 c) {
+    ivec2 ch = chunkDaCelula(c);
+    vector<uint32_t> &nos = G.nosDoChunk[(size_t) ch.y * mapa.chunksX + ch.x];
+    for (uint32_t no : nos)
+        if (G.celula[no] == c) return no;
+    uint32_t no = (uint32_t) G.celula.size();
+    G.celula.push_back(c);
+    G.arestas.emplace_back();
+    nos.push_back(no);
+    return no;
+}
+
+// Travessias de uma borda entre dois chunks: 'a' percorre as células do lado
+// de cá e 'b' as vizinhas do lado de lá. Trechos abertos curtos ganham uma
+// travessia no meio; os longos, uma em cada ponta.
+void ligarBorda(GrafoAbstrato &G, ivec2 a, ivec2 b, ivec2 passo, int comprimento) {
+    auto ligar = [&](int k) {
+        uint32_t na = noAbstrato(G, ivec2(a.x + passo.x * k, a.y + passo.y * k));
+        uint32_t nb = noAbstrato(G, ivec2(b.x + passo.x * k, b.y + passo.y * k));
+        G.arestas[na].push_back({ nb, 1.0f });
+        G.arestas[nb].push_back({ na, 1.0f });
+    };
+    int inicioTrecho = -1;
+    for (int k = 0; k <= comprimento; k++) {
+        bool aberta = k < comprimento &&
+            celulaCaminhavel(a.x + passo.x * k, a.y + passo.y * k) &&
+            celulaCaminhavel(b.x + passo.x * k, b.y + passo.y * k);
+        if (aberta && inicioTrecho < 0) inicioTrecho = k;
+        if (!aberta && inicioTrecho >= 0) {
+            int fimTrecho = k - 1;
+            if (fimTrecho - inicioTrecho + 1 < 6) ligar((inicioTrecho + fimTrecho) / 2);
+            else { ligar(inicioTrecho); ligar(fimTrecho); }
+            inicioTrecho = -1;
+        }
+    }
+}
+
+// Monta o grafo abstrato da busca hierárquica: travessias nas bordas dos
+// chunks e, dentro de cada chunk, o custo entre cada par de travessias
+// (um Dijkstra limitado ao chunk por nó, com os chunks em paralelo)
+void construirGrafoAbstrato(GrafoAbstrato &G) {
+    size_t nChunks = (size_t) mapa.chunksX * mapa.chunksY;
+    G.celula.clear();
+    G.arestas.clear();
+    G.nosDoChunk.assign(nChunks, {});
+    for (int cy = 0; cy < mapa.chunksY; cy++) {
+        for (int cx = 0; cx < mapa.chunksX; cx++) {
+            JanelaBusca j = janelaChunk(ivec2(cx, cy));
+            if (cx + 1 < mapa.chunksX)
+                ligarBorda(G, ivec2(j.maximo.x, j.minimo.y), ivec2(j.maximo.x + 1, j.minimo.y), ivec2(0, 1),
+                           j.maximo.y - j.minimo.y + 1);
+            if (cy + 1 < mapa.chunksY)
+                ligarBorda(G, ivec2(j.minimo.x, j.maximo.y), ivec2(j.minimo.x, j.maximo.y + 1), ivec2(1, 0),
+                           j.maximo.x - j.minimo.x + 1);
+        }
+    }
+    // Cada tarefa só escreve nas listas de arestas dos nós dos próprios chunks
+    G.poolsThreads.resize(glm::max(escalonador.filas.size(), (size_t) 1));
+    paraCadaFaixa(escalonador, nChunks, 16, [&](size_t inicio, size_t fim) {
+        PoolBusca &local = G.poolsThreads[indiceThreadEscalonador];
+        for (size_t ch = inicio; ch < fim; ch++) {
+            const vector<uint32_t> &nos = G.nosDoChunk[ch];
+            JanelaBusca j = janelaChunk(ivec2((int)(ch % mapa.chunksX), (int)(ch / mapa.chunksX)));
+            for (uint32_t a : nos) {
+                buscarAEstrela(G.celula[a], ivec2(-1, -1), j, local, nullptr);
+                for (uint32_t b : nos) {
+                    uint32_t id = idNaJanela(j, G.celula[b]);
+                    if (b != a && local.vista[id] == local.geracao) G.arestas[a].push_back({ b, local.g[id] });
+                }
+            }
+        }
+    });
+    G.valido = true;
+}
+
+// Custos da célula c até os nós abstratos do seu chunk
+void ligarAoGrafo(const GrafoAbstrato &G, ivec2 c, PoolBusca &p, vector<ArestaAbstrata> &saida) {
+    ivec2 ch = chunkDaCelula(c);
+    JanelaBusca j = janelaChunk(ch);
+    saida.clear();
+    buscarAEstrela(c, ivec2(-1, -1), j, p, nullptr);
+    for (uint32_t no : G.nosDoChunk[(size_t) ch.y * mapa.chunksX + ch.x]) {
+        uint32_t id = idNaJanela(j, G.celula[no]);
+        if (p.vista[id] == p.geracao) saida.push_back({ no, p.g[id] });
+    }
+}
+
+// Busca hierárquica: A* no grafo abstrato entre o chunk do início e o do
+// objetivo e, se 'caminho' for pedido, refinamento de cada trecho com A*
+// dentro do chunk. O custo pode passar um pouco do ótimo. Retorna -1 se o
+// grafo não ligar os dois pontos.
+float buscarHierarquico(ivec2 inicio, ivec2 fim, vector<ivec2> *caminho) {
+    GrafoAbstrato &G = grafoAbstrato;
+    if (!G.valido) construirGrafoAbstrato(G);
+    if (!celulaCaminhavel(inicio.x, inicio.y) || !celulaCaminhavel(fim.x, fim.y)) return -1;
+    static vector<ArestaAbstrata> saidas, chegadas;
+    static vector<uint32_t> rota;
+    ligarAoGrafo(G, inicio, poolJanela, saidas);
+    ligarAoGrafo(G, fim, poolJanela, chegadas);
+
+    // Os nós n e n + 1 são o início e o objetivo
+    PoolBusca &p = G.pool;
+    uint32_t n = (uint32_t) G.celula.size(), idInicio = n, idFim = n + 1;
+    prepararPool(p, n + 2);
+    ivec2 chunkFim = chunkDaCelula(fim);
+    relaxar(p, idInicio, UINT32_MAX, 0.0f, distanciaOctil(inicio, fim));
+    uint32_t id;
+    while ((id = fecharProximo(p)) != UINT32_MAX && id != idFim) {
+        const vector<ArestaAbstrata> &arestas = id == idInicio ? saidas : G.arestas[id];
+        for (const ArestaAbstrata &a : arestas)
+            relaxar(p, a.destino, id, p.g[id] + a.custo, PESO_HEURISTICA_ABSTRATA * distanciaOctil(G.celula[a.destino], fim));
+        if (id != idInicio && chunkDaCelula(G.celula[id]) == chunkFim)
+            for (const ArestaAbstrata &a : chegadas)
+                if (a.destino == id) relaxar(p, idFim, id, p.g[id] + a.custo, 0.0f);
+    }
+    if (id != idFim) return -1;
+    if (!caminho) return p.g[idFim];
+
+    // Refinamento: os nós em sequência estão no mesmo chunk ou em lados opostos de uma travessia
+    rota.clear();
+    for (uint32_t k = p.pai[idFim]; k != idInicio; k = p.pai[k]) rota.push_back(k);
+    reverse(rota.begin(), rota.end());
+    caminho->push_back(inicio);
+    float custo = 0.0f;
+    for (size_t k = 0; k <= rota.size(); k++) {
+        ivec2 a = caminho->back();
+        ivec2 b = k < rota.size() ? G.celula[rota[k]] : fim;
+        if (a == b) continue;
+        if (chunkDaCelula(a) != chunkDaCelula(b)) {
+            caminho->push_back(b);
+            custo += 1.0f;
+            continue;
+        }
+        caminho->pop_back();
+        float trecho = buscarAEstrela(a, b, janelaChunk(chunkDaCelula(a)), poolJanela, caminho);
+        if (trecho < 0) return -1;
+        custo += trecho;
+    }
+    return custo;
+}
+
+// Caminho de 'inicio' até 'fim' (as duas células incluídas). Pontos a mais de
+// um chunk de distância usam a busca hierárquica; os próximos, ou quando ela
+// falha (travessias só por quinas de chunk), a JPS no mapa inteiro.
+bool encontrarCaminho(ivec2 inicio, ivec2 fim, vector<ivec2> &caminho) {
+    caminho.clear();
+    ivec2 ci = chunkDaCelula(inicio), cf = chunkDaCelula(fim);
+    if (!streaming.ativo && glm::max(abs(ci.x - cf.x), abs(ci.y - cf.y)) >= 2) {
+        if (buscarHierarquico(inicio, fim, &caminho) >= 0) return true;
+        caminho.clear();
+    }
+    return buscarJPS(inicio, fim, poolBusca, &caminho) >= 0;
+}
+
+// ------------------------------
+// Campo de fluxo até a bandeira (multidões)
+// ------------------------------
+const int FLUXO_MUDOU = 1, FLUXO_BORDA_MUDOU = 2;
+// Largura da faixa de custo processada por rodada. Relaxar os chunks em ordem
+// aproximada de custo (como no delta-stepping) evita que cada chunk seja
+// refeito muitas vezes à medida que chegam caminhos melhores pelos lados.
+const float FAIXA_FLUXO = 2.0f * CHUNK_TAM;
+
+inline float custoPasso(ivec2 d) {
+    return (d.x != 0 && d.y != 0) ? CUSTO_DIAGONAL : 1.0f;
+}
+
+// Cor do chunk (2x2): chunks vizinhos, inclusive na diagonal, têm cores
+// diferentes, então os de uma cor relaxam em paralelo sem disputar células
+inline int corChunk(size_t chunk) {
+    return (int)(chunk % mapa.chunksX & 1) | (int)(chunk / mapa.chunksX & 1) << 1;
+}
+
+void ativarChunkFluxo(CampoFluxo &F, size_t chunk, float custo) {
+    F.prioridade[chunk] = glm::min(F.prioridade[chunk], custo);
+}
+
+void ativarVizinhosFluxo(CampoFluxo &F, size_t chunk, float custo) {
+    int cx = (int)(chunk % mapa.chunksX), cy = (int)(chunk / mapa.chunksX);
+    for (int dy = -1; dy <= 1; dy++)
+        for (int dx = -1; dx <= 1; dx++) {
+            int x = cx + dx, y = cy + dy;
+            if ((dx || dy) && x >= 0 && y >= 0 && x < mapa.chunksX && y < mapa.chunksY)
+                ativarChunkFluxo(F, (size_t) y * mapa.chunksX + x, custo);
+        }
+}
+
+// Relaxa o custo de integração dentro de um chunk: semeia as células da borda
+// com o melhor custo vindo dos chunks vizinhos e roda um Dijkstra local a
+// partir das que baixaram (ou de todas as com custo finito, se o chunk teve
+// custos invalidados). Só escreve no próprio chunk. Retorna FLUXO_MUDOU e/ou
+// FLUXO_BORDA_MUDOU (os vizinhos precisam relaxar), com o menor custo novo da
+// borda em 'menorBorda'.
+int relaxarChunkFluxo(CampoFluxo &F, size_t chunk, vector<NoAberto> &heap, float &menorBorda) {
+    const int T = CHUNK_TAM;
+    size_t base = chunk * T * T;
+    int x0 = (int)(chunk % mapa.chunksX) * T, y0 = (int)(chunk / mapa.chunksX) * T;
+    bool semearTudo = F.semearTudo[chunk];
+    F.semearTudo[chunk] = 0;
+    int resultado = 0;
+    menorBorda = INFINITY;
+    heap.clear();
+    for (int ly = 0; ly < T; ly++)
+        for (int lx = 0; lx < T; lx++) {
+            bool borda = lx == 0 || ly == 0 || lx == T - 1 || ly == T - 1;
+            if (!semearTudo && !borda) continue;
+            if (!celulaCaminhavel(x0 + lx, y0 + ly)) continue;
+            size_t i = base + ly * T + lx;
+            bool baixou = false;
+            if (borda) {
+                float c = F.custo[i];
+                for (const ivec2 &d : DIRECOES_PASSO) {
+                    int nx = lx + d.x, ny = ly + d.y;
+                    if (nx >= 0 && ny >= 0 && nx < T && ny < T) continue; // Dentro do chunk: fica com o Dijkstra
+                    if (!celulaCaminhavel(x0 + nx, y0 + ny)) continue;
+                    c = glm::min(c, F.custo[indiceTile(x0 + nx, y0 + ny)] + custoPasso(d));
+                }
+                if (c < F.custo[i]) {
+                    F.custo[i] = c;
+                    baixou = true;
+                    resultado |= FLUXO_MUDOU | FLUXO_BORDA_MUDOU;
+                    menorBorda = glm::min(menorBorda, c);
+                }
+            }
+            if (baixou || (semearTudo && F.custo[i] < INFINITY))
+                heap.push_back({ F.custo[i], (uint32_t)(ly * T + lx) });
+        }
+    make_heap(heap.begin(), heap.end(), maiorF);
+    while (!heap.empty()) {
+        pop_heap(heap.begin(), heap.end(), maiorF);
+        NoAberto n = heap.back();
+        heap.pop_back();
+        if (n.f > F.custo[base + n.id]) continue;
+        int lx = n.id % T, ly = n.id / T;
+        for (const ivec2 &d : DIRECOES_PASSO) {
+            int nx = lx + d.x, ny = ly + d.y;
+            if (nx < 0 || ny < 0 || nx >= T || ny >= T || !celulaCaminhavel(x0 + nx, y0 + ny)) continue;
+            uint32_t id = ny * T + nx;
+            float c = n.f + custoPasso(d);
+            if (c < F.custo[base + id]) {
+                F.custo[base + id] = c;
+                heap.push_back({ c, id });
+                push_heap(heap.begin(), heap.end(), maiorF);
+                resultado |= FLUXO_MUDOU;
+                if (nx == 0 || ny == 0 || nx == T - 1 || ny == T - 1) {
+                    resultado |= FLUXO_BORDA_MUDOU;
+                    menorBorda = glm::min(menorBorda, c);
+                }
+            }
+        }
+    }
+    return resultado;
+}
+
+// Direção de cada célula do chunk: o vizinho de menor custo + passo
+void recalcularDirecoesChunk(CampoFluxo &F, size_t chunk) {
+    const int T = CHUNK_TAM;
+    size_t base = chunk * T * T;
+    int x0 = (int)(chunk % mapa.chunksX) * T, y0 = (int)(chunk / mapa.chunksX) * T;
+    for (int ly = 0; ly < T; ly++)
+        for (int lx = 0; lx < T; lx++) {
+            size_t i = base + ly * T + lx;
+            ivec2 c(x0 + lx, y0 + ly);
+            F.direcao[i] = SEM_DIRECAO;
+            if (F.custo[i] == INFINITY || c == F.objetivo) continue;
+            float melhor = INFINITY;
+            for (int k = 0; k < 8; k++) {
+                ivec2 v = c + DIRECOES_PASSO[k];
+                if (!celulaCaminhavel(v.x, v.y)) continue;
+                float custo = F.custo[indiceTile(v.x, v.y)] + custoPasso(DIRECOES_PASSO[k]);
+                if (custo < melhor) {
+                    melhor = custo;
+                    F.direcao[i] = (uint8_t) k;
+                }
+            }
+        }
+}
+
+// Leva o campo ao ponto fixo. A cada rodada entram os chunks ativos com
+// prioridade até a menor + FAIXA_FLUXO, em quatro passadas por cor (em
+// paralelo dentro de cada cor); para quando nenhuma borda muda. Depois refaz
+// as direções dos chunks alterados e de seus vizinhos. A ordem das passadas
+// não depende do número de threads, então o resultado também não.
+void atualizarCampoFluxo(CampoFluxo &F) {
+    size_t nChunks = (size_t) mapa.chunksX * mapa.chunksY;
+    static vector<uint32_t> lista;
+    static vector<uint8_t> resultado;
+    static vector<float> menorBorda;
+    F.chunksRelaxados = 0;
+    while (true) {
+        float limite = INFINITY;
+        for (size_t c = 0; c < nChunks; c++) limite = glm::min(limite, F.prioridade[c]);
+        if (limite == INFINITY) break;
+        limite += FAIXA_FLUXO;
+        for (int cor = 0; cor < 4; cor++) {
+            lista.clear();
+            for (size_t c = 0; c < nChunks; c++)
+                if (F.prioridade[c] <= limite && corChunk(c) == cor) {
+                    lista.push_back((uint32_t) c);
+                    F.prioridade[c] = INFINITY;
+                }
+            if (lista.empty()) continue;
+            F.chunksRelaxados += lista.size();
+            resultado.assign(lista.size(), 0);
+            menorBorda.resize(lista.size());
+            paraCadaFaixa(escalonador, lista.size(), 2, [&](size_t inicio, size_t fim) {
+                static thread_local vector<NoAberto> heap;
+                for (size_t k = inicio; k < fim; k++)
+                    resultado[k] = (uint8_t) relaxarChunkFluxo(F, lista[k], heap, menorBorda[k]);
+            });
+            for (size_t k = 0; k < lista.size(); k++) {
+                if (resultado[k] & FLUXO_MUDOU) F.alterado[lista[k]] = 1;
+                if (resultado[k] & FLUXO_BORDA_MUDOU) ativarVizinhosFluxo(F, lista[k], menorBorda[k]);
+            }
+        }
+    }
+
+    // A direção de uma célula da borda depende do custo no chunk vizinho
+    lista.clear();
+    for (size_t c = 0; c < nChunks; c++) {
+        int cx = (int)(c % mapa.chunksX), cy = (int)(c / mapa.chunksX);
+        bool refazer = false;
+        for (int dy = -1; dy <= 1 && !refazer; dy++)
+            for (int dx = -1; dx <= 1 && !refazer; dx++) {
+                int x = cx + dx, y = cy + dy;
+                refazer = x >= 0 && y >= 0 && x < mapa.chunksX && y < mapa.chunksY && F.alterado[(size_t) y * mapa.chunksX + x];
+            }
+        if (refazer) lista.push_back((uint32_t) c);
+    }
+    fill(F.alterado.begin(), F.alterado.end(), 0);
+    paraCadaFaixa(escalonador, lista.size(), 4, [&](size_t inicio, size_t fim) {
+        for (size_t k = inicio; k < fim; k++) recalcularDirecoesChunk(F, lista[k]);
+    });
+    F.pendente = false;
+}
+
+// Monta o campo inteiro até 'objetivo'
+void construirCampoFluxo(CampoFluxo &F, ivec2 objetivo) {
+    size_t nChunks = (size_t) mapa.chunksX * mapa.chunksY;
+    F.objetivo = objetivo;
+    F.custo.assign(mapa.nCelulas, INFINITY);
+    F.direcao.assign(mapa.nCelulas, SEM_DIRECAO);
+    F.prioridade.assign(nChunks, INFINITY);
+    F.semearTudo.assign(nChunks, 0);
+    F.alterado.assign(nChunks, 0);
+    if (celulaCaminhavel(objetivo.x, objetivo.y)) {
+        size_t i = indiceTile(objetivo.x, objetivo.y);
+        F.custo[i] = 0.0f;
+        F.prioridade[i / (CHUNK_TAM * CHUNK_TAM)] = 0.0f;
+        F.semearTudo[i / (CHUNK_TAM * CHUNK_TAM)] = 1;
+    }
+    atualizarCampoFluxo(F);
+}
+
+// Atualização incremental depois que a célula c mudou de caminhabilidade
+// (o recálculo fica para a próxima atualizarCampoFluxo). Liberada, o custo só pode cair:
+// basta relaxar o chunk. Bloqueada, invalida c e todas as células cujas
+// direções passavam por ela (a árvore de fluxo a montante); só os chunks
+// dessa região voltam a relaxar, a partir do custo das células ao redor.
+void celulaAlteradaNoFluxo(CampoFluxo &F, ivec2 c) {
+    const size_t tilesPorChunk = CHUNK_TAM * CHUNK_TAM;
+    size_t i = indiceTile(c.x, c.y);
+    F.pendente = true;
+    if (celulaCaminhavel(c.x, c.y)) {
+        if (c == F.objetivo) F.custo[i] = 0.0f;
+        ativarChunkFluxo(F, i / tilesPorChunk, 0.0f);
+        F.semearTudo[i / tilesPorChunk] = 1;
+        F.alterado[i / tilesPorChunk] = 1;
+        return;
+    }
+    static vector<ivec2> fila;
+    fila.assign(1, c);
+    F.custo[i] = INFINITY;
+    F.direcao[i] = SEM_DIRECAO;
+    for (size_t k = 0; k < fila.size(); k++) {
+        ivec2 q = fila[k];
+        for (const ivec2 &d : DIRECOES_PASSO) {
+            ivec2 v = q - d; // v aponta para q se a direção de v for d
+            if (v.x < 0 || v.y < 0 || v.x >= tilemapWidth || v.y >= tilemapHeight) continue;
+            size_t j = indiceTile(v.x, v.y);
+            if (F.direcao[j] == SEM_DIRECAO || DIRECOES_PASSO[F.direcao[j]] != d) continue;
+            F.custo[j] = INFINITY;
+            F.direcao[j] = SEM_DIRECAO;
+            ativarChunkFluxo(F, j / tilesPorChunk, 0.0f);
+            F.semearTudo[j / tilesPorChunk] = 1;
+            F.alterado[j / tilesPorChunk] = 1;
+            fila.push_back(v);
+        }
+    }
+    F.alterado[i / tilesPorChunk] = 1;
+}
+
+// Troca o tipo de um tile durante o jogo e atualiza o que depende dele: o
+// chão pré-renderizado e, se a caminhabilidade mudou, o bitset, o grafo da
+// busca hierárquica e o campo de fluxo (recalculado no próximo tick, só na
+// região afetada). O tipo do arquivo fica em tiposOriginais na primeira troca.
+// Com avisarFluxo = false o chamador refaz o campo de fluxo inteiro depois
+// (trocas em massa, acima de MAX_CELULAS_FLUXO_INCREMENTAL células).
+void alterarTile(int x, int y, int tipo, bool avisarFluxo = true) {
+    size_t i = indiceTile(x, y);
+    bool antes = celulaCaminhavel(x, y);
+    if (mapa.tiles[i] != tipo) {
+        mapa.tiposOriginais.emplace((uint32_t)((size_t) y * tilemapWidth + x), mapa.tiles[i]);
+        marcarChaoSujo(x, y);
+    }
+    mapa.tiles[i] = (uint16_t) tipo;
+    if (i / (CHUNK_TAM * CHUNK_TAM) < mapa.tiposNoChunk.size()) mapa.tiposNoChunk[i / (CHUNK_TAM * CHUNK_TAM)] |= bitTipo(tipo);
+    uint64_t bit = (uint64_t)1 << (i & 63);
+    if (tipo < (int)tiposCaminhaveis.size() && tiposCaminhaveis[tipo]) mapa.caminhavel[i >> 6] |= bit;
+    else mapa.caminhavel[i >> 6] &= ~bit;
+    if (celulaCaminhavel(x, y) == antes) return;
+    grafoAbstrato.valido = false;
+    if (avisarFluxo && !campoFluxo.custo.empty()) celulaAlteradaNoFluxo(campoFluxo, ivec2(x, y));
+}
+
+// ------------------------------
+// Mapa binário (.tmap) mapeado em memória
+// ------------------------------
+
+// Mapeia o arquivo inteiro em memória (cópia na escrita: edições não vão para o disco)
+void *mapearArquivo(const string& filename, size_t &tamanho) {
+#ifdef _WIN32
+    HANDLE arquivo = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (arquivo == INVALID_HANDLE_VALUE) return nullptr;
+    LARGE_INTEGER t;
+    GetFileSizeEx(arquivo, &t);
+    tamanho = (size_t) t.QuadPart;
+    HANDLE mapeamento = CreateFileMappingA(arquivo, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    CloseHandle(arquivo);
+    if (!mapeamento) return nullptr;
+    void *dados = MapViewOfFile(mapeamento, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mapeamento);
+    return dados;
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0) { close(fd); return nullptr; }
+    tamanho = (size_t) st.st_size;
+    void *dados = mmap(nullptr, tamanho, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    return dados == MAP_FAILED ? nullptr : dados;
+#endif
+}
+
+void desmapearArquivo(void *dados, size_t tamanho) {
+#ifdef _WIN32
+    UnmapViewOfFile(dados);
+#else
+    munmap(dados, tamanho);
+#endif
+}
+
+// Verdadeiro se o arquivo começa com a assinatura do formato binário
+bool ehMapaBinario(const string& filename) {
+    ifstream file(filename, ios::binary);
+    char magica[4] = {};
+    file.read(magica, 4);
+    return file && memcmp(magica, MAPA_BIN_MAGICA, 4) == 0;
+}
+
+// Confere o cabeçalho de um .tmap contra o tamanho do arquivo, antes de qualquer
+// alocação ou de descartar o mapa atual (carga mapeada e streaming)
+bool validarCabecalhoMapaBin(const CabecalhoMapaBin &cab, uint64_t tamanho, const string& filename) {
+    if (tamanho < sizeof(CabecalhoMapaBin) || memcmp(cab.magica, MAPA_BIN_MAGICA, 4) != 0
+        || cab.versao != MAPA_BIN_VERSAO) {
+        cerr << "Formato de mapa binário inválido ou versão não suportada: " << filename << endl;
+        return false;
+    }
+    // As dimensões do cabeçalho têm de ser coerentes entre si: o tamanho dos tiles
+    // sai de largura/altura, então chunksX/chunksY precisam bater com elas
+    if (cab.largura <= 0 || cab.altura <= 0 || cab.tileW <= 0 || cab.tileH <= 0 || cab.nTiles <= 0
+        || cab.chunksX != (cab.largura + CHUNK_TAM - 1) / CHUNK_TAM
+        || cab.chunksY != (cab.altura + CHUNK_TAM - 1) / CHUNK_TAM) {
+        cerr << "Dimensões inválidas no mapa binário: " << filename << endl;
+        return false;
+    }
+    // Cada seção precisa caber no arquivo; os testes comparam com o que sobra
+    // depois do offset para não estourar offset + tamanho
+    uint64_t bytesTiles = (uint64_t)cab.chunksX * cab.chunksY * CHUNK_TAM * CHUNK_TAM * sizeof(uint16_t);
+    uint64_t bytesBloqueados = (uint64_t)cab.nBloqueados * sizeof(int32_t);
+    if (cab.offsetTiles < sizeof(CabecalhoMapaBin) || cab.offsetTiles % alignof(uint16_t) != 0
+        || cab.offsetBloqueados % alignof(int32_t) != 0
+        || cab.offsetTiles > tamanho || bytesTiles > tamanho - cab.offsetTiles
+        || cab.offsetBloqueados > tamanho || bytesBloqueados > tamanho - cab.offsetBloqueados) {
+        cerr << "Mapa binário truncado: " << filename << endl;
+        return false;
+    }
+    return true;
+}
+
+// Carrega um .tmap sem parsing nem cópia: os tiles são usados direto do mapeamento
+bool carregarMapaBinario(const string& filename) {
+    size_t tamanho = 0;
+    void *dados = mapearArquivo(filename, tamanho);
+    if (!dados) {
+        cerr << "Erro ao abrir " << filename << endl;
+        return false;
+    }
+    const CabecalhoMapaBin *cab = (const CabecalhoMapaBin *) dados;
+    if (tamanho < sizeof(CabecalhoMapaBin)) {
+        cerr << "Formato de mapa binário inválido ou versão não suportada: " << filename << endl;
+        desmapearArquivo(dados, tamanho);
+        return false;
+    }
+    if (!validarCabecalhoMapaBin(*cab, tamanho, filename)) {
+        desmapearArquivo(dados, tamanho);
+        return false;
+    }
+
+    liberarMapa();
+    mapa.armazenamento.clear();
+    mapa.mapeado = dados;
+    mapa.tamanhoMapeado = tamanho;
+    tilesetFile = string(cab->tileset, strnlen(cab->tileset, sizeof(cab->tileset)));
+    nTiles = cab->nTiles;
+    tileW = cab->tileW;
+    tileH = cab->tileH;
+    definirDimensoesMapa(cab->largura, cab->altura);
+    mapa.tiles = (uint16_t *)((char *) dados + cab->offsetTiles);
+    mapa.caminhavel.assign((mapa.nCelulas + 63) / 64, 0);
+
+    const int32_t *bloqueados = (const int32_t *)((const char *) dados + cab->offsetBloqueados);
+    tilesBloqueados.assign(bloqueados, bloqueados + cab->nBloqueados);
+    bloqueadosNoMapa = true;
+    calcularHashMapa();
+    return true;
+}
+
+// Grava o mapa carregado (e a lista de bloqueados) no formato binário
+bool salvarMapaBinario(const string& filename) {
+    ofstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Erro ao criar " << filename << endl;
+        return false;
+    }
+    CabecalhoMapaBin cab;
+    memset(&cab, 0, sizeof(cab));
+    memcpy(cab.magica, MAPA_BIN_MAGICA, 4);
+    cab.versao = MAPA_BIN_VERSAO;
+    strncpy(cab.tileset, tilesetFile.c_str(), sizeof(cab.tileset) - 1);
+    cab.nTiles = nTiles; cab.tileW = tileW; cab.tileH = tileH;
+    cab.largura = tilemapWidth; cab.altura = tilemapHeight;
+    cab.chunksX = mapa.chunksX; cab.chunksY = mapa.chunksY;
+    cab.nBloqueados = (uint32_t) tilesBloqueados.size();
+    cab.offsetTiles = (sizeof(CabecalhoMapaBin) + 63) & ~(uint64_t)63;
+    cab.offsetBloqueados = cab.offsetTiles + mapa.nCelulas * sizeof(uint16_t);
+
+    file.write((const char *) &cab, sizeof(cab));
+    vector<char> preenchimento(cab.offsetTiles - sizeof(cab), 0);
+    file.write(preenchimento.data(), preenchimento.size());
+    file.write((const char *) mapa.tiles, mapa.nCelulas * sizeof(uint16_t));
+    vector<int32_t> bloqueados(tilesBloqueados.begin(), tilesBloqueados.end());
+    file.write((const char *) bloqueados.data(), bloqueados.size() * sizeof(int32_t));
+    return (bool) file;
+}
+
+// Grava o mapa carregado no formato texto do map.txt
+bool salvarMapaTexto(const string& filename) {
+    ofstream file(filename);
+    if (!file.is_open()) {
+        cerr << "Erro ao criar " << filename << endl;
+        return false;
+    }
+    file << tilesetFile << " " << nTiles << " " << tileW << " " << tileH << "\n";
+    file << tilemapWidth << " " << tilemapHeight << "\n";
+    for (int i = 0; i < tilemapHeight; ++i) {
+        for (int j = 0; j < tilemapWidth; ++j)
+            file << (j ? " " : "") << tileEm(j, i);
+        file << "\n";
+    }
+    return (bool) file;
+}
+
+// Converte entre map.txt e .tmap conforme o formato da entrada.
+// Texto -> binário embute a lista de 'bloqueados'; binário -> texto a grava em 'bloqueados'.
+bool converterMapa(const string& entrada, const string& saida, const string& bloqueados) {
+    bool binario = ehMapaBinario(entrada);
+    if (!loadMapConfig(entrada)) return false;
+    if (binario) {
+        ofstream file(bloqueados);
+        for (int idx : tilesBloqueados) file << idx << " ";
+        return salvarMapaTexto(saida);
+    }
+    carregarTilesBloqueados(bloqueados);
+    return salvarMapaBinario(saida);
+}
+
+// ------------------------------
+// Streaming de chunks do mapa
+// ------------------------------
+
+#ifdef _WIN32
+// Acesso a uma página só reservada da região do streaming (um snapshot lendo
+// um chunk fora da memória, por exemplo): compromete a página e repete a
+// instrução, como as páginas sob demanda do mmap no Linux
+LONG CALLBACK comprometerPaginaMapa(EXCEPTION_POINTERS *e) {
+    const EXCEPTION_RECORD *r = e->ExceptionRecord;
+    if (r->ExceptionCode != EXCEPTION_ACCESS_VIOLATION || r->NumberParameters < 2) return EXCEPTION_CONTINUE_SEARCH;
+    char *endereco = (char *) r->ExceptionInformation[1], *inicio = (char *) mapa.mapeado;
+    if (!mapa.anonimo || !inicio || endereco < inicio || endereco >= inicio + mapa.tamanhoMapeado)
+        return EXCEPTION_CONTINUE_SEARCH;
+    return VirtualAlloc(endereco, 1, MEM_COMMIT, PAGE_READWRITE) ? EXCEPTION_CONTINUE_EXECUTION : EXCEPTION_CONTINUE_SEARCH;
+}
+#endif
+
+// Reserva espaço de endereçamento para o mapa inteiro; as páginas só ocupam
+// memória quando um chunk é escrito e são devolvidas no descarte. No Windows
+// a região só é reservada: cada chunk é comprometido ao chegar
+// (comprometerChunk) e descomprometido no descarte.
+void *reservarMemoriaMapa(size_t bytes) {
+#ifdef _WIN32
+    static PVOID manipulador = AddVectoredExceptionHandler(1, comprometerPaginaMapa);
+    (void) manipulador;
+    return VirtualAlloc(NULL, bytes, MEM_RESERVE, PAGE_READWRITE);
+#else
+    void *dados = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return dados == MAP_FAILED ? nullptr : dados;
+#endif
+}
+
+// Páginas do chunk prontas para a escrita (no Linux o mmap já as dá sob demanda)
+void comprometerChunk(size_t chunk) {
+#ifdef _WIN32
+    const size_t bytesChunk = CHUNK_TAM * CHUNK_TAM * sizeof(uint16_t);
+    VirtualAlloc((char *) mapa.tiles + chunk * bytesChunk, bytesChunk, MEM_COMMIT, PAGE_READWRITE);
+#else
+    (void) chunk;
+#endif
+}
+
+// Devolve ao sistema as páginas que contêm apenas chunks não residentes
+void liberarPaginasChunk(size_t chunk) {
+#ifdef _WIN32
+    const size_t pagina = 4096;
+#else
+    const size_t pagina = (size_t) sysconf(_SC_PAGESIZE);
+#endif
+    const size_t bytesChunk = CHUNK_TAM * CHUNK_TAM * sizeof(uint16_t);
+    size_t chunksPorPagina = glm::max(pagina / bytesChunk, (size_t) 1);
+    size_t primeiro = chunk - chunk % chunksPorPagina;
+    for (size_t c = primeiro; c < primeiro + chunksPorPagina && c < (size_t) mapa.chunksX * mapa.chunksY; c++)
+        if (streaming.estado[c] == CHUNK_RESIDENTE) return;
+
+    char *inicio = (char *) mapa.tiles + primeiro * bytesChunk;
+    size_t bytes = glm::max(pagina, bytesChunk);
+#ifdef _WIN32
+    VirtualFree(inicio, bytes, MEM_DECOMMIT);
+#else
+    madvise(inicio, bytes, MADV_DONTNEED);
+#endif
+}
+
+// Thread de carga: lê os chunks ao redor do personagem, primeiro os mais
+// próximos e depois os da direção do último movimento (pré-carga)
+void trabalhadorStreaming() {
+    ifstream file(streaming.arquivo, ios::binary);
+    uint64_t versaoAtendida = 0;
+    while (true) {
+        ivec2 centro, direcao;
+        {
+            unique_lock<mutex> trava(streaming.mtx);
+            streaming.cv.wait(trava, [&]() { return streaming.parar || streaming.versaoPedido != versaoAtendida; });
+            if (streaming.parar) return;
+            versaoAtendida = streaming.versaoPedido;
+            centro = streaming.centro;
+            direcao = streaming.direcao;
+        }
+
+        // Lista de chunks desejados, ordenada pela distância ao personagem
+        int r = streaming.raio;
+        ivec2 alvoPrecarga = centro + ivec2(direcao.x * r, direcao.y * r);
+        vector<pair<int, size_t>> desejados;
+        for (const ivec2 &base : { centro, alvoPrecarga }) {
+            for (int cy = base.y - r; cy <= base.y + r; cy++)
+                for (int cx = base.x - r; cx <= base.x + r; cx++) {
+                    if (cx < 0 || cy < 0 || cx >= mapa.chunksX || cy >= mapa.chunksY) continue;
+                    int dist = glm::max(abs(cx - centro.x), abs(cy - centro.y));
+                    desejados.push_back({ dist, (size_t) cy * mapa.chunksX + cx });
+                }
+        }
+        sort(desejados.begin(), desejados.end());
+
+        for (auto &d : desejados) {
+            size_t c = d.second;
+            uint8_t esperado = CHUNK_AUSENTE;
+            if (!streaming.estado[c].compare_exchange_strong(esperado, CHUNK_PEDIDO)) continue;
+
+            ChunkCarregado *carregado = new ChunkCarregado;
+            carregado->chunk = c;
+            file.clear();
+            file.seekg(streaming.offsetTiles + c * sizeof(carregado->tiles));
+            file.read((char *) carregado->tiles, sizeof(carregado->tiles));
+            // Arquivo encurtado depois de aberto: publica o chunk zerado em vez de
+            // lixo; voltar para AUSENTE faria a thread pedi-lo de novo sem fim
+            if ((size_t) file.gcount() != sizeof(carregado->tiles)) {
+                memset(carregado->tiles, 0, sizeof(carregado->tiles));
+                streaming.errosLeitura++;
+            }
+
+            while (!streaming.prontos.inserir(carregado)) {
+                if (streaming.parar) { delete carregado; return; }
+                this_thread::sleep_for(chrono::microseconds(200));
+            }
+            // Personagem mudou de chunk: recomeça pela nova vizinhança
+            if (streaming.versaoPedido != versaoAtendida) break;
+        }
+    }
+}
+
+// Abre um .tmap em modo streaming: só o cabeçalho é lido agora, os tiles
+// chegam pela thread de carga
+bool carregarMapaStreaming(const string& filename, int raio, size_t orcamentoMB) {
+    ifstream file(filename, ios::binary);
+    CabecalhoMapaBin cab;
+    if (!file.read((char *) &cab, sizeof(cab))) {
+        cerr << "Streaming exige um mapa binário válido: " << filename << endl;
+        return false;
+    }
+    file.seekg(0, ios::end);
+    uint64_t tamanho = (uint64_t) file.tellg();
+    if (!validarCabecalhoMapaBin(cab, tamanho, filename)) return false;
+    liberarMapa();
+    mapa.armazenamento.clear();
+    tilesetFile = string(cab.tileset, strnlen(cab.tileset, sizeof(cab.tileset)));
+    nTiles = cab.nTiles;
+    tileW = cab.tileW;
+    tileH = cab.tileH;
+    definirDimensoesMapa(cab.largura, cab.altura);
+    mapa.tamanhoMapeado = mapa.nCelulas * sizeof(uint16_t);
+    mapa.mapeado = reservarMemoriaMapa(mapa.tamanhoMapeado);
+    if (!mapa.mapeado) {
+        cerr << "Sem espaço de endereçamento para o mapa" << endl;
+        return false;
+    }
+    mapa.anonimo = true;
+    mapa.tiles = (uint16_t *) mapa.mapeado;
+    mapa.caminhavel.assign((mapa.nCelulas + 63) / 64, 0);
+
+    vector<int32_t> bloqueados(cab.nBloqueados);
+    file.seekg(cab.offsetBloqueados);
+    file.read((char *) bloqueados.data(), bloqueados.size() * sizeof(int32_t));
+    tilesBloqueados.assign(bloqueados.begin(), bloqueados.end());
+    bloqueadosNoMapa = true;
+
+    size_t nChunks = (size_t) mapa.chunksX * mapa.chunksY;
+    const size_t bytesChunk = CHUNK_TAM * CHUNK_TAM * sizeof(uint16_t);
+    size_t minimo = 2 * (size_t)(2 * raio + 1) * (2 * raio + 1); // vizinhança + pré-carga
+    streaming.arquivo = filename;
+    streaming.offsetTiles = cab.offsetTiles;
+    streaming.raio = raio;
+    streaming.orcamentoChunks = glm::max(orcamentoMB * 1024 * 1024 / bytesChunk, minimo);
+    streaming.estado.reset(new atomic<uint8_t>[nChunks]);
+    for (size_t c = 0; c < nChunks; c++) streaming.estado[c] = CHUNK_AUSENTE;
+    streaming.ultimoUso.assign(nChunks, 0);
+    streaming.anteriorLRU.assign(nChunks, SEM_CHUNK);
+    streaming.proximoLRU.assign(nChunks, SEM_CHUNK);
+    streaming.cabecaLRU = streaming.caudaLRU = SEM_CHUNK;
+    streaming.nResidentes = 0;
+    streaming.ativo = true;
+    mapa.hashPendente = true; // Ler o arquivo inteiro agora desfaria o streaming
+    return true;
+}
+
+// Hash do conteúdo do mapa como carregado. Em streaming os tiles residentes
+// podem não cobrir o mapa: o hash sai da seção de tiles do arquivo, lida em
+// blocos na primeira vez que for pedido (F5/F9).
+uint64_t hashConteudoMapa() {
+    if (!mapa.hashPendente) return mapa.hashConteudo;
+    ifstream file(streaming.arquivo, ios::binary);
+    file.seekg(streaming.offsetTiles);
+    vector<uint16_t> bloco(1 << 16);
+    uint64_t h = 0;
+    for (size_t inicio = 0; inicio < mapa.nCelulas && file; inicio += bloco.size()) {
+        size_t n = glm::min(bloco.size(), mapa.nCelulas - inicio);
+        file.read((char *) bloco.data(), n * sizeof(uint16_t));
+        h += somarHashMapa(bloco.data(), inicio, n);
+    }
+    mapa.hashConteudo = h;
+    mapa.hashPendente = false;
+    return h;
+}
+
+void iniciarStreaming() {
+    if (!streaming.ativo) return;
+    streaming.centro = ivec2((int) pos.x / CHUNK_TAM, (int) pos.y / CHUNK_TAM);
+    streaming.versaoPedido++;
+    streaming.trabalhador = thread(trabalhadorStreaming);
+}
+
+void pararStreaming() {
+    if (!streaming.ativo) return;
+    {
+        lock_guard<mutex> trava(streaming.mtx);
+        streaming.parar = true;
+    }
+    streaming.cv.notify_all();
+    streaming.trabalhador.join();
+    ChunkCarregado *carregado;
+    while (streaming.prontos.remover(carregado)) delete carregado;
+}
+
+// Lista LRU dos residentes (só a thread principal mexe)
+void ligarNaCabecaLRU(uint32_t c) {
+    StreamingMapa &S = streaming;
+    S.anteriorLRU[c] = SEM_CHUNK;
+    S.proximoLRU[c] = S.cabecaLRU;
+    if (S.cabecaLRU != SEM_CHUNK) S.anteriorLRU[S.cabecaLRU] = c;
+    else S.caudaLRU = c;
+    S.cabecaLRU = c;
+}
+
+void desligarDaLRU(uint32_t c) {
+    StreamingMapa &S = streaming;
+    if (S.anteriorLRU[c] != SEM_CHUNK) S.proximoLRU[S.anteriorLRU[c]] = S.proximoLRU[c];
+    else S.cabecaLRU = S.proximoLRU[c];
+    if (S.proximoLRU[c] != SEM_CHUNK) S.anteriorLRU[S.proximoLRU[c]] = S.anteriorLRU[c];
+    else S.caudaLRU = S.anteriorLRU[c];
+}
+
+// Chunk usado neste frame (visível ou na vizinhança do personagem)
+void usarChunkStreaming(size_t chunk) {
+    uint32_t c = (uint32_t) chunk;
+    streaming.ultimoUso[c] = streaming.frame;
+    if (streaming.estado[c] != CHUNK_RESIDENTE || streaming.cabecaLRU == c) return;
+    desligarDaLRU(c);
+    ligarNaCabecaLRU(c);
+}
+
+// Chamada uma vez por frame na thread principal: informa a posição do personagem,
+// aplica os chunks prontos e descarta os mais antigos acima do orçamento
+void atualizarStreaming(vec2 direcaoMovimento) {
+    if (!streaming.ativo) return;
+    streaming.frame++;
+
+    ivec2 centro((int) pos.x / CHUNK_TAM, (int) pos.y / CHUNK_TAM);
+    ivec2 direcao((direcaoMovimento.x > 0) - (direcaoMovimento.x < 0), (direcaoMovimento.y > 0) - (direcaoMovimento.y < 0));
+    {
+        lock_guard<mutex> trava(streaming.mtx);
+        if (centro != streaming.centro || direcao != streaming.direcao) {
+            streaming.centro = centro;
+            streaming.direcao = direcao;
+            streaming.versaoPedido++;
+        }
+    }
+    streaming.cv.notify_one();
+
+    // Aplica no máximo alguns chunks por frame para não estourar o tempo do frame
+    const size_t tilesPorChunk = CHUNK_TAM * CHUNK_TAM;
+    ChunkCarregado *carregado;
+    for (int n = 0; n < 64 && streaming.prontos.remover(carregado); n++) {
+        size_t c = carregado->chunk;
+        comprometerChunk(c);
+        memcpy(mapa.tiles + c * tilesPorChunk, carregado->tiles, sizeof(carregado->tiles));
+        delete carregado;
+        streaming.estado[c] = CHUNK_RESIDENTE;
+        streaming.ultimoUso[c] = streaming.frame;
+        ligarNaCabecaLRU((uint32_t) c);
+        streaming.nResidentes++;
+        streaming.carregados++;
+        reconstruirCaminhabilidadeChunk(c);
+        marcarChunkChaoSujo(c);
+    }
+
+    // Vizinhança do personagem conta como uso neste frame
+    for (int cy = centro.y - streaming.raio; cy <= centro.y + streaming.raio; cy++)
+        for (int cx = centro.x - streaming.raio; cx <= centro.x + streaming.raio; cx++)
+            if (cx >= 0 && cy >= 0 && cx < mapa.chunksX && cy < mapa.chunksY)
+                usarChunkStreaming((size_t) cy * mapa.chunksX + cx);
+
+    // Descarte pela cauda da LRU enquanto acima do orçamento; se a cauda foi
+    // usada neste frame, todos os residentes foram
+    while (streaming.nResidentes > streaming.orcamentoChunks) {
+        uint32_t c = streaming.caudaLRU;
+        if (streaming.ultimoUso[c] == streaming.frame) break;
+        desligarDaLRU(c);
+        streaming.nResidentes--;
+        streaming.estado[c] = CHUNK_AUSENTE;
+        memset(&mapa.caminhavel[c * tilesPorChunk / 64], 0, tilesPorChunk / 8);
+        liberarPaginasChunk(c);
+        streaming.descartados++;
+    }
+}
+
+// ------------------------------
+// Função para carregar configuração do mapa
+// ------------------------------
+bool loadMapConfig(const string& filename) {
+    // Formato detectado pela assinatura no início do arquivo
+    if (ehMapaBinario(filename)) return carregarMapaBinario(filename);
+
+    bloqueadosNoMapa = false;
+    // Lido de uma vez: com --observar, a recarga compara as edições com
+    // exatamente este texto (e não com uma segunda leitura do arquivo)
+    string texto;
+    if (!lerTextoArquivo(filename, texto)) {
+        cerr << "Erro ao abrir " << filename << endl;
+        return false;
+    }
+    istringstream file(texto);
+    string line;
+    // Linha 1: tilesetIso.png 7 57 114
+    getline(file, line);
+    stringstream ss(line);
+    string tileset;
+    int n = 0, w = 0, h = 0;
+    ss >> tileset >> n >> w >> h;
+    if (!ss || n <= 0 || w <= 0 || h <= 0) {
+        cerr << "Cabeçalho do mapa inválido (tileset nTiles tileW tileH): " << filename << endl;
+        return false;
+    }
+
+    // Linha 2: largura altura
+    getline(file, line);
+    ss.clear(); ss.str(line);
+    int largura = 0, altura = 0;
+    ss >> largura >> altura;
+    if (!ss || largura <= 0 || altura <= 0) {
+        cerr << "Dimensões do mapa inválidas (largura altura): " << filename << endl;
+        return false;
+    }
+    tilesetFile = tileset;
+    nTiles = n;
+    tileW = w;
+    tileH = h;
+    alocarMapa(largura, altura);
+
+    // Linhas seguintes: mapa
+    for (int i = 0; i < tilemapHeight; ++i) {
+        getline(file, line);
+        ss.clear(); ss.str(line);
+        for (int j = 0; j < tilemapWidth; ++j) {
+            int v = 0; ss >> v;
+            mapa.tiles[indiceTile(j, i)] = (uint16_t) v;
+        }
+    }
+    if (recargaQuente.guardarTexto) recargaQuente.textoMapa = move(texto);
+    calcularHashMapa();
+    return true;
+}
+
+// ------------------------------
+// Função para carregar tiles não caminháveis de um arquivo
+// ------------------------------
+void carregarTilesBloqueados(const string& filename) {
+    ifstream file(filename);
+    if (!file.is_open()) {
+        cerr << "Erro ao abrir " << filename << endl;
+        return;
+    }
+    tilesBloqueados.clear();
+    int idx;
+    while (file >> idx) tilesBloqueados.push_back(idx);
+    file.close();
+    aplicarTilesBloqueados();
+}
+
+// Marca no tileset os tiles da lista de bloqueados e recalcula o bitset
+void aplicarTilesBloqueados() {
+    tiposCaminhaveis.assign(glm::max(nTiles, (int)tileset.size()), 1);
+    for (int idx : tilesBloqueados) {
+        if (idx >= 0 && idx < (int)tiposCaminhaveis.size())
+            tiposCaminhaveis[idx] = 0;
+    }
+    for (size_t t = 0; t < tileset.size(); t++)
+        tileset[t].caminhavel = tiposCaminhaveis[t];
+    reconstruirCaminhabilidade();
+}
+
+// ------------------------------
+// Função para carregar tiles animados (opcional): linhas "indice nFrames fps".
+// Os frames de um tile animado são as colunas seguintes a ele no tileset.
+// ------------------------------
+void carregarTilesAnimados(const string& filename) {
+    tilesAnimados.assign(nTiles, vec2(1.0f, 0.0f));
+    ifstream file(filename);
+    if (!file.is_open()) return; // Sem tiles animados
+    int idx, nFrames;
+    float fps;
+    while (file >> idx >> nFrames >> fps) {
+        if (idx < 0 || idx >= nTiles || idx >= 64 || nFrames < 1 || idx + nFrames > nTiles) {
+            cerr << "Tile animado inválido em " << filename << ": " << idx << endl;
+            continue;
+        }
+        tilesAnimados[idx] = vec2((float) nFrames, fps);
+    }
+    file.close();
+}
+
+// ------------------------------
+// Recarga a quente (--observar): map.txt, tiles_bloqueados.txt e spritesheets
+// ------------------------------
+
+// Data de modificação e tamanho do arquivo (conferidos quando não há inotify)
+int64_t modificacaoArquivo(const string& caminho) {
+    struct stat st;
+    if (stat(caminho.c_str(), &st) != 0) return -1;
+    return (int64_t) st.st_mtime * 1000003 + (int64_t) st.st_size;
+}
+
+bool lerTextoArquivo(const string& caminho, string &texto) {
+    ifstream file(caminho, ios::binary | ios::ate);
+    if (!file.is_open()) return false;
+    texto.resize((size_t) file.tellg());
+    file.seekg(0);
+    file.read(&texto[0], texto.size());
+    texto.resize((size_t) file.gcount());
+    return true;
+}
+
+// Linha de um texto (aponta para dentro dele, sem o '\n' e o '\r' finais)
+struct LinhaTexto {
+    const char *inicio;
+    size_t tamanho;
+    bool operator==(const LinhaTexto &o) const { return tamanho == o.tamanho && memcmp(inicio, o.inicio, tamanho) == 0; }
+};
+
+void separarLinhas(const string &texto, vector<LinhaTexto> &linhas) {
+    linhas.clear();
+    const char *p = texto.data(), *fim = p + texto.size();
+    while (p < fim) {
+        const char *q = (const char *) memchr(p, '\n', fim - p);
+        if (!q) q = fim;
+        size_t n = q - p;
+        while (n > 0 && (p[n - 1] == '\r' || p[n - 1] == ' ')) n--;
+        linhas.push_back({ p, n });
+        p = q + 1;
+    }
+}
+
+// Inteiros de uma linha do mapa; false se houver algo que não seja número
+bool lerLinhaMapa(const LinhaTexto &linha, vector<int> &valores) {
+    valores.clear();
+    const char *p = linha.inicio, *fim = p + linha.tamanho;
+    while (p < fim) {
+        if (*p == ' ' || *p == '\t') { p++; continue; }
+        if (*p < '0' || *p > '9') return false;
+        int v = 0;
+        while (p < fim && *p >= '0' && *p <= '9') v = v * 10 + (*p++ - '0');
+        valores.push_back(v);
+    }
+    return true;
+}
+
+// Compara o map.txt gravado com a última versão aceita. Só as linhas com bytes
+// diferentes são interpretadas; o cabeçalho (tileset e tamanho) não pode mudar.
+void relerMapa(RecargaQuente &R, const ArquivoVigiado &arq, ReleituraArquivo &res) {
+    string texto;
+    if (!lerTextoArquivo(arq.caminho, texto)) { res.erro = "não foi possível ler o arquivo"; return; }
+    vector<LinhaTexto> antes, depois;
+    separarLinhas(R.textoMapa, antes);
+    separarLinhas(texto, depois);
+    if (depois.size() < 2 + (size_t) tilemapHeight) {
+        res.erro = "arquivo incompleto (" + to_string(depois.size()) + " linhas)";
+        return;
+    }
+    if (antes.size() < 2 || !(antes[0] == depois[0]) || !(antes[1] == depois[1])) {
+        res.erro = "o cabeçalho mudou (reinicie o jogo para trocar o tileset ou o tamanho)";
+        return;
+    }
+    vector<int> valoresAntes, valoresDepois;
+    for (int y = 0; y < tilemapHeight; y++) {
+        size_t l = 2 + y;
+        if (l < antes.size() && antes[l] == depois[l]) continue;
+        if (!lerLinhaMapa(depois[l], valoresDepois) || (int) valoresDepois.size() < tilemapWidth) {
+            res.erro = "linha " + to_string(l + 1) + " incompleta";
+            res.celulas.clear();
+            return;
+        }
+        if (l >= antes.size() || !lerLinhaMapa(antes[l], valoresAntes)) valoresAntes.clear();
+        valoresAntes.resize(tilemapWidth, -1); // Sem valor antes: a célula conta como alterada
+        for (int x = 0; x < tilemapWidth; x++) {
+            if (valoresDepois[x] == valoresAntes[x]) continue;
+            if (valoresDepois[x] >= nTiles) {
+                res.erro = "tile " + to_string(valoresDepois[x]) + " fora do tileset na linha " + to_string(l + 1);
+                res.celulas.clear();
+                return;
+            }
+            res.celulas.push_back({ x, y, (uint16_t) valoresDepois[x] });
+        }
+    }
+    R.textoMapa = move(texto);
+}
+
+// Thread da recarga: relê um arquivo e deixa o resultado para a thread principal
+void relerArquivoVigiado(RecargaQuente &R, int k) {
+    auto inicio = chrono::steady_clock::now();
+    const ArquivoVigiado &arq = R.arquivos[k];
+    ReleituraArquivo &res = R.resultado;
+    res = ReleituraArquivo();
+    res.arquivo = k;
+    res.pixels = nullptr;
+    if (arq.tipo == VIGIADO_MAPA) relerMapa(R, arq, res);
+    else if (arq.tipo == VIGIADO_BLOQUEADOS) {
+        ifstream file(arq.caminho);
+        int idx;
+        if (!file.is_open()) res.erro = "não foi possível ler o arquivo";
+        while (file >> idx) res.bloqueados.push_back(idx);
+    } else {
+        const RegiaoAtlas &r = atlas.regioes[arq.regiao];
+        int w, h, nrChannels;
+        res.pixels = stbi_load(arq.caminho.c_str(), &w, &h, &nrChannels, 4);
+        if (!res.pixels) res.erro = "não foi possível decodificar a imagem";
+        else if (w != r.w || h != r.h) {
+            res.erro = "tamanho mudou para " + to_string(w) + "x" + to_string(h) + " (o atlas tem "
+                     + to_string(r.w) + "x" + to_string(r.h) + "; reinicie o jogo)";
+            stbi_image_free(res.pixels);
+            res.pixels = nullptr;
+        }
+    }
+    res.msLeitura = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+    R.pronto = true;
+}
+
+// Nova lista de tiles bloqueados: só os tipos que trocaram de caminhabilidade
+// são revisitados, e só nos chunks que têm algum deles. Retorna as células
+// que mudaram.
+size_t atualizarTilesBloqueados(const vector<int> &lista) {
+    vector<uint8_t> novos(tiposCaminhaveis.size(), 1);
+    for (int idx : lista)
+        if (idx >= 0 && idx < (int) novos.size()) novos[idx] = 0;
+    tilesBloqueados = lista;
+    uint64_t mascara = 0;
+    for (size_t t = 0; t < novos.size(); t++)
+        if (novos[t] != tiposCaminhaveis[t]) mascara |= bitTipo((int) t);
+    if (!mascara) return 0;
+    tiposCaminhaveis = novos;
+    for (size_t t = 0; t < tileset.size(); t++)
+        tileset[t].caminhavel = tiposCaminhaveis[t];
+
+    // Bits das células dos tipos afetados; o campo de fluxo é avisado célula a
+    // célula (ou refeito inteiro se forem muitas)
+    const size_t tilesPorChunk = CHUNK_TAM * CHUNK_TAM;
+    static vector<ivec2> alteradas;
+    alteradas.clear();
+    size_t nChunks = (size_t) mapa.chunksX * mapa.chunksY;
+    for (size_t c = 0; c < nChunks; c++) {
+        if (!(mapa.tiposNoChunk[c] & mascara) || !chunkResidente(c)) continue;
+        int x0 = (int)(c % mapa.chunksX) * CHUNK_TAM, y0 = (int)(c / mapa.chunksX) * CHUNK_TAM;
+        for (size_t k = 0; k < tilesPorChunk; k++) {
+            size_t i = c * tilesPorChunk + k;
+            int t = mapa.tiles[i];
+            if (!(bitTipo(t) & mascara)) continue;
+            uint64_t bit = (uint64_t)1 << (i & 63);
+            bool caminhavel = t < (int) tiposCaminhaveis.size() && tiposCaminhaveis[t];
+            if (caminhavel == ((mapa.caminhavel[i >> 6] & bit) != 0)) continue;
+            mapa.caminhavel[i >> 6] ^= bit;
+            ivec2 celula(x0 + (int)(k % CHUNK_TAM), y0 + (int)(k / CHUNK_TAM));
+            if (celula.x < tilemapWidth && celula.y < tilemapHeight) alteradas.push_back(celula);
+        }
+    }
+    if (alteradas.empty()) return 0;
+    grafoAbstrato.valido = false;
+    if (!campoFluxo.custo.empty()) {
+        if (alteradas.size() > MAX_CELULAS_FLUXO_INCREMENTAL) construirCampoFluxo(campoFluxo, campoFluxo.objetivo);
+        else for (ivec2 c : alteradas) celulaAlteradaNoFluxo(campoFluxo, c);
+    }
+    return alteradas.size();
+}
+
+// Aplica na thread principal o resultado da última releitura
+bool aplicarReleitura(RecargaQuente &R) {
+    ReleituraArquivo &res = R.resultado;
+    const ArquivoVigiado &arq = R.arquivos[res.arquivo];
+    if (!res.erro.empty()) {
+        cerr << "Recarga de " << arq.caminho << " ignorada: " << res.erro << endl;
+        return false;
+    }
+    if (arq.tipo == VIGIADO_MAPA && res.celulas.empty()) return false; // Sem diferença (a conferência inicial, em geral)
+    auto inicio = chrono::steady_clock::now();
+    string resumo;
+    if (arq.tipo == VIGIADO_MAPA) {
+        // O arquivo relido passa a ser a referência do mapa: as células dele
+        // saem de tiposOriginais (rebobinar e F9 não as desfazem) e o hash do
+        // conteúdo troca a parcela do tipo de referência antigo pela do novo.
+        // Com muitas células, o campo de fluxo é refeito uma vez no fim
+        bool refazerFluxo = res.celulas.size() > MAX_CELULAS_FLUXO_INCREMENTAL;
+        for (const CelulaAlterada &c : res.celulas) {
+            uint32_t chave = (uint32_t)((size_t) c.y * tilemapWidth + c.x);
+            auto o = mapa.tiposOriginais.find(chave);
+            uint16_t referencia = o != mapa.tiposOriginais.end() ? o->second : (uint16_t) tileEm(c.x, c.y);
+            size_t i = indiceTile(c.x, c.y);
+            mapa.hashConteudo += parcelaHashMapa(i, c.tipo) - parcelaHashMapa(i, referencia);
+            alterarTile(c.x, c.y, c.tipo, !refazerFluxo);
+            mapa.tiposOriginais.erase(chave);
+        }
+        if (refazerFluxo && !campoFluxo.custo.empty()) construirCampoFluxo(campoFluxo, campoFluxo.objetivo);
+        resumo = to_string(res.celulas.size()) + " tiles alterados";
+    } else if (arq.tipo == VIGIADO_BLOQUEADOS) {
+        resumo = to_string(atualizarTilesBloqueados(res.bloqueados)) + " células mudaram de caminhabilidade";
+    } else {
+        // Mesmo arquivo pode ocupar várias regiões (--texturas-extras)
+        ligarTextura(atlas.textura.id());
+        for (const RegiaoAtlas &r : atlas.regioes) {
+            if (r.arquivo != arq.caminho) continue;
+            glTexSubImage2D(GL_TEXTURE_2D, 0, r.x, r.y, r.w, r.h, GL_RGBA, GL_UNSIGNED_BYTE, res.pixels);
+            if (r.arquivo == tilesetFile) atlas.versao++; // Páginas do chão são assadas de novo
+        }
+        ligarTextura(0);
+        stbi_image_free(res.pixels);
+        res.pixels = nullptr;
+        const RegiaoAtlas &r = atlas.regioes[arq.regiao];
+        resumo = "região " + to_string(r.w) + "x" + to_string(r.h) + " reenviada";
+    }
+    R.msUltimaAplicacao = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+    R.aplicadas++;
+    cout << "Recarga de " << arq.caminho << ": " << resumo << " (leitura " << res.msLeitura
+         << " ms, aplicação " << R.msUltimaAplicacao << " ms)" << endl;
+    return true;
+}
+
+// Vigia 'caminho' (pelo diretório, para pegar também gravações com rename)
+void vigiarArquivo(RecargaQuente &R, const string& caminho, TipoArquivoVigiado tipo, int regiao) {
+    for (const ArquivoVigiado &a : R.arquivos)
+        if (a.caminho == caminho) return;
+    ArquivoVigiado arq;
+    arq.caminho = caminho;
+    size_t barra = caminho.find_last_of("/\\");
+    arq.diretorio = barra == string::npos ? "." : caminho.substr(0, barra + 1);
+    arq.nome = barra == string::npos ? caminho : caminho.substr(barra + 1);
+    arq.tipo = tipo;
+    arq.regiao = regiao;
+    arq.vigia = -1;
+    arq.modificacao = modificacaoArquivo(caminho);
+    arq.mudou = false;
+#ifdef __linux__
+    if (R.fd >= 0) arq.vigia = inotify_add_watch(R.fd, arq.diretorio.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+#endif
+    R.arquivos.push_back(arq);
+}
+
+// Começa a vigiar o mapa (só o texto, fora do streaming), a lista de tiles
+// bloqueados (se não veio no mapa) e as spritesheets do atlas. A referência do
+// mapa é o texto que loadMapConfig interpretou (guardarTexto), e a primeira
+// releitura já sai marcada: uma edição feita durante a carga não se perde
+bool iniciarRecargaQuente(const string& arquivoMapa) {
+    RecargaQuente &R = recargaQuente;
+#ifdef __linux__
+    R.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (R.fd < 0) cerr << "inotify indisponível; conferindo a data dos arquivos" << endl;
+#endif
+    R.arquivos.clear();
+    if (!streaming.ativo && !ehMapaBinario(arquivoMapa) && (!R.textoMapa.empty() || lerTextoArquivo(arquivoMapa, R.textoMapa))) {
+        vigiarArquivo(R, arquivoMapa, VIGIADO_MAPA, -1);
+        R.arquivos.back().mudou = true;
+    }
+    if (!bloqueadosNoMapa) vigiarArquivo(R, "tiles_bloqueados.txt", VIGIADO_BLOQUEADOS, -1);
+    for (size_t i = 0; i < atlas.regioes.size(); i++)
+        vigiarArquivo(R, atlas.regioes[i].arquivo, VIGIADO_SPRITESHEET, (int) i);
+    R.ultimaVerificacao = chrono::steady_clock::now();
+    R.ativo = true;
+    cout << "Observando " << R.arquivos.size() << " arquivos" << (R.fd >= 0 ? " (inotify)" : "") << endl;
+    return true;
+}
+
+// Chamada uma vez por frame na thread principal: junta os avisos do inotify
+// (ou confere as datas a cada meio segundo), aplica a releitura que ficou
+// pronta e passa o próximo arquivo alterado para a thread. Retorna true se a
+// cena mudou.
+bool atualizarRecargaQuente() {
+    RecargaQuente &R = recargaQuente;
+    if (!R.ativo) return false;
+#ifdef __linux__
+    if (R.fd >= 0) {
+        alignas(inotify_event) char buffer[4096];
+        ssize_t n;
+        while ((n = read(R.fd, buffer, sizeof(buffer))) > 0) {
+            for (char *p = buffer; p < buffer + n; ) {
+                const inotify_event *e = (const inotify_event *) p;
+                for (ArquivoVigiado &a : R.arquivos)
+                    if (a.vigia == e->wd && e->len && a.nome == e->name) a.mudou = true;
+                p += sizeof(inotify_event) + e->len;
+            }
+        }
+    } else
+#endif
+    if (chrono::steady_clock::now() - R.ultimaVerificacao > chrono::milliseconds(500)) {
+        R.ultimaVerificacao = chrono::steady_clock::now();
+        for (ArquivoVigiado &a : R.arquivos) {
+            int64_t m = modificacaoArquivo(a.caminho);
+            if (m != a.modificacao) { a.modificacao = m; a.mudou = true; }
+        }
+    }
+
+    bool aplicou = false;
+    if (R.emAndamento) {
+        if (!R.pronto) return false;
+        R.trabalhador.join();
+        R.emAndamento = false;
+        R.pronto = false;
+        aplicou = aplicarReleitura(R);
+    }
+    // Spritesheets esperam o pipeline de texturas terminar a carga inicial
+    for (size_t k = 0; k < R.arquivos.size(); k++) {
+        ArquivoVigiado &a = R.arquivos[k];
+        if (!a.mudou || (a.tipo == VIGIADO_SPRITESHEET && pipelineTexturas.ativo)) continue;
+        a.mudou = false;
+        R.emAndamento = true;
+        R.trabalhador = thread(relerArquivoVigiado, ref(R), (int) k);
+        break;
+    }
+    return aplicou;
+}
+
+void encerrarRecargaQuente() {
+    RecargaQuente &R = recargaQuente;
+    if (R.emAndamento) {
+        R.trabalhador.join();
+        if (R.resultado.pixels) stbi_image_free(R.resultado.pixels);
+        R.emAndamento = false;
+        R.pronto = false;
+    }
+#ifdef __linux__
+    if (R.fd >= 0) close(R.fd);
+#endif
+    R.fd = -1;
+    R.arquivos.clear();
+    R.textoMapa = string();
+    R.guardarTexto = false;
+    R.ativo = false;
+}
+
+// ------------------------------
+// Shaders (GLSL)
+// ------------------------------
+const GLchar *vertexShaderSource = R"(
+ #version 400
+ layout (location = 0) in vec3 position;
+ layout (location = 1) in vec2 texc;
+ out vec2 tex_coord;
+ uniform mat4 model;
+ layout (std140) uniform Quadro {
+    mat4 projection;
+    float tempo;
+ };
+ void main()
+ {
+    tex_coord = texc;
+    gl_Position = projection * model * vec4(position, 1.0);
+ }
+ )";
+
+const GLchar *fragmentShaderSource = R"(
+ #version 400
+ in vec2 tex_coord;
+ out vec4 color;
+ uniform sampler2D tex_buff;
+ uniform vec2 offsetTex;
+ void main()
+ {
+     color = texture(tex_buff,tex_coord + offsetTex);
+ }
+ )";
+
+// Vertex shader do lote de sprites: o frame da animação sai do tempo global,
+// sem atualização por objeto na CPU
+const GLchar *spriteVertexShaderSource = R"(
+ #version 400
+ layout (location = 0) in vec3 position;
+ layout (location = 1) in vec2 texc;
+ layout (location = 2) in vec4 animacao; // passo, inicio, nFrames, fps
+ out vec2 tex_coord;
+ layout (std140) uniform Quadro {
+    mat4 projection;
+    float tempo;
+ };
+ void main()
+ {
+    float frame = 0.0;
+    if (animacao.w > 0.0)
+        frame = floor(mod((tempo - animacao.y) * animacao.w, animacao.z));
+    tex_coord = texc + vec2(frame * animacao.x, 0.0);
+    gl_Position = projection * vec4(position, 1.0);
+ }
+ )";
+
+// Fragment shader do lote de sprites. Como a ordem sai do depth buffer, a
+// passada escolhe os texels (PassadaSprites): modoAlfa 1 só os opacos, que
+// escrevem profundidade; 2 só as bordas translúcidas; 0 (ordem de pintor)
+// todos. Texels totalmente transparentes nunca chegam ao framebuffer.
+const GLchar *spriteFragmentShaderSource = R"(
+ #version 400
+ in vec2 tex_coord;
+ out vec4 color;
+ uniform sampler2D tex_buff;
+ uniform int modoAlfa;
+ void main()
+ {
+     color = texture(tex_buff,tex_coord);
+     bool opaco = color.a >= 1.0;
+     if (color.a <= 0.0 || (modoAlfa == 1 && !opaco) || (modoAlfa == 2 && opaco)) discard;
+ }
+ )";
+
+// Vertex shader da camada de tiles: posicionamento isométrico e lookup
+// no atlas feitos por instância, na GPU. Tiles animados avançam pelas
+// colunas seguintes do tileset conforme animTile[iTile] = (nFrames, fps).
+const GLchar *tileVertexShaderSource = R"(
+ #version 400
+ layout (location = 0) in vec3 position;
+ layout (location = 1) in vec2 texc;
+ layout (location = 2) in vec2 celula;
+ layout (location = 3) in float iTile;
+ out vec2 tex_coord;
+ layout (std140) uniform Quadro {
+    mat4 projection;
+    float tempo;
+ };
+ uniform vec2 origem;
+ uniform vec2 tileDim;
+ uniform vec2 uvBase;
+ uniform float ds;
+ uniform vec2 animTile[64];
+ void main()
+ {
+    vec2 base = origem + vec2((celula.x - celula.y) * tileDim.x / 2.0,
+                              (celula.x + celula.y) * tileDim.y / 2.0);
+    vec2 anim = iTile < 64.0 ? animTile[int(iTile)] : vec2(1.0, 0.0);
+    float frame = anim.y > 0.0 ? floor(mod(tempo * anim.y, anim.x)) : 0.0;
+    tex_coord = uvBase + texc + vec2((iTile + frame) * ds, 0.0);
+    gl_Position = projection * vec4(base + position.xy * tileDim, position.z, 1.0);
+ }
+ )";
+
+// Quads das páginas do chão: posição em mundo e textura com cor pré-multiplicada
+const GLchar *chaoVertexShaderSource = R"(
+ #version 400
+ layout (location = 0) in vec2 position;
+ layout (location = 1) in vec2 texc;
+ out vec2 tex_coord;
+ layout (std140) uniform Quadro {
+    mat4 projection;
+    float tempo;
+ };
+ void main()
+ {
+    tex_coord = texc;
+    gl_Position = projection * vec4(position, 0.0, 1.0);
+ }
+ )";
+
+const GLchar *chaoFragmentShaderSource = R"(
+ #version 400
+ in vec2 tex_coord;
+ out vec4 color;
+ uniform sampler2D tex_buff;
+ void main()
+ {
+     color = texture(tex_buff, tex_coord);
+ }
+ )";
+
+#ifndef SEM_PERFIL
+// Overlay do profiler: retângulos em pixels da janela, cor por vértice
+const GLchar *overlayVertexShaderSource = R"(
+ #version 400
+ layout (location = 0) in vec2 position;
+ layout (location = 1) in vec3 cor;
+ uniform mat4 projection;
+ out vec3 corV;
+ void main()
+ {
+    corV = cor;
+    gl_Position = projection * vec4(position, 0.0, 1.0);
+ }
+ )";
+
+const GLchar *overlayFragmentShaderSource = R"(
+ #version 400
+ in vec3 corV;
+ out vec4 color;
+ void main()
+ {
+    color = vec4(corV, 0.85);
+ }
+ )";
+#endif
+
+// ------------------------------
+// Função para configurar a bandeira animada
+// ------------------------------
+void setupFlag() {
+    const RegiaoAtlas &regiao = regiaoAtlas("flag animation.png");
+    flag.nAnimations = 1; // Número de linhas no spritesheet
+    flag.nFrames = 5;     // Número de frames de animação
+    flag.iAnimation = 0;
+    flag.iFrame = 0;
+    flag.dimensions = vec3(tileH/1.3, tileW/1.3, 1.0); // Tamanho da flag
+    flag.texID = atlas.textura.id();
+    flag.uvBase = regiao.uv0;
+    flag.ds = regiao.uvTam.x / (float) flag.nFrames;
+    flag.dt = regiao.uvTam.y / (float) flag.nAnimations;
+    // A posição vem de iniciarSimulacao
+}
+
+// ------------------------------
+// Função para desenhar a bandeira animada
+// ------------------------------
+void desenharFlag() {
+    if (flagReached) return;
+    AnimacaoSprite animacao = { 0.0f, flag.nFrames, 10.0f, flag.iAnimation }; // 10 FPS
+    adicionarSprite(loteSprites, 1, flag.texID, flag.position, flag.dimensions,
+                    flag.uvBase, flag.ds, flag.dt, animacao);
+}
+
+// ------------------------------
+// Função para configurar a aparência das moedas e dos atores
+// (as posições vêm de iniciarSimulacao)
+// ------------------------------
+void setupAparencias() {
+    const RegiaoAtlas &regiaoMoeda = regiaoAtlas("coin_Sheet.png");
+    AparenciaEntidade &moeda = aparencias[ENTIDADE_MOEDA];
+    moeda.texID = atlas.textura.id();
+    moeda.nFrames = 10;
+    moeda.fps = 10.0f;
+    moeda.uvBase = regiaoMoeda.uv0;
+    moeda.duv = vec2(regiaoMoeda.uvTam.x / (float) moeda.nFrames, regiaoMoeda.uvTam.y);
+    moeda.dimensoes = vec2(tileH/2, tileW/2);
+    // Desenhada no mesmo lugar de antes, seja qual for a célula de coleta
+    ivec2 d = deslocamentoColetaMoeda();
+    moeda.deslocamento = DESLOCAMENTO_TELA_MOEDA - vec2((d.x - d.y) * tileH/2.0f, (d.x + d.y) * tileW/2.0f);
+
+    const RegiaoAtlas &regiaoAtor = regiaoAtlas("personagem_spritesheet.png");
+    AparenciaEntidade &ator = aparencias[ENTIDADE_ATOR];
+    ator.texID = atlas.textura.id();
+    ator.nFrames = 6;
+    ator.fps = 8.0f;
+    ator.uvBase = regiaoAtor.uv0;
+    ator.duv = vec2(regiaoAtor.uvTam.x / (float) ator.nFrames, regiaoAtor.uvTam.y / 4.0f);
+    ator.dimensoes = vec2(tileH * 0.8f, tileW * 0.8f);
+    ator.deslocamento = vec2(0, 0);
+}
+
+// Item do lote de sprites de uma entidade (lido em paralelo pela gravação do frame)
+ItemSprite itemEntidade(int camada, size_t id) {
+    const AparenciaEntidade &a = aparencias[entidades.aparencia[id]];
+    AnimacaoSprite animacao = { entidades.inicioAnimacao[id], a.nFrames, a.fps, entidades.linha[id] };
+    vec2 p = posicaoEntidade(id);
+    return { camada, a.texID, profundidadeIsometrica(entidades.posicao[id]), p, a.dimensoes, a.uvBase, a.duv, animacao };
+}
+
+// ------------------------------
+// Função para desenhar as moedas
+// (a animação roda no shader; o lote das moedas só é refeito quando uma é
+// coletada e, como os atores visíveis, é montado em gravarListasQuadro)
+// ------------------------------
+void desenharEntidades(PassadaSprites passada) {
+    // Na ordem de pintor as moedas se intercalam com os outros sprites, então
+    // estão no lote do frame
+    if (!ordemNaCpu) desenharSpriteBatch(loteMoedas, passada);
+}
+
+// ------------------------------
+// Log de eventos (anéis por thread e escritor em segundo plano)
+// ------------------------------
+const char *NOMES_NIVEIS_LOG[] = { "depuracao", "info", "aviso", "erro" };
+const char *NOMES_EVENTOS_LOG[N_TIPOS_EVENTO_LOG] = { "movimento", "moeda", "bandeira", "caminho", "sem_caminho" };
+
+// Primeiro evento de uma thread: cria o anel dela. Os anéis ficam até o fim
+// do programa, já que o ponteiro thread_local não fica sabendo de nada.
+AnelLog *registrarThreadLog()
+{
+    lock_guard<mutex> trava(logEventos.mtxAneis);
+    logEventos.aneis.emplace_back(new AnelLog());
+    anelLog = logEventos.aneis.back().get();
+    anelLog->thread = (uint16_t)(logEventos.aneis.size() - 1);
+    return anelLog;
+}
+
+// Caminho rápido de LOG_EVENTO: monta o registro direto no anel da thread,
+// sem trava, formatação nem E/S
+inline void registrarLog(NivelLog nivel, TipoEventoLog tipo, int32_t a = 0, int32_t b = 0, int32_t c = 0, float valor = 0.0f)
+{
+    if (!logEventos.ativo.load(memory_order_relaxed)) return;
+    AnelLog *anel = anelLog ? anelLog : registrarThreadLog();
+    uint32_t cabeca = anel->cabeca.load(memory_order_relaxed);
+    if (cabeca - anel->caudaVista >= CAPACIDADE_ANEL_LOG) {
+        anel->caudaVista = anel->cauda.load(memory_order_acquire);
+        if (cabeca - anel->caudaVista >= CAPACIDADE_ANEL_LOG) {
+            anel->descartados.store(anel->descartados.load(memory_order_relaxed) + 1, memory_order_relaxed);
+            return;
+        }
+    }
+    RegistroLog &r = anel->registros[cabeca & (CAPACIDADE_ANEL_LOG - 1)];
+    r.tempoNs = (uint64_t) chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - logEventos.inicio).count();
+    r.tick = tickSimulacao;
+    r.a = a; r.b = b; r.c = c;
+    r.valor = valor;
+    r.nivel = (uint8_t) nivel;
+    r.tipo = (uint8_t) tipo;
+    r.thread = anel->thread;
+    r.reservado = 0;
+    anel->cabeca.store(cabeca + 1, memory_order_release);
+}
+
+#define LOG_EVENTO(nivel, ...) do { if ((nivel) >= NIVEL_LOG_MINIMO) registrarLog((nivel), __VA_ARGS__); } while (0)
+
+// Texto de um registro: o mesmo que antes ia direto para o terminal
+string textoRegistroLog(const RegistroLog &r)
+{
+    ostringstream ss;
+    switch (r.tipo) {
+    case EVENTO_MOVIMENTO: ss << "(" << r.a << "," << r.b << ")"; break;
+    case EVENTO_MOEDA: ss << "Moeda coletada!"; break;
+    case EVENTO_BANDEIRA: ss << "Você chegou na bandeira! Fim de jogo."; break;
+    case EVENTO_CAMINHO: ss << "Caminho até (" << r.a << "," << r.b << "): " << r.c << " passos, " << r.valor << " ms"; break;
+    case EVENTO_SEM_CAMINHO: ss << "Sem caminho até (" << r.a << "," << r.b << ")"; break;
+    default: ss << "Evento desconhecido " << (int) r.tipo;
+    }
+    return ss.str();
+}
+
+// Esvazia um anel: os registros vão em bloco para o arquivo e um a um, como
+// texto, para o terminal. Retorna quantos saíram.
+size_t drenarAnelLog(LogEventos &L, AnelLog &anel)
+{
+    uint32_t cauda = anel.cauda.load(memory_order_relaxed);
+    uint32_t cabeca = anel.cabeca.load(memory_order_acquire);
+    for (uint32_t i = cauda; i != cabeca; ) {
+        uint32_t inicio = i & (CAPACIDADE_ANEL_LOG - 1);
+        uint32_t n = glm::min(cabeca - i, CAPACIDADE_ANEL_LOG - inicio); // Até a volta do anel
+        if (L.arquivo) fwrite(&anel.registros[inicio], sizeof(RegistroLog), n, L.arquivo);
+        if (L.texto)
+            for (uint32_t k = 0; k < n; k++) cout << textoRegistroLog(anel.registros[inicio + k]) << '\n';
+        i += n;
+    }
+    anel.cauda.store(cabeca, memory_order_release);
+    return cabeca - cauda;
+}
+
+// Thread escritora: varre os anéis e dorme 1 ms quando estão todos vazios.
+// Ao parar, ainda esvazia tudo o que foi registrado antes.
+void escritorLog(LogEventos &L)
+{
+    vector<AnelLog *> aneis;
+    while (true) {
+        bool parar = L.parar.load(memory_order_acquire);
+        {
+            lock_guard<mutex> trava(L.mtxAneis);
+            aneis.clear();
+            for (auto &anel : L.aneis) aneis.push_back(anel.get());
+        }
+        size_t n = 0;
+        for (AnelLog *anel : aneis) n += drenarAnelLog(L, *anel);
+        if (n && L.texto) cout.flush();
+        if (parar) break;
+        if (!n) this_thread::sleep_for(chrono::milliseconds(1));
+    }
+}
+
+// Liga o log: texto no terminal e/ou registros binários no arquivo (vazio = sem arquivo)
+bool iniciarLog(LogEventos &L, bool texto, const string &arquivo)
+{
+    if (!arquivo.empty()) {
+        L.arquivo = fopen(arquivo.c_str(), "wb");
+        if (!L.arquivo) {
+            cerr << "Erro ao criar " << arquivo << endl;
+            return false;
+        }
+        CabecalhoLog cab = { { 'L', 'O', 'G', 'E' }, VERSAO_LOG, (uint32_t) sizeof(RegistroLog), 0 };
+        fwrite(&cab, sizeof(cab), 1, L.arquivo);
+    }
+    L.texto = texto;
+    if (!texto && !L.arquivo) return true;
+    L.inicio = chrono::steady_clock::now();
+    L.parar.store(false);
+    L.escritor = thread(escritorLog, ref(L));
+    L.ativo.store(true);
+    return true;
+}
+
+// Desliga o log depois que as threads que registram eventos pararam
+void encerrarLog(LogEventos &L)
+{
+    if (!L.ativo.load()) return;
+    L.ativo.store(false);
+    L.parar.store(true, memory_order_release);
+    L.escritor.join();
+    uint64_t descartados = 0;
+    for (auto &anel : L.aneis) descartados += anel->descartados.load();
+    if (L.arquivo) {
+        fclose(L.arquivo);
+        L.arquivo = nullptr;
+    }
+    if (descartados) cerr << "Log: " << descartados << " eventos descartados com o anel cheio" << endl;
+}
+
+// Mostra um arquivo gravado com --log: um evento por linha, com tick, thread
+// e instante, e a contagem por tipo no fim. Uso: trabalhogb --ler-log arquivo
+int lerLog(const string &filename)
+{
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) {
+        cerr << "Erro ao abrir " << filename << endl;
+        return -1;
+    }
+    CabecalhoLog cab;
+    if (fread(&cab, sizeof(cab), 1, f) != 1 || memcmp(cab.magica, "LOGE", 4) != 0 || cab.versao != VERSAO_LOG
+        || cab.tamanhoRegistro != sizeof(RegistroLog)) {
+        cerr << "Formato de log inválido ou versão não suportada: " << filename << endl;
+        fclose(f);
+        return -1;
+    }
+    size_t contagem[N_TIPOS_EVENTO_LOG] = {}, total = 0;
+    RegistroLog r;
+    while (fread(&r, sizeof(r), 1, f) == 1) {
+        if (r.tipo >= N_TIPOS_EVENTO_LOG || r.nivel >= LOG_DESLIGADO) {
+            cerr << "Registro inválido na posição " << total << " de " << filename << endl;
+            fclose(f);
+            return -1;
+        }
+        cout << "tick " << r.tick << " t" << r.thread << " " << r.tempoNs / 1e6 << " ms "
+             << NOMES_NIVEIS_LOG[r.nivel] << " " << NOMES_EVENTOS_LOG[r.tipo] << ": " << textoRegistroLog(r) << '\n';
+        contagem[r.tipo]++;
+        total++;
+    }
+    fclose(f);
+    cout << total << " eventos:";
+    for (int t = 0; t < N_TIPOS_EVENTO_LOG; t++) cout << " " << NOMES_EVENTOS_LOG[t] << " " << contagem[t];
+    cout << endl;
+    return 0;
+}
+
+// ------------------------------
+// Profiler de frame
+// ------------------------------
+#ifndef SEM_PERFIL
+const char *NOMES_ESCOPOS_PERFIL[N_ESCOPOS_PERFIL] = {
+    "entrada", "simulacao", "desenharMapa", "desenharEntidades", "desenharFlag", "desenharPersonagem", "sprites", "swap",
+    "gravarListas"
+};
+const vec3 CORES_ESCOPOS_PERFIL[N_ESCOPOS_PERFIL] = {
+    { 0.9f, 0.9f, 0.3f }, { 1.0f, 0.5f, 0.2f }, { 0.3f, 0.8f, 0.3f }, { 0.9f, 0.8f, 0.1f },
+    { 0.9f, 0.3f, 0.3f }, { 0.4f, 0.6f, 1.0f }, { 0.7f, 0.4f, 0.9f }, { 0.5f, 0.5f, 0.5f },
+    { 0.2f, 0.8f, 0.8f }
+};
+
+inline int64_t instantePerfilNs() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - perfil.origem).count();
+}
+
+// Liga o profiler (precisa do contexto GL). Com arquivoTrace, os eventos vão
+// para um buffer reservado aqui e são gravados no fim; cheio, o trace para.
+void iniciarPerfilador(Perfilador &P, const string &arquivoTrace) {
+    P.ativo = true;
+    P.overlay = true;
+    P.origem = chrono::steady_clock::now();
+    P.arquivoTrace = arquivoTrace;
+    P.maxEventos = arquivoTrace.empty() ? 0 : 1 << 20;
+    P.eventos.reserve(P.maxEventos);
+    glGenQueries(FRAMES_ANEL_GPU * N_ESCOPOS_PERFIL, &P.consultas[0][0]);
+    for (int f = 0; f < FRAMES_ANEL_GPU; f++)
+        for (int e = 0; e < N_ESCOPOS_PERFIL; e++) P.inicioConsulta[f][e] = -1;
+
+    // Overlay: retângulos coloridos em pixels da janela
+    P.VAO = criarRecursoGPU(GPU_VAO, CATEGORIA_STREAMING);
+    ligarVAO(P.VAO.id());
+    P.VBO = criarRecursoGPU(GPU_BUFFER, CATEGORIA_STREAMING);
+    ligarBuffer(GL_ARRAY_BUFFER, P.VBO.id());
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)(2 * sizeof(GLfloat)));
+    glEnableVertexAttribArray(1);
+    ligarVAO(0);
+    ligarBuffer(GL_ARRAY_BUFFER, 0);
+    P.shaderID = setupShaderProgram(overlayVertexShaderSource, overlayFragmentShaderSource);
+    P.localProjecao = localUniform(P.shaderID, "projection");
+}
+
+inline void abrirEscopoPerfil(Perfilador &P, int escopo, bool gpu) {
+    P.inicioEscopo[escopo] = instantePerfilNs();
+    if (gpu) {
+        int anel = P.frame % FRAMES_ANEL_GPU;
+        glBeginQuery(GL_TIME_ELAPSED, P.consultas[anel][escopo]);
+        P.inicioConsulta[anel][escopo] = P.inicioEscopo[escopo];
+    }
+}
+
+inline void fecharEscopoPerfil(Perfilador &P, int escopo, bool gpu) {
+    if (gpu) glEndQuery(GL_TIME_ELAPSED);
+    int64_t duracao = instantePerfilNs() - P.inicioEscopo[escopo];
+    P.cpuFrame[escopo] += duracao * 1e-6f;
+    if (P.eventos.size() < P.maxEventos) P.eventos.push_back({ P.inicioEscopo[escopo], duracao, (uint8_t) escopo, 0 });
+}
+
+// Mede um escopo do frame enquanto o objeto existir (com o profiler
+// desligado, só o teste de 'ativo')
+struct EscopoPerfilado {
+    int escopo;
+    bool gpu;
+    EscopoPerfilado(int e, bool g) : escopo(perfil.ativo ? e : -1), gpu(g) {
+        if (escopo >= 0) abrirEscopoPerfil(perfil, escopo, gpu);
+    }
+    ~EscopoPerfilado() {
+        if (escopo >= 0) fecharEscopoPerfil(perfil, escopo, gpu);
+    }
+};
+#define PERFIL_ESCOPO(escopo) EscopoPerfilado escopoPerfil##escopo(escopo, false)
+#define PERFIL_ESCOPO_GPU(escopo) EscopoPerfilado escopoPerfil##escopo(escopo, true)
+
+// Começo do frame: lê as consultas de GPU gravadas FRAMES_ANEL_GPU frames
+// atrás (as que este frame vai reaproveitar). Só pega as já prontas; as
+// outras contam como perdidas, mas a CPU nunca espera pela GPU.
+void inicioFramePerfil(Perfilador &P) {
+    if (!P.ativo) return;
+    int anel = P.frame % FRAMES_ANEL_GPU;
+    float gpuTotal = 0.0f;
+    bool leu = false;
+    for (int e = 0; e < N_ESCOPOS_PERFIL; e++) {
+        if (P.inicioConsulta[anel][e] < 0) continue;
+        GLint pronta = 0;
+        glGetQueryObjectiv(P.consultas[anel][e], GL_QUERY_RESULT_AVAILABLE, &pronta);
+        if (pronta) {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(P.consultas[anel][e], GL_QUERY_RESULT, &ns);
+            P.msGpu[e] += (ns * 1e-6f - P.msGpu[e]) * 0.05f;
+            gpuTotal += ns * 1e-6f;
+            leu = true;
+            // No trace, o trecho de GPU aparece a partir do instante em que a CPU o enviou
+            if (P.eventos.size() < P.maxEventos) P.eventos.push_back({ P.inicioConsulta[anel][e], (int64_t) ns, (uint8_t) e, 1 });
+        } else P.consultasPerdidas++;
+        P.inicioConsulta[anel][e] = -1;
+    }
+    if (leu) P.historicoGpu[(P.frame - FRAMES_ANEL_GPU) % FRAMES_HISTORICO_PERFIL] = gpuTotal;
+    P.historicoGpu[P.frame % FRAMES_HISTORICO_PERFIL] = 0.0f; // Ainda sem resultado
+    for (int e = 0; e < N_ESCOPOS_PERFIL; e++) P.cpuFrame[e] = 0.0f;
+}
+
+void fimFramePerfil(Perfilador &P) {
+    if (!P.ativo) return;
+    for (int e = 0; e < N_ESCOPOS_PERFIL; e++) {
+        P.msCpu[e] += (P.cpuFrame[e] - P.msCpu[e]) * 0.05f;
+        P.historicoCpu[P.frame % FRAMES_HISTORICO_PERFIL][e] = P.cpuFrame[e];
+    }
+    P.frame++;
+}
+
+void adicionarRetanguloPerfil(vector<GLfloat> &v, float x0, float y0, float x1, float y1, vec3 cor) {
+    GLfloat quad[6][2] = { { x0, y0 }, { x1, y0 }, { x0, y1 }, { x0, y1 }, { x1, y0 }, { x1, y1 } };
+    for (auto &p : quad) v.insert(v.end(), { p[0], p[1], cor.r, cor.g, cor.b });
+}
+
+// Overlay no canto da janela: uma barra por frame (o mais recente à direita)
+// com o tempo de CPU de cada escopo empilhado e, embaixo, o tempo total de
+// GPU. As linhas brancas marcam 16,7 ms. Uma chamada de desenho, fora das
+// estatísticas do frame.
+void desenharOverlayPerfil(Perfilador &P, int largura, int altura) {
+    if (!P.ativo || !P.overlay) return;
+    const float pixelsPorMs = 4.0f, larguraBarra = 2.0f, alturaGrafico = 25.0f * pixelsPorMs;
+    const float x0 = 10.0f, baseCpu = 10.0f + alturaGrafico, baseGpu = baseCpu + 10.0f + alturaGrafico;
+    P.vertices.clear();
+    adicionarRetanguloPerfil(P.vertices, x0, 10.0f, x0 + FRAMES_HISTORICO_PERFIL * larguraBarra, baseGpu, vec3(0.0f));
+    for (int k = 0; k < FRAMES_HISTORICO_PERFIL; k++) {
+        uint64_t f = P.frame + k; // Do mais antigo (k = 0) ao último fechado
+        float x = x0 + k * larguraBarra, y = baseCpu;
+        for (int e = 0; e < N_ESCOPOS_PERFIL; e++) {
+            float h = glm::min(P.historicoCpu[f % FRAMES_HISTORICO_PERFIL][e] * pixelsPorMs, y - (baseCpu - alturaGrafico));
+            if (h <= 0.0f) continue;
+            adicionarRetanguloPerfil(P.vertices, x, y - h, x + larguraBarra, y, CORES_ESCOPOS_PERFIL[e]);
+            y -= h;
+        }
+        float hGpu = glm::min(P.historicoGpu[f % FRAMES_HISTORICO_PERFIL] * pixelsPorMs, alturaGrafico);
+        if (hGpu > 0.0f) adicionarRetanguloPerfil(P.vertices, x, baseGpu - hGpu, x + larguraBarra, baseGpu, vec3(0.2f, 0.9f, 0.9f));
+    }
+    float xFim = x0 + FRAMES_HISTORICO_PERFIL * larguraBarra;
+    adicionarRetanguloPerfil(P.vertices, x0, baseCpu - 16.7f * pixelsPorMs, xFim, baseCpu - 16.7f * pixelsPorMs + 1, vec3(1.0f));
+    adicionarRetanguloPerfil(P.vertices, x0, baseGpu - 16.7f * pixelsPorMs, xFim, baseGpu - 16.7f * pixelsPorMs + 1, vec3(1.0f));
+
+    usarPrograma(P.shaderID);
+    mat4 projecao = ortho(0.0f, (float) largura, (float) altura, 0.0f, -1.0f, 1.0f);
+    enviarUniform(P.localProjecao, projecao);
+    ligarVAO(P.VAO.id());
+    ligarBuffer(GL_ARRAY_BUFFER, P.VBO.id());
+    glBufferData(GL_ARRAY_BUFFER, P.vertices.size() * sizeof(GLfloat), P.vertices.data(), GL_STREAM_DRAW);
+    definirBytesRecurso(P.VBO, P.vertices.size() * sizeof(GLfloat));
+    ligarBuffer(GL_ARRAY_BUFFER, 0);
+    glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(P.vertices.size() / 5));
+    ligarVAO(0);
+}
+
+// Médias por escopo para o título da janela, em ms de CPU/GPU ("-" = sem GPU)
+string resumoPerfil(const Perfilador &P) {
+    ostringstream s;
+    s.setf(ios::fixed);
+    s.precision(2);
+    s << " | perfil cpu/gpu ms:";
+    for (int e = 0; e < N_ESCOPOS_PERFIL; e++) {
+        s << ' ' << NOMES_ESCOPOS_PERFIL[e] << ' ' << P.msCpu[e] << '/';
+        if (P.msGpu[e] > 0.0f) s << P.msGpu[e];
+        else s << '-';
+    }
+    if (P.consultasPerdidas) s << " (" << P.consultasPerdidas << " consultas de GPU perdidas)";
+    return s.str();
+}
+
+// Grava os eventos no formato de trace do Chrome (chrome://tracing ou
+// Perfetto): escopos de CPU na thread 1 e de GPU na 2, em microssegundos
+void salvarTracePerfil(const Perfilador &P) {
+    if (P.arquivoTrace.empty()) return;
+    ofstream f(P.arquivoTrace);
+    if (!f) {
+        cerr << "Erro ao gravar o trace " << P.arquivoTrace << endl;
+        return;
+    }
+    f.setf(ios::fixed);
+    f.precision(3);
+    f << "{\"traceEvents\":[\n"
+      << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n"
+      << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+    for (const EventoPerfil &e : P.eventos)
+        f << ",\n{\"name\":\"" << NOMES_ESCOPOS_PERFIL[e.escopo] << "\",\"cat\":\"" << (e.gpu ? "gpu" : "cpu")
+          << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << 1 + e.gpu << ",\"ts\":" << e.inicioNs / 1000.0
+          << ",\"dur\":" << e.duracaoNs / 1000.0 << "}";
+    f << "\n]}\n";
+    cout << "Trace do profiler (" << P.eventos.size() << " eventos"
+         << (P.eventos.size() >= P.maxEventos ? ", buffer cheio" : "") << ") salvo em " << P.arquivoTrace << endl;
+}
+#else
+#define PERFIL_ESCOPO(escopo)
+#define PERFIL_ESCOPO_GPU(escopo)
+#endif
+
+// ------------------------------
+// Gravação do frame: listas em paralelo nas arenas, submissão na thread do GL
+// ------------------------------
+
+void *alocarArena(ArenaQuadro &a, size_t bytes) {
+    size_t inicio = (a.usado + 15) & ~(size_t) 15;
+    if (inicio + bytes <= a.capacidade) {
+        a.usado = inicio + bytes;
+        return a.bloco.get() + inicio;
+    }
+    a.avulsos.emplace_back(new uint8_t[bytes]);
+    a.bytesAvulsos += bytes;
+    a.crescimentos++;
+    return a.avulsos.back().get();
+}
+
+// Início do frame: devolve tudo e, se o bloco ficou menor que 'minimo', troca
+// por um que comporte o frame inteiro
+void reiniciarArena(ArenaQuadro &a, size_t minimo) {
+    if (a.capacidade < minimo) {
+        a.capacidade = glm::max(a.capacidade * 2, minimo);
+        a.bloco.reset(new uint8_t[a.capacidade]);
+    }
+    a.avulsos.clear();
+    a.bytesAvulsos = 0;
+    a.usado = 0;
+}
+
+template <typename T>
+void empilharArena(ArenaQuadro &a, ListaArena<T> &l, const T &v) {
+    if (l.n == l.capacidade) {
+        uint32_t nova = glm::max(l.capacidade * 2, 64u);
+        size_t extra = (size_t)(nova - l.capacidade) * sizeof(T);
+        uint8_t *inicio = (uint8_t *) l.dados, *fim = (uint8_t *)(l.dados + l.capacidade);
+        // Última alocação do bloco e ainda cabe: cresce no lugar
+        if (l.dados && inicio >= a.bloco.get() && fim == a.bloco.get() + a.usado && a.usado + extra <= a.capacidade)
+            a.usado += extra;
+        else {
+            T *novos = (T *) alocarArena(a, (size_t) nova * sizeof(T));
+            if (l.n) memcpy(novos, l.dados, (size_t) l.n * sizeof(T));
+            l.dados = novos;
+        }
+        l.capacidade = nova;
+    }
+    l.dados[l.n++] = v;
+}
+
+// Faixas por thread em cada fase: sobra trabalho para roubar quando uma faixa demora mais
+size_t graoGravacao(size_t n) {
+    size_t faixas = 4 * glm::max(escalonador.filas.size(), (size_t) 1);
+    return glm::max((n + faixas - 1) / faixas, (size_t) 1);
+}
+
+// Linhas [inicio, fim) do retângulo de chunks sob a visão: culling, uso no
+// streaming e tiles animados
+void gravarChunks(GravacaoQuadro &G, size_t inicio, size_t fim) {
+    FaixaGravada &F = G.mapa[inicio / G.graoMapa];
+    ArenaQuadro &A = G.arenas[indiceThreadEscalonador];
+    for (int cy = G.minChunk.y + (int) inicio; cy < G.minChunk.y + (int) fim; cy++)
+        for (int cx = G.minChunk.x; cx <= G.maxChunk.x; cx++) {
+            if (!chunkVisivel(camadaMapa, cx, cy)) {
+                F.chunksDescartados++;
+                continue;
+            }
+            F.chunksVisiveis++;
+            size_t chunk = (size_t) cy * mapa.chunksX + cx;
+            if (streaming.ativo) {
+                // Chunk visível ainda não carregado fica em branco até chegar
+                if (!chunkResidente(chunk)) { F.faltas++; continue; }
+                F.acertos++;
+                empilharArena(A, F.chunksUsados, (uint32_t) chunk);
+            }
+            if (chao.haAnimados)
+                for (const InstanciaTile &t : animadosDoChunk(chao, chunk)) empilharArena(A, F.animados, t);
+        }
+}
+
+// Moedas vivas entre os ids [inicio, fim)
+void gravarMoedas(GravacaoQuadro &G, size_t inicio, size_t fim) {
+    FaixaGravada &F = G.moedas[inicio / G.graoMoedas];
+    ArenaQuadro &A = G.arenas[indiceThreadEscalonador];
+    for (size_t i = inicio; i < fim; i++)
+        if (entidades.viva[i]) empilharArena(A, F.sprites, itemEntidade(0, i));
+}
+
+// Atores nas linhas [inicio, fim) da região da grade ao redor da visão
+void gravarAtores(GravacaoQuadro &G, size_t inicio, size_t fim) {
+    FaixaGravada &F = G.atores[inicio / G.graoAtores];
+    ArenaQuadro &A = G.arenas[indiceThreadEscalonador];
+    vec2 minVisao = camera.visao - camera.tamanho / 2.0f;
+    vec2 maxVisao = camera.visao + camera.tamanho / 2.0f;
+    vec2 meia = aparencias[ENTIDADE_ATOR].dimensoes / 2.0f;
+    for (int y = G.centroAtores.y - G.raioAtores + (int) inicio; y < G.centroAtores.y - G.raioAtores + (int) fim; y++)
+        for (int x = G.centroAtores.x - G.raioAtores; x <= G.centroAtores.x + G.raioAtores; x++)
+            paraCadaNaCelula(gradeEntidades, ivec2(x, y), [&](int id) {
+                if (entidades.tipo[id] != ENTIDADE_ATOR) return;
+                vec2 p = posicaoEntidade(id);
+                if (p.x + meia.x < minVisao.x || p.x - meia.x > maxVisao.x ||
+                    p.y + meia.y < minVisao.y || p.y - meia.y > maxVisao.y)
+                    return;
+                empilharArena(A, F.sprites, itemEntidade(1, id));
+            });
+}
+
+// Fase 1 do frame (sem GL): as threads do escalonador percorrem chunks,
+// moedas e atores e gravam as listas nas arenas; a thread principal junta as
+// faixas na ordem, então o resultado não depende do número de threads
+void gravarListasQuadro()
+{
+    GravacaoQuadro &G = gravacao;
+    size_t nThreads = glm::max(escalonador.filas.size(), (size_t) 1);
+    if (G.arenas.size() != nThreads) G.arenas.resize(nThreads);
+    // Com o roubo de tarefas, qualquer thread pode pegar a maior parte do
+    // trabalho: todas as arenas ficam com o tamanho da que mais usou
+    size_t maior = 0;
+    for (const ArenaQuadro &a : G.arenas) maior = glm::max(maior, a.usado + a.bytesAvulsos);
+    for (ArenaQuadro &a : G.arenas) reiniciarArena(a, maior);
+
+    // Mapa: só o retângulo de chunks sob a visão é testado um a um
+    chunksSobVisao(camadaMapa, G.minChunk, G.maxChunk);
+    size_t linhasChunks = (size_t) glm::max(G.maxChunk.y - G.minChunk.y + 1, 0);
+    size_t colunasChunks = (size_t) glm::max(G.maxChunk.x - G.minChunk.x + 1, 0);
+    G.graoMapa = graoGravacao(linhasChunks);
+    G.mapa.assign((linhasChunks + G.graoMapa - 1) / G.graoMapa, FaixaGravada());
+    paraCadaFaixa(escalonador, linhasChunks, G.graoMapa, [&G](size_t inicio, size_t fim) { gravarChunks(G, inicio, fim); });
+    estatisticas.chunksDescartados += (int)((size_t) mapa.chunksX * mapa.chunksY - linhasChunks * colunasChunks);
+
+    // Moedas: na ordem de pintor entram no lote do frame; senão o lote
+    // persistente só é refeito depois de uma coleta
+    bool moedas = ordemNaCpu || loteMoedas.sujo;
+    size_t nMoedas = moedas ? entidades.inicioAtores : 0;
+    G.graoMoedas = glm::max(graoGravacao(nMoedas), (size_t) 4096);
+    G.moedas.assign((nMoedas + G.graoMoedas - 1) / G.graoMoedas, FaixaGravada());
+    paraCadaFaixa(escalonador, nMoedas, G.graoMoedas, [&G](size_t inicio, size_t fim) { gravarMoedas(G, inicio, fim); });
+
+    // Atores: só os das células ao redor da visão, consultados na grade
+    size_t linhas = 0;
+    if (entidades.n > entidades.inicioAtores) {
+        float w = tileH, h = tileW;
+        vec2 d = camera.visao - vec2(400, 130);
+        G.centroAtores = ivec2((int) floor(d.x / w + d.y / h), (int) floor(d.y / h - d.x / w));
+        G.raioAtores = (int) ceil((camera.tamanho.x / w + camera.tamanho.y / h) / 2.0f) + 1;
+        linhas = 2 * G.raioAtores + 1;
+    }
+    G.graoAtores = graoGravacao(linhas);
+    G.atores.assign((linhas + G.graoAtores - 1) / G.graoAtores, FaixaGravada());
+    paraCadaFaixa(escalonador, linhas, G.graoAtores, [&G](size_t inicio, size_t fim) { gravarAtores(G, inicio, fim); });
+
+    // Junção na thread principal
+    G.totalAnimados = 0;
+    for (const FaixaGravada &F : G.mapa) {
+        estatisticas.chunksVisiveis += F.chunksVisiveis;
+        estatisticas.chunksDescartados += F.chunksDescartados;
+        streaming.acertos += F.acertos;
+        streaming.faltas += F.faltas;
+        for (uint32_t k = 0; k < F.chunksUsados.n; k++) usarChunkStreaming(F.chunksUsados.dados[k]);
+        G.totalAnimados += F.animados.n;
+    }
+    if (moedas) {
+        SpriteBatch &destino = ordemNaCpu ? loteSprites : loteMoedas;
+        if (!ordemNaCpu) destino.itens.clear();
+        for (const FaixaGravada &F : G.moedas)
+            destino.itens.insert(destino.itens.end(), F.sprites.dados, F.sprites.dados + F.sprites.n);
+        destino.sujo = true;
+        destino.preparado = false;
+    }
+    for (const FaixaGravada &F : G.atores) {
+        if (!F.sprites.n) continue;
+        loteSprites.itens.insert(loteSprites.itens.end(), F.sprites.dados, F.sprites.dados + F.sprites.n);
+        loteSprites.sujo = true;
+        loteSprites.preparado = false;
+    }
+}
+
+size_t crescimentosArenas() {
+    size_t total = 0;
+    for (const ArenaQuadro &a : gravacao.arenas) total += a.crescimentos;
+    return total;
+}
+
+// ------------------------------
+// Cena: preparação e desenho de um frame (janela ou --bench-render)
+// ------------------------------
+
+// Precisa do contexto GL e do mapa já carregado. Retorna o shader dos tiles avulsos.
+GLuint iniciarCena(int moedasExtras, int nAtores, int texturasExtras, vec2 tamanhoTela)
+{
+    // Compila shaders; projeção e tempo ficam no uniform buffer do bloco Quadro
+    GLuint shaderID = setupShader();
+    setupQuadro();
+    localModel = localUniform(shaderID, "model");
+    localOffsetTex = localUniform(shaderID, "offsetTex");
+
+    // Atlas com o tileset e todas as spritesheets (reaproveitado do cache quando as fontes não mudaram).
+    // --texturas-extras repete as spritesheets para medir a carga com muitos arquivos.
+    vector<string> spritesheets = { tilesetFile, "personagem_spritesheet.png", "coin_Sheet.png", "flag animation.png" };
+    for (int i = 0; i < texturasExtras; i++) spritesheets.push_back(spritesheets[1 + i % 3]);
+    carregarAtlas(atlas, spritesheets, "atlas.cache");
+    const RegiaoAtlas &regiaoTileset = regiaoAtlas(tilesetFile);
+    GLuint texID = atlas.textura.id();
+
+    // Configura tileset (a geometria é a mesma para todos os tiles)
+    float ds, dt;
+    RecursoGPU VAO = setupTile(nTiles, regiaoTileset.uvTam, ds, dt);
+    tileset.clear();
+    for (int i=0; i < nTiles; i++)
+    {
+        Tile tile;
+        tile.dimensions = vec3(tileH, tileW, 1.0);
+        tile.iTile = i;
+        tile.texID = texID;
+        tile.uvBase = regiaoTileset.uv0;
+        tile.VAO = VAO;
+        tile.ds = ds;
+        tile.dt = dt;
+        tile.caminhavel = true;
+        tileset.push_back(tile);
+    }
+    // Define tiles não caminháveis (o mapa binário já traz a lista)
+    if (bloqueadosNoMapa) aplicarTilesBloqueados();
+    else carregarTilesBloqueados("tiles_bloqueados.txt");
+    carregarTilesAnimados("tiles_animados.txt");
+
+    // Camada instanciada do mapa e as páginas do chão
+    setupTileLayer(camadaMapa, regiaoTileset, texID);
+    setupChao(chao);
+
+    // Estado inicial da partida (personagem, moedas, atores e bandeira)
+    iniciarEscalonador(escalonador, numeroThreadsSimulacao());
+    prepararAnimadosChunks(chao);
+    iniciarSimulacao(moedasExtras, nAtores);
+    iniciarStreaming();
+
+    // Aparência do sprite do personagem
+    const RegiaoAtlas &regiaoPersonagem = regiaoAtlas("personagem_spritesheet.png");
+    personagem.texID = atlas.textura.id();
+    personagem.uvBase = regiaoPersonagem.uv0;
+    personagem.ds = regiaoPersonagem.uvTam.x / (float) personagem.nFrames;
+    personagem.dt = regiaoPersonagem.uvTam.y / (float) personagem.nAnimations;
+
+    // Configura moedas, atores, flag e o lote de sprites
+    setupAparencias();
+    setupFlag();
+    setupSpriteBatch(loteSprites, false);
+    setupSpriteBatch(loteMoedas, true);
+
+    usarPrograma(shaderID);
+
+    // Uniforms e projeção
+    glActiveTexture(GL_TEXTURE0);
+    enviarUniform(localUniform(shaderID, "tex_buff"), 0);
+
+    // Câmera começa centrada no personagem
+    camera.tamanho = tamanhoTela;
+    atualizarCamera(-1.0f);
+
+    // OpenGL states
+    glEnable(GL_DEPTH_TEST);
+    funcaoProfundidade(GL_ALWAYS);
+    glEnable(GL_BLEND);
+    definirMistura(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    return shaderID;
+}
+
+// Desfaz iniciarCena: para as threads da cena e solta os objetos GL dela
+// (atlas, páginas do chão, camada, lotes e o losango dos tiles). Programas e
+// o bloco Quadro ficam no gerenciador para a próxima carga; o streaming é do
+// mapa e para com pararStreaming.
+void encerrarCena()
+{
+    encerrarEscalonador(escalonador);
+    encerrarPipelineTexturas();
+    tileset.clear();
+    camadaMapa = TileLayer();
+    chao = ChaoPreRenderizado();
+    loteSprites = SpriteBatch();
+    loteMoedas = SpriteBatch();
+    gravacao = GravacaoQuadro();
+    atlas.textura = RecursoGPU();
+}
+
+// Desenha a cena no framebuffer atual, com o estado interpolado em alfa entre
+// os dois últimos passos de simulação; zera e preenche as estatísticas do frame
+void desenharCena(GLuint shaderID, float alfa, double agora)
+{
+    estatisticas.drawCalls = 0;
+    estatisticas.drawCallsMapa = 0;
+    estatisticas.chunksVisiveis = 0;
+    estatisticas.chunksDescartados = 0;
+    estatisticas.trocasEstado = 0;
+    estatisticas.trocasEvitadas = 0;
+    estatisticas.uploadsUniform = 0;
+    estatisticas.paginasAssadas = 0;
+    estatisticas.tilesAssados = 0;
+
+    // Fase 1, sem GL: listas do mapa e das entidades gravadas em paralelo,
+    // bandeira e personagem no lote e os quads dos lotes escritos
+    auto inicio = chrono::steady_clock::now();
+    interpolarCamera(alfa);
+    {
+        PERFIL_ESCOPO(PERFIL_GRAVACAO);
+        gravarListasQuadro();
+    }
+    {
+        PERFIL_ESCOPO(PERFIL_FLAG);
+        desenharFlag();
+    }
+    {
+        PERFIL_ESCOPO(PERFIL_PERSONAGEM);
+        desenharPersonagem(alfa);
+    }
+    {
+        PERFIL_ESCOPO(PERFIL_GRAVACAO);
+        if (!ordemNaCpu) prepararSpriteBatch(loteMoedas);
+        prepararSpriteBatch(loteSprites);
+    }
+    auto fimGravacao = chrono::steady_clock::now();
+    gravacao.msGravacao = chrono::duration<double, milli>(fimGravacao - inicio).count();
+
+    // Fase 2: submissão na thread do GL
+    enviarQuadro(projecaoCamera(), (float) agora);
+
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    escreverProfundidade(true);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glLineWidth(10);
+    glPointSize(20);
+
+    // Desenho dos elementos (bandeira e personagem só entram no lote de
+    // sprites; o trabalho de GPU deles aparece em "sprites"). O chão não
+    // escreve profundidade; os sprites se ordenam entre si pelo depth buffer
+    // (GL_LEQUAL: no empate vence o desenhado depois, como na ordem de pintor).
+    // Os texels opacos de todos os lotes vão antes das bordas translúcidas,
+    // para que toda borda se misture com o que ficou atrás dela.
+    // Limitação: o tileset só tem losangos chatos, então nada do chão fica na
+    // frente de um sprite; tiles altos (paredes, árvores) precisariam entrar no
+    // lote de sprites com a profundidade da célula.
+    funcaoProfundidade(GL_ALWAYS);
+    escreverProfundidade(false);
+    {
+        PERFIL_ESCOPO_GPU(PERFIL_MAPA);
+        desenharMapa();
+        desenharAtualTile(shaderID);
+    }
+    funcaoProfundidade(ordemNaCpu ? GL_ALWAYS : GL_LEQUAL);
+    escreverProfundidade(true);
+    {
+        PERFIL_ESCOPO_GPU(PERFIL_ENTIDADES);
+        desenharEntidades(SPRITES_OPACOS);
+    }
+    {
+        PERFIL_ESCOPO_GPU(PERFIL_SPRITES);
+        desenharSpriteBatch(loteSprites, SPRITES_OPACOS);
+        desenharEntidades(SPRITES_BORDAS);
+        desenharSpriteBatch(loteSprites, SPRITES_BORDAS);
+    }
+    funcaoProfundidade(GL_ALWAYS);
+    gravacao.msSubmissao = chrono::duration<double, milli>(chrono::steady_clock::now() - fimGravacao).count();
+}
+
+// ------------------------------
+// Função principal (main)
+// ------------------------------
+int main(int argc, char **argv)
+{
+    auto inicioPrograma = chrono::steady_clock::now();
+
+    // Modos de benchmark (sem janela)
+    if (argc > 1 && string(argv[1]) == "--bench-mapa") {
+        benchmarkMapa(argc > 2 ? glm::max(atoi(argv[2]), 8) : 2048);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-carga") {
+        benchmarkCargaMapa();
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-entidades") {
+        benchmarkEntidades(argc > 2 ? (size_t) atoll(argv[2]) : 500000, argc > 3 ? atoi(argv[3]) : 0);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-log") {
+        benchmarkLog(argc > 2 ? (size_t) atoll(argv[2]) : 1000000);
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "--ler-log") {
+        return lerLog(argv[2]);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-colisao") {
+        benchmarkColisao(argc > 2 ? (size_t) atoll(argv[2]) : 1000000);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-fluxo") {
+        benchmarkFluxo(argc > 2 ? (size_t) atoll(argv[2]) : 1000000, argc > 3 ? atoi(argv[3]) : 0);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-caminhos") {
+        benchmarkCaminhos(argc > 2 ? atoi(argv[2]) : 2048, argc > 3 ? atoi(argv[3]) : 200);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-render") {
+        return benchmarkRender(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-ordem") {
+        return benchmarkOrdem(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-recargas") {
+        return benchmarkRecargas(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-recarga-quente") {
+        return benchmarkRecargaQuente(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-gravacao") {
+        return benchmarkGravacao(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-snapshots") {
+        return benchmarkSnapshots(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--headless") {
+        return simulacaoHeadless(argc, argv);
+    }
+    if (argc > 3 && string(argv[1]) == "--converter-mapa") {
+        return converterMapa(argv[2], argv[3], argc > 4 ? argv[4] : "tiles_bloqueados.txt") ? 0 : -1;
+    }
+
+    // Opções: [arquivo do mapa] [--stream <arquivo.tmap> [raio] [orcamentoMB]] [--moedas N]
+    //         [--texturas-extras N] [--threads-decodificacao N] [--vsync 0|1] [--fps N] [--ocioso]
+    //         [--gravar-roteiro arquivo] [--atores N] [--multidao] [--threads N]
+    //         [--perfil [trace.json]] [--observar] [--rebobinar segundos [MB]] [--snapshot arquivo]
+    string arquivoMapa = "map.txt";
+    bool usarStreaming = false;
+    int raioStreaming = 2;
+    size_t orcamentoMB = 64;
+    int moedasExtras = 0;
+    int nAtores = 0;
+    int texturasExtras = 0;
+    int vsync = 1;
+    double limiteFPS = 0; // 0 = sem limite
+    bool modoOcioso = false;
+    bool usarPerfil = false;
+    bool observar = false;
+    double segundosRebobinar = 300;
+    size_t orcamentoRebobinarMB = 8;
+    bool rebobinarExplicito = false;
+    string arquivoTrace, arquivoLog;
+    for (int a = 1; a < argc; a++) {
+        string arg = argv[a];
+        if (arg == "--stream" && a + 1 < argc) {
+            usarStreaming = true;
+            arquivoMapa = argv[++a];
+            if (a + 1 < argc && isdigit(argv[a + 1][0])) raioStreaming = atoi(argv[++a]);
+            if (a + 1 < argc && isdigit(argv[a + 1][0])) orcamentoMB = (size_t) atoi(argv[++a]);
+        }
+        else if (arg == "--moedas" && a + 1 < argc) moedasExtras = atoi(argv[++a]);
+        else if (arg == "--texturas-extras" && a + 1 < argc) texturasExtras = atoi(argv[++a]);
+        else if (arg == "--threads-decodificacao" && a + 1 < argc) threadsDecodificacao = atoi(argv[++a]);
+        else if (arg == "--vsync" && a + 1 < argc) vsync = atoi(argv[++a]);
+        else if (arg == "--fps" && a + 1 < argc) limiteFPS = atof(argv[++a]);
+        else if (arg == "--ocioso") modoOcioso = true;
+        else if (arg == "--gravar-roteiro" && a + 1 < argc) roteiroGravacao.open(argv[++a]);
+        else if (arg == "--atores" && a + 1 < argc) nAtores = atoi(argv[++a]);
+        else if (arg == "--multidao") multidao = true;
+        else if (arg == "--threads" && a + 1 < argc) threadsSimulacao = atoi(argv[++a]);
+        else if (arg == "--perfil") {
+            usarPerfil = true;
+            if (a + 1 < argc && argv[a + 1][0] != '-') arquivoTrace = argv[++a];
+        }
+        else if (arg == "--log" && a + 1 < argc) arquivoLog = argv[++a];
+        else if (arg == "--observar") observar = true;
+        else if (arg == "--rebobinar" && a + 1 < argc) {
+            rebobinarExplicito = true;
+            segundosRebobinar = atof(argv[++a]);
+            if (a + 1 < argc && isdigit(argv[a + 1][0])) orcamentoRebobinarMB = (size_t) atoi(argv[++a]);
+        }
+        else if (arg == "--snapshot" && a + 1 < argc) arquivoSnapshot = argv[++a];
+        else if (arg[0] != '-') arquivoMapa = arg;
+    }
+    if (!iniciarLog(logEventos, logSimulacao, arquivoLog)) return -1;
+
+    // Carrega configuração do mapa (texto ou binário); no streaming os chunks chegam em segundo plano
+    recargaQuente.guardarTexto = observar;
+    if (usarStreaming) {
+        if (!carregarMapaStreaming(arquivoMapa, raioStreaming, orcamentoMB)) return -1;
+    } else if (!loadMapConfig(arquivoMapa)) return -1;
+
+    // Inicialização da GLFW
+    glfwInit();
+    glfwWindowHint(GLFW_SAMPLES, 8);
+
+    // Criação da janela GLFW
+    const GLuint WIDTH = 800, HEIGHT = 600;
+    GLFWwindow *window = glfwCreateWindow(WIDTH, HEIGHT, "Jogo com Moedas Animadas", nullptr, nullptr);
+    if (!window)
+    {
+        std::cerr << "Falha ao criar a janela GLFW" << std::endl;
+        glfwTerminate();
+        return -1;
+    }
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(vsync);
+
+    // Callbacks de teclado e mouse (clique para mover)
+    glfwSetKeyCallback(window, key_callback);
+    glfwSetMouseButtonCallback(window, mouse_button_callback);
+
+    // Inicialização do GLAD
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    {
+        std::cerr << "Falha ao inicializar GLAD" << std::endl;
+        return -1;
+    }
+
+    // Informações de versão
+    const GLubyte *renderer = glGetString(GL_RENDERER);
+    const GLubyte *version = glGetString(GL_VERSION);
+    cout << "Renderer: " << renderer << endl;
+    cout << "OpenGL version supported " << version << endl;
+
+    // Viewport
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    glViewport(0, 0, width, height);
+
+    // Shaders, texturas, camada do mapa, sprites e estado inicial da partida
+    GLuint shaderID = iniciarCena(moedasExtras, nAtores, texturasExtras, vec2(WIDTH, HEIGHT));
+    if (observar) iniciarRecargaQuente(arquivoMapa);
+    size_t atoresCena = entidades.n - entidades.inicioAtores;
+    if (!rebobinarExplicito && segundosRebobinar > 0 && atoresCena > ATORES_MAX_HISTORICO)
+        cerr << "Rebobinar desligado: " << atoresCena << " atores (acima de " << ATORES_MAX_HISTORICO
+             << "); use --rebobinar para ligar" << endl;
+    else iniciarHistorico(historico, segundosRebobinar, orcamentoRebobinarMB, rebobinarExplicito ? 0 : ORCAMENTO_HISTORICO_MS);
+
+#ifndef SEM_PERFIL
+    if (usarPerfil) iniciarPerfilador(perfil, arquivoTrace);
+#else
+    if (usarPerfil) cerr << "Profiler desativado na compilação (SEM_PERFIL)" << endl;
+#endif
+
+    // Relatório de draw calls (uma vez por segundo, no título da janela)
+    double ultimoRelatorio = glfwGetTime();
+    int framesNoPeriodo = 0;
+
+    // Relógio da simulação: passos fixos acumulados a partir do tempo real
+    double ultimoTempo = glfwGetTime();
+    double acumulador = 0.0;
+    double proximaAnimacao = 0.0;
+    bool precisaDesenhar = true;
+
+    // ------------------------------
+    // Loop principal do jogo
+    // ------------------------------
+    while (!glfwWindowShouldClose(window))
+    {
+        double inicioIteracao = glfwGetTime();
+#ifndef SEM_PERFIL
+        inicioFramePerfil(perfil);
+#endif
+        {
+            PERFIL_ESCOPO(PERFIL_ENTRADA);
+            glfwPollEvents();
+        }
+
+        // Simulação em passos fixos; o excesso vira fração de interpolação
+        double agora = glfwGetTime();
+        acumulador += glm::min(agora - ultimoTempo, 0.25); // Evita a espiral após pausas longas
+        ultimoTempo = agora;
+        {
+            PERFIL_ESCOPO(PERFIL_SIMULACAO);
+            while (acumulador >= PASSO_SIMULACAO) {
+                if (passoSimulacao((float) PASSO_SIMULACAO)) precisaDesenhar = true;
+                acumulador -= PASSO_SIMULACAO;
+            }
+        }
+        if (flagReached) glfwSetWindowShouldClose(window, GL_TRUE);
+
+        // Chunks do streaming ao redor do personagem, texturas recém-decodificadas
+        // e arquivos alterados em disco (--observar)
+        uint64_t carregadosAntes = streaming.carregados;
+        atualizarStreaming(ultimaDirecao);
+        atualizarPipelineTexturas(4.0);
+        if (atualizarRecargaQuente()) precisaDesenhar = true;
+        if (streaming.carregados != carregadosAntes || pipelineTexturas.ativo) precisaDesenhar = true;
+
+        // Modo ocioso: sem mudanças na cena, dorme até a próxima troca de frame
+        // das animações ou até chegar um evento (observando arquivos, acorda
+        // a cada 0,1 s para conferi-los; rebobinando, não dorme)
+        if (modoOcioso && !precisaDesenhar && !historico.voltando && agora < proximaAnimacao) {
+            double espera = proximaAnimacao - agora;
+            glfwWaitEventsTimeout(recargaQuente.ativo ? glm::min(espera, 0.1) : espera);
+            continue;
+        }
+
+        // Estado desenhado entre os dois últimos passos de simulação
+        desenharCena(shaderID, (float)(acumulador / PASSO_SIMULACAO), agora);
+        framesNoPeriodo++;
+#ifndef SEM_PERFIL
+        desenharOverlayPerfil(perfil, width, height);
+#endif
+
+        if (glfwGetTime() - ultimoRelatorio > 1.0) {
+            double msFrame = 1000.0 * (glfwGetTime() - ultimoRelatorio) / framesNoPeriodo;
+            string titulo = "Jogo com Moedas Animadas | " + to_string(msFrame) + " ms/frame"
+                          + " | draw calls: " + to_string(estatisticas.drawCalls)
+                          + " (mapa: " + to_string(estatisticas.drawCallsMapa) + ")"
+                          + " | trocas de estado: " + to_string(estatisticas.trocasEstado)
+                          + " (" + to_string(estatisticas.trocasEvitadas) + " evitadas)"
+                          + " | uniforms: " + to_string(estatisticas.uploadsUniform)
+                          + " | chunks: " + to_string(estatisticas.chunksVisiveis) + " visíveis, "
+                          + to_string(estatisticas.chunksDescartados) + " descartados"
+                          + " | chão: " + to_string(chao.paginas.size()) + " páginas, "
+                          + to_string(estatisticas.tilesAssados) + " tiles assados"
+                          + " | GPU: " + to_string(bytesGPU() / (1024 * 1024)) + " MB";
+            if (streaming.ativo)
+                titulo += " | streaming: " + to_string(streaming.nResidentes) + " residentes, "
+                        + to_string(streaming.acertos) + " acertos, " + to_string(streaming.faltas) + " faltas, "
+                        + to_string(streaming.travamentos) + " travamentos"
+                        + (streaming.errosLeitura ? ", " + to_string(streaming.errosLeitura.load()) + " erros de leitura" : "");
+#ifndef SEM_PERFIL
+            if (perfil.ativo) titulo += resumoPerfil(perfil);
+#endif
+            glfwSetWindowTitle(window, titulo.c_str());
+            ultimoRelatorio = glfwGetTime();
+            framesNoPeriodo = 0;
+        }
+
+        {
+            PERFIL_ESCOPO(PERFIL_SWAP);
+            glfwSwapBuffers(window);
+        }
+#ifndef SEM_PERFIL
+        fimFramePerfil(perfil);
+#endif
+        precisaDesenhar = false;
+        proximaAnimacao = proximaTrocaAnimacao(agora);
+
+        static bool primeiroFrame = true;
+        if (primeiroFrame) {
+            cout << "Primeiro frame em " << chrono::duration<double, milli>(chrono::steady_clock::now() - inicioPrograma).count()
+                 << " ms" << endl;
+            primeiroFrame = false;
+        }
+
+        // Limite de frames: espera o restante do período atendendo eventos
+        if (limiteFPS > 0) {
+            double fimFrame = inicioIteracao + 1.0 / limiteFPS;
+            for (double t = glfwGetTime(); t < fimFrame && !glfwWindowShouldClose(window); t = glfwGetTime())
+                glfwWaitEventsTimeout(fimFrame - t);
+        }
+    }
+    // Finaliza recarga, streaming, threads da simulação, texturas pendentes, objetos GL e GLFW
+    encerrarRecargaQuente();
+    pararStreaming();
+    encerrarCena();
+#ifndef SEM_PERFIL
+    salvarTracePerfil(perfil);
+#endif
+    encerrarLog(logEventos);
+    encerrarRecursos();
+    glfwTerminate();
+    return 0;
+}
+
+// ------------------------------
+// Função de callback de teclado
+// ------------------------------
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mode)
+{
+    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
+        glfwSetWindowShouldClose(window, GL_TRUE);
+#ifndef SEM_PERFIL
+    if (key == GLFW_KEY_F3 && action == GLFW_PRESS) {
+        perfil.overlay = !perfil.overlay;
+        return;
+    }
+#endif
+    // Backspace rebobina enquanto estiver pressionado; F5 salva e F9 carrega a partida
+    if (key == GLFW_KEY_BACKSPACE) {
+        historico.voltando = historico.ativo && action != GLFW_RELEASE;
+        return;
+    }
+    if (key == GLFW_KEY_F5 || key == GLFW_KEY_F9) {
+        if (action != GLFW_PRESS) return;
+        if (key == GLFW_KEY_F5) salvarSnapshot(arquivoSnapshot);
+        else carregarSnapshot(arquivoSnapshot);
+        return;
+    }
+
+    // A lógica roda no próximo passo de simulação
+    if (action == GLFW_PRESS)
+        comandosPendentes.push_back(key);
+}
+
+// Tile sob um ponto da janela: desfaz a câmera e a projeção isométrica da
+// camada do chão (o losango do tile (u, v) tem centro em
+// origem + (w/2 + (u-v)*w/2, h/2 + (u+v)*h/2))
+ivec2 tileSobCursor(GLFWwindow *window, double x, double y)
+{
+    int larguraJanela, alturaJanela;
+    glfwGetWindowSize(window, &larguraJanela, &alturaJanela);
+    vec2 mundo = camera.visao - camera.tamanho / 2.0f
+               + vec2((float)(x / larguraJanela) * camera.tamanho.x, (float)(y / alturaJanela) * camera.tamanho.y);
+    float w = tileH, h = tileW;
+    vec2 d = mundo - camadaMapa.origem - vec2(w / 2, h / 2);
+    float uMenosV = d.x / (w / 2), uMaisV = d.y / (h / 2);
+    return ivec2((int) floor((uMaisV + uMenosV) / 2 + 0.5f), (int) floor((uMaisV - uMenosV) / 2 + 0.5f));
+}
+
+// Clique com o botão esquerdo: caminho até o tile clicado. O personagem o
+// percorre pelos passos de simulação, como se as teclas fossem apertadas.
+// Só guarda o alvo: a busca (e a remontagem do grafo abstrato, se o mapa
+// mudou) fica para o próximo passo de simulação, fora do callback
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
+{
+    if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS) return;
+    double x, y;
+    glfwGetCursorPos(window, &x, &y);
+    pedidoCaminho = tileSobCursor(window, x, y);
+    haPedidoCaminho = true;
+}
+
+// Atende o último clique: caminho do personagem até o alvo, se caminhável
+void atenderPedidoCaminho()
+{
+    haPedidoCaminho = false;
+    ivec2 alvo = pedidoCaminho;
+    if (!celulaCaminhavel(alvo.x, alvo.y)) return;
+
+    auto inicio = chrono::steady_clock::now();
+    bool achou = encontrarCaminho(ivec2((int) pos.x, (int) pos.y), alvo, caminhoAtual);
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+    passoCaminho = 1; // caminhoAtual[0] é a célula atual
+    ticksAtePasso = 0;
+    if (achou) LOG_EVENTO(LOG_INFO, EVENTO_CAMINHO, alvo.x, alvo.y, (int32_t) caminhoAtual.size() - 1, (float) ms);
+    else LOG_EVENTO(LOG_INFO, EVENTO_SEM_CAMINHO, alvo.x, alvo.y);
+}
+
+// ------------------------------
+// Simulação em passo fixo
+// ------------------------------
+
+// Avança a simulação de dt segundos: aplica as teclas pendentes, checa coleta
+// e bandeira e move a câmera. Retorna true se algo visível mudou.
+bool passoSimulacao(float dt)
+{
+    posAnterior = pos;
+    camera.centroAnterior = camera.centro;
+
+    // Com Backspace pressionado, um snapshot para trás por passo (as teclas
+    // e cliques são ignorados); senão o clique pendente e um tick das regras,
+    // guardado no histórico
+    bool mudou;
+    if (historico.voltando) {
+        haPedidoCaminho = false;
+        mudou = voltarSnapshot(historico);
+    } else {
+        if (haPedidoCaminho) atenderPedidoCaminho();
+        mudou = tickRegras(comandosPendentes.data(), comandosPendentes.size());
+        if (historico.ativo) registrarSnapshot(historico);
+    }
+    comandosPendentes.clear();
+
+    atualizarCamera(dt);
+    vec2 deslocamento = camera.centro - camera.centroAnterior;
+    if (glm::abs(deslocamento.x) + glm::abs(deslocamento.y) > 0.01f) mudou = true;
+    return mudou;
+}
+
+// ------------------------------
+// Regras do jogo (sem GL nem janela: rodam também no modo headless)
+// ------------------------------
+
+// Teclas de movimento. Os códigos da GLFW para letras são o próprio ASCII
+// maiúsculo, então roteiros gravados usam a letra.
+bool ehTeclaMovimento(int key)
+{
+    return key > 0 && key < 128 && strchr("WASDQEZX", key) != nullptr;
+}
+
+// Estado inicial da partida: personagem na origem, moedas fixas mais
+// moedasExtras em células aleatórias, nAtores andando ao acaso (sementes fixas)
+// e bandeira no último tile
+void iniciarSimulacao(int moedasExtras, int nAtores)
+{
+    pos = vec2(0, 0);
+    posAnterior = pos;
+    ultimaDirecao = vec2(0, 0);
+    tickSimulacao = 0;
+    flagReached = false;
+
+    personagem.nAnimations = 4;
+    personagem.nFrames = 6;
+    personagem.iAnimation = 0;
+    personagem.iFrame = 0;
+    personagem.position = vec3(0, 0, 0);
+    personagem.dimensions = vec3(tileH, tileW, 1.0);
+
+    vector<vec2> posicoesMoedas = {
+        {1, 1}, {3, 2}, {5, 3}, {2, 4}, {4, 5}
+    };
+    mt19937 rng(2024);
+    for (int i = 0; i < moedasExtras; i++)
+        posicoesMoedas.push_back(vec2(rng() % tilemapWidth, rng() % tilemapHeight));
+    entidades = Entidades();
+    reservarGrade(gradeEntidades, posicoesMoedas.size() + glm::max(nAtores, 0));
+    for (auto& p : posicoesMoedas) {
+        // Coletada na célula sob o desenho (p.x - 1, p.y no tileset 114x57)
+        size_t id = criarEntidade(entidades, ENTIDADE_MOEDA, ivec2((int) p.x, (int) p.y) + deslocamentoColetaMoeda());
+        inserirNaGrade(gradeEntidades, (int) id, entidades.celula[id]);
+    }
+    entidades.inicioAtores = entidades.n;
+    mt19937 rngAtores(2025);
+    for (int i = 0; i < nAtores; i++) {
+        // Sorteia de novo enquanto cair em célula bloqueada (com um limite,
+        // para mapas quase todos bloqueados ou chunks ainda fora da memória)
+        ivec2 c(rngAtores() % tilemapWidth, rngAtores() % tilemapHeight);
+        for (int tentativa = 0; tentativa < 64 && !celulaCaminhavel(c.x, c.y); tentativa++)
+            c = ivec2(rngAtores() % tilemapWidth, rngAtores() % tilemapHeight);
+        size_t id = criarEntidade(entidades, ENTIDADE_ATOR, c);
+        entidades.semente[id] = (uint32_t) rngAtores() | 1;
+        // Fases espalhadas: a cada tick só uma fração dos atores troca de célula
+        entidades.progresso[id] = (rngAtores() % 1024) / 1024.0f;
+        inserirNaGrade(gradeEntidades, (int) id, c);
+    }
+
+    float x0 = 470, y0 = 100;
+    int lastX = tilemapWidth - 1, lastY = tilemapHeight - 1;
+    flag.position = vec3(
+        x0 + (lastX-lastY) * tileH/2.0,
+        y0 + (lastX+lastY) * tileW/2.0 - 10,
+        profundidadeIsometrica(vec2(lastX, lastY))
+    );
+    // A bandeira aparece sobre o tile vizinho acima do último
+    celulaBandeira = ivec2(lastX, lastY - 1);
+    if (multidao) construirCampoFluxo(campoFluxo, celulaBandeira);
+}
+
+// Um tick das regras: aplica as teclas recebidas, checa coleta e bandeira e
+// atualiza as entidades. Retorna true se a cena pode ter mudado.
+bool tickRegras(const int *teclas, size_t nTeclas)
+{
+    // Clique para mover: um passo do caminho a cada TICKS_POR_PASSO ticks,
+    // virando a tecla da direção (assim o roteiro gravado reproduz a caminhada).
+    // Qualquer tecla de movimento cancela o caminho.
+    int teclaCaminho = 0;
+    for (size_t i = 0; i < nTeclas; i++)
+        if (ehTeclaMovimento(teclas[i])) caminhoAtual.clear();
+    if (passoCaminho < caminhoAtual.size() && --ticksAtePasso <= 0) {
+        ticksAtePasso = TICKS_POR_PASSO;
+        ivec2 d = caminhoAtual[passoCaminho++] - ivec2((int) pos.x, (int) pos.y);
+        for (int k = 0; k < 8; k++)
+            if (DIRECOES_PASSO[k] == d) teclaCaminho = TECLAS_PASSO[k];
+        if (!teclaCaminho) caminhoAtual.clear(); // Saiu do caminho
+    }
+
+    for (size_t i = 0; i <= nTeclas; i++) {
+        int tecla = i < nTeclas ? teclas[i] : teclaCaminho;
+        if (!tecla) continue;
+        if (roteiroGravacao.is_open() && ehTeclaMovimento(tecla))
+            roteiroGravacao << tickSimulacao << ' ' << (char) tecla << '\n';
+        moverPersonagem(tecla);
+        verificarColisoes();
+    }
+    if (multidao && campoFluxo.pendente) atualizarCampoFluxo(campoFluxo);
+    atualizarEntidades((float) PASSO_SIMULACAO);
+    tickSimulacao++;
+    return nTeclas > 0 || passoCaminho < caminhoAtual.size() || entidades.n > entidades.inicioAtores;
+}
+
+// Movimentação do personagem por uma tecla (W, A, S, D, Q, E, Z, X)
+void moverPersonagem(int key)
+{
+    vec2 aux = pos;
+    int oldAnimation = personagem.iAnimation;
+
+    if (key == GLFW_KEY_W) { if (pos.x > 0) pos.x--; if (pos.y > 0) pos.y--; personagem.iAnimation = 1; }
+    else if (key == GLFW_KEY_A) { if (pos.x > 0) pos.x--; if (pos.y <= tilemapHeight - 2) pos.y++; personagem.iAnimation = 2; }
+    else if (key == GLFW_KEY_S) { if (pos.x <= tilemapWidth -2) pos.x++; if (pos.y <= tilemapHeight - 2) pos.y++; personagem.iAnimation = 0; }
+    else if (key == GLFW_KEY_D) { if (pos.x <= tilemapWidth -2) pos.x++; if (pos.y > 0) pos.y--; personagem.iAnimation = 3; }
+    else if (key == GLFW_KEY_Q) { if (pos.x > 0) pos.x--; personagem.iAnimation = 2; }
+    else if (key == GLFW_KEY_E) { if (pos.y > 0) pos.y--; personagem.iAnimation = 3; }
+    else if (key == GLFW_KEY_Z) { if (pos.y <= tilemapHeight - 2) pos.y++; personagem.iAnimation = 2; }
+    else if (key == GLFW_KEY_X) { if (pos.x <= tilemapWidth -2) pos.x++; personagem.iAnimation = 3; }
+    else return;
+
+    if (pos != aux) ultimaDirecao = pos - aux;
+
+    // Entrar num chunk que o streaming ainda não trouxe é um travamento
+    size_t chunkDestino = (size_t)((int)pos.y / CHUNK_TAM) * mapa.chunksX + (int)pos.x / CHUNK_TAM;
+    if (pos != aux && !chunkResidente(chunkDestino))
+        streaming.travamentos++;
+
+    // Checa se o tile é caminhável
+    if (!celulaCaminhavel((int)pos.x, (int)pos.y))
+    {
+        pos = aux; 
+    }
+    else if (personagem.iAnimation == oldAnimation) {
+        personagem.iFrame = (personagem.iFrame + 1) % personagem.nFrames;
+    } else {
+        personagem.iFrame = 0;
+    }
+
+    LOG_EVENTO(LOG_DEPURACAO, EVENTO_MOVIMENTO, (int32_t) pos.x, (int32_t) pos.y);
+}
+
+// Colisão do personagem com moedas e bandeira, por célula do mapa
+void verificarColisoes()
+{
+    ivec2 celula((int) pos.x, (int) pos.y);
+
+    // Colisão com moedas: só as entidades da célula do personagem
+    paraCadaNaCelula(gradeEntidades, celula, [&](int id) {
+        if (entidades.tipo[id] != ENTIDADE_MOEDA) return;
+        entidades.viva[id] = 0;
+        removerDaGrade(gradeEntidades, id);
+        loteMoedas.sujo = true;
+        LOG_EVENTO(LOG_INFO, EVENTO_MOEDA, celula.x, celula.y, id);
+    });
+
+    // Colisão com a flag (o loop principal fecha a janela)
+    if (!flagReached && celula == celulaBandeira) {
+        flagReached = true;
+        LOG_EVENTO(LOG_INFO, EVENTO_BANDEIRA, celula.x, celula.y);
+    }
+}
+
+// Próximo instante em que alguma animação troca de frame. Todas as animações
+// estão em fase com o relógio global, então basta olhar as taxas distintas.
+double proximaTrocaAnimacao(double agora)
+{
+    vector<float> taxas;
+    if (!loteMoedas.itens.empty()) taxas.push_back(aparencias[ENTIDADE_MOEDA].fps);
+    if (!flagReached) taxas.push_back(10.0f);
+    for (const vec2 &anim : tilesAnimados)
+        if (anim.y > 0) taxas.push_back(anim.y);
+
+    double proxima = agora + 0.5; // Ainda acorda para atualizar o título
+    for (float taxa : taxas)
+        proxima = glm::min(proxima, (floor(agora * taxa) + 1.0) / taxa);
+    return proxima;
+}
+
+// ------------------------------
+// Gerenciador de recursos de GPU
+// ------------------------------
+const char *NOMES_CATEGORIA_GPU[N_CATEGORIAS_GPU] = {
+    "texturas", "geometria", "streaming", "alvos", "transferencia", "uniformes", "programas"
+};
+
+RecursoGPU::RecursoGPU(const RecursoGPU &outro) : indice(outro.indice) {
+    if (indice != SEM_RECURSO && recursosGPU.ativo) recursosGPU.entradas[indice].referencias++;
+}
+
+void soltarRecursoGPU(uint32_t indice);
+
+// Depois de encerrarRecursos os handles que sobraram (globais) não fazem nada
+RecursoGPU::~RecursoGPU() {
+    if (indice != SEM_RECURSO && recursosGPU.ativo) soltarRecursoGPU(indice);
+}
+
+GLuint RecursoGPU::id() const {
+    return indice == SEM_RECURSO ? 0 : recursosGPU.entradas[indice].id;
+}
+
+RecursoGPU criarRecursoGPU(TipoRecursoGPU tipo, CategoriaGPU categoria)
+{
+    GerenciadorRecursos &G = recursosGPU;
+    G.ativo = true;
+    uint32_t indice;
+    if (!G.livres.empty()) {
+        indice = G.livres.back();
+        G.livres.pop_back();
+    } else {
+        indice = (uint32_t) G.entradas.size();
+        G.entradas.emplace_back();
+    }
+    EntradaRecursoGPU &e = G.entradas[indice];
+    switch (tipo) {
+    case GPU_TEXTURA: glGenTextures(1, &e.id); break;
+    case GPU_BUFFER: glGenBuffers(1, &e.id); break;
+    case GPU_VAO: glGenVertexArrays(1, &e.id); break;
+    case GPU_FRAMEBUFFER: glGenFramebuffers(1, &e.id); break;
+    case GPU_RENDERBUFFER: glGenRenderbuffers(1, &e.id); break;
+    case GPU_PROGRAMA: e.id = glCreateProgram(); break;
+    }
+    e.tipo = tipo;
+    e.categoria = categoria;
+    e.referencias = 1;
+    e.bytes = 0;
+    e.bloco = -1;
+    G.objetos[categoria]++;
+    return RecursoGPU(indice);
+}
+
+// Memória do objeto (quem chama glBufferData/glTexImage2D/glRenderbufferStorage informa)
+void definirBytesRecurso(const RecursoGPU &recurso, size_t bytes)
+{
+    if (!recurso) return;
+    EntradaRecursoGPU &e = recursosGPU.entradas[recurso.indice];
+    recursosGPU.bytes[e.categoria] += bytes - e.bytes;
+    e.bytes = bytes;
+}
+
+// Apaga o objeto no GL; o cache de estado e a reflexão não podem guardar o
+// nome, que o driver vai reaproveitar
+void apagarObjetoGL(const EntradaRecursoGPU &e)
+{
+    switch (e.tipo) {
+    case GPU_TEXTURA:
+        glDeleteTextures(1, &e.id);
+        if (cacheEstado.textura == e.id) cacheEstado.textura = 0;
+        break;
+    case GPU_BUFFER: glDeleteBuffers(1, &e.id); break;
+    case GPU_VAO:
+        glDeleteVertexArrays(1, &e.id);
+        if (cacheEstado.vao == e.id) cacheEstado.vao = 0;
+        break;
+    case GPU_FRAMEBUFFER: glDeleteFramebuffers(1, &e.id); break;
+    case GPU_RENDERBUFFER: glDeleteRenderbuffers(1, &e.id); break;
+    case GPU_PROGRAMA:
+        glDeleteProgram(e.id);
+        if (cacheEstado.programa == e.id) cacheEstado.programa = 0;
+        for (size_t i = 0; i < programasShader.size(); i++)
+            if (programasShader[i].id == e.id) {
+                programasShader.erase(programasShader.begin() + i);
+                break;
+            }
+        break;
+    }
+}
+
+inline size_t tamanhoAlinhado(size_t bytes) {
+    return (bytes + ALINHAMENTO_GEOMETRIA - 1) / ALINHAMENTO_GEOMETRIA * ALINHAMENTO_GEOMETRIA;
+}
+
+// Devolve uma faixa ao pool, juntando com as vizinhas; a última faixa livre
+// encolhe a parte usada
+void liberarFaixaPool(size_t inicio, size_t bytes)
+{
+    GerenciadorRecursos &G = recursosGPU;
+    auto it = G.faixasLivres.insert(lower_bound(G.faixasLivres.begin(), G.faixasLivres.end(), make_pair(inicio, bytes)),
+                                    make_pair(inicio, bytes));
+    if (it + 1 != G.faixasLivres.end() && it->first + it->second == (it + 1)->first) {
+        it->second += (it + 1)->second;
+        G.faixasLivres.erase(it + 1);
+    }
+    if (it != G.faixasLivres.begin() && (it - 1)->first + (it - 1)->second == it->first) {
+        (it - 1)->second += it->second;
+        it = G.faixasLivres.erase(it) - 1;
+    }
+    if (it->first + it->second == G.usadoPool) {
+        G.usadoPool = it->first;
+        G.faixasLivres.erase(it);
+    }
+}
+
+void soltarRecursoGPU(uint32_t indice)
+{
+    GerenciadorRecursos &G = recursosGPU;
+    EntradaRecursoGPU &e = G.entradas[indice];
+    if (--e.referencias > 0) return;
+    apagarObjetoGL(e);
+    G.bytes[e.categoria] -= e.bytes;
+    G.objetos[e.categoria]--;
+    if (e.bloco >= 0) {
+        BlocoGeometria &b = G.blocos[e.bloco];
+        if (--b.referencias == 0) {
+            liberarFaixaPool(b.inicio, tamanhoAlinhado(b.dados.size()));
+            b.dados = vector<uint8_t>();
+        }
+    }
+    e = EntradaRecursoGPU();
+    G.livres.push_back(indice);
+}
+
+// Aumenta o VBO do pool mantendo o nome (os VAOs continuam apontando para
+// ele); o conteúdo passa por um buffer temporário
+void crescerPoolGeometria(size_t capacidade)
+{
+    GerenciadorRecursos &G = recursosGPU;
+    if (!G.poolVertices) G.poolVertices = criarRecursoGPU(GPU_BUFFER, CATEGORIA_GEOMETRIA);
+    RecursoGPU temporario;
+    if (G.usadoPool > 0) {
+        temporario = criarRecursoGPU(GPU_BUFFER, CATEGORIA_GEOMETRIA);
+        ligarBuffer(GL_COPY_WRITE_BUFFER, temporario.id());
+        glBufferData(GL_COPY_WRITE_BUFFER, G.usadoPool, NULL, GL_STATIC_COPY);
+        ligarBuffer(GL_COPY_READ_BUFFER, G.poolVertices.id());
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, G.usadoPool);
+    }
+    ligarBuffer(GL_COPY_WRITE_BUFFER, G.poolVertices.id());
+    glBufferData(GL_COPY_WRITE_BUFFER, capacidade, NULL, GL_STATIC_DRAW);
+    if (temporario) {
+        ligarBuffer(GL_COPY_READ_BUFFER, temporario.id());
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, G.usadoPool);
+        ligarBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    ligarBuffer(GL_COPY_WRITE_BUFFER, 0);
+    G.capacidadePool = capacidade;
+    definirBytesRecurso(G.poolVertices, capacidade);
+}
+
+// Primeira faixa livre que caiba; sem nenhuma, cresce a parte usada
+size_t reservarFaixaPool(size_t bytes)
+{
+    GerenciadorRecursos &G = recursosGPU;
+    for (size_t i = 0; i < G.faixasLivres.size(); i++) {
+        auto &f = G.faixasLivres[i];
+        if (f.second < bytes) continue;
+        size_t inicio = f.first;
+        f.first += bytes;
+        f.second -= bytes;
+        if (f.second == 0) G.faixasLivres.erase(G.faixasLivres.begin() + i);
+        return inicio;
+    }
+    if (G.usadoPool + bytes > G.capacidadePool)
+        crescerPoolGeometria(glm::max(glm::max(G.capacidadePool * 2, POOL_GEOMETRIA_INICIAL), G.usadoPool + bytes));
+    size_t inicio = G.usadoPool;
+    G.usadoPool += bytes;
+    return inicio;
+}
+
+// Põe a geometria estática do VAO no pool (ou reaproveita um bloco com os
+// mesmos bytes) e deixa o pool ligado em GL_ARRAY_BUFFER. Retorna o deslocamento
+// em bytes para os glVertexAttribPointer. O bloco é solto junto com o VAO.
+size_t alocarGeometria(const RecursoGPU &vao, const void *dados, size_t bytes)
+{
+    GerenciadorRecursos &G = recursosGPU;
+    const uint8_t *p = (const uint8_t *) dados;
+    int32_t bloco = -1, vago = -1;
+    for (size_t b = 0; b < G.blocos.size() && bloco < 0; b++) {
+        const BlocoGeometria &B = G.blocos[b];
+        if (!B.referencias) { if (vago < 0) vago = (int32_t) b; continue; }
+        if (B.dados.size() == bytes && memcmp(B.dados.data(), p, bytes) == 0) bloco = (int32_t) b;
+    }
+    if (bloco < 0) {
+        size_t inicio = reservarFaixaPool(tamanhoAlinhado(bytes));
+        ligarBuffer(GL_COPY_WRITE_BUFFER, G.poolVertices.id());
+        glBufferSubData(GL_COPY_WRITE_BUFFER, inicio, bytes, dados);
+        ligarBuffer(GL_COPY_WRITE_BUFFER, 0);
+        if (vago < 0) {
+            vago = (int32_t) G.blocos.size();
+            G.blocos.emplace_back();
+        }
+        bloco = vago;
+        G.blocos[bloco] = { inicio, vector<uint8_t>(p, p + bytes), 0 };
+    }
+    G.blocos[bloco].referencias++;
+    G.entradas[vao.indice].bloco = bloco;
+    ligarBuffer(GL_ARRAY_BUFFER, G.poolVertices.id());
+    return G.blocos[bloco].inicio;
+}
+
+// EBO compartilhado com o padrão de índices dos quads (0 1 2 2 1 3 a cada 4
+// vértices) para pelo menos nQuads; cresce junto com o maior lote já visto.
+// O envio usa GL_COPY_WRITE_BUFFER para não mexer no EBO do VAO ligado.
+GLuint eboQuads(size_t nQuads)
+{
+    GerenciadorRecursos &G = recursosGPU;
+    if (!G.indicesQuads) G.indicesQuads = criarRecursoGPU(GPU_BUFFER, CATEGORIA_GEOMETRIA);
+    if (nQuads > G.quadsIndexados) {
+        G.quadsIndexados = glm::max(nQuads, G.quadsIndexados * 2);
+        vector<GLuint> indices(G.quadsIndexados * 6);
+        for (size_t q = 0; q < G.quadsIndexados; q++) {
+            GLuint b = (GLuint)(q * 4);
+            GLuint quad[6] = { b, b + 1, b + 2, b + 2, b + 1, b + 3 };
+            copy(quad, quad + 6, &indices[q * 6]);
+        }
+        ligarBuffer(GL_COPY_WRITE_BUFFER, G.indicesQuads.id());
+        glBufferData(GL_COPY_WRITE_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+        ligarBuffer(GL_COPY_WRITE_BUFFER, 0);
+        definirBytesRecurso(G.indicesQuads, indices.size() * sizeof(GLuint));
+    }
+    return G.indicesQuads.id();
+}
+
+size_t bytesGPU()
+{
+    size_t total = 0;
+    for (int c = 0; c < N_CATEGORIAS_GPU; c++) total += recursosGPU.bytes[c];
+    return total;
+}
+
+// Memória viva e objetos por categoria ("texturas 5.0 MB (3), ...")
+string resumoRecursosGPU()
+{
+    ostringstream s;
+    s.setf(ios::fixed);
+    s.precision(2);
+    for (int c = 0; c < N_CATEGORIAS_GPU; c++)
+        s << (c ? ", " : "") << NOMES_CATEGORIA_GPU[c] << " " << recursosGPU.bytes[c] / (1024.0 * 1024.0)
+          << " MB (" << recursosGPU.objetos[c] << ")";
+    return s.str();
+}
+
+// Apaga o que ainda estiver vivo (chamada com o contexto GL, antes de
+// destruí-lo). Os handles que sobrarem ficam inertes.
+void encerrarRecursos()
+{
+    GerenciadorRecursos &G = recursosGPU;
+    if (!G.ativo) return;
+    G.programas.clear();
+    G.poolVertices = RecursoGPU();
+    G.indicesQuads = RecursoGPU();
+    for (EntradaRecursoGPU &e : G.entradas)
+        if (e.referencias) apagarObjetoGL(e);
+    for (int c = 0; c < N_CATEGORIAS_GPU; c++) G.bytes[c] = G.objetos[c] = 0;
+    G.ativo = false;
+}
+
+// ------------------------------
+// Funções utilitárias de setup e desenho
+// ------------------------------
+int setupShader()
+{
+    return setupShaderProgram(vertexShaderSource, fragmentShaderSource);
+}
+
+// Compila e linka o par de fontes, ou devolve o programa que já veio dele
+// (os lotes de sprites dividem um programa; recarregar a cena não recompila)
+int setupShaderProgram(const GLchar *vsSource, const GLchar *fsSource)
+{
+    for (const ProgramaCompilado &p : recursosGPU.programas)
+        if (p.vs == vsSource && p.fs == fsSource) return p.programa.id();
+
+    // Vertex shader
+    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vertexShader, 1, &vsSource, NULL);
+    glCompileShader(vertexShader);
+    // Checando erros de compilação (exibição via log no terminal)
+    GLint success;
+    GLchar infoLog[512];
+    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
+        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
+                  << infoLog << std::endl;
+    }
+    // Fragment shader
+    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragmentShader, 1, &fsSource, NULL);
+    glCompileShader(fragmentShader);
+    // Checando erros de compilação (exibição via log no terminal)
+    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
+        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n"
+                  << infoLog << std::endl;
+    }
+    // Linkando os shaders e criando o identificador do programa de shader
+    RecursoGPU recurso = criarRecursoGPU(GPU_PROGRAMA, CATEGORIA_PROGRAMAS);
+    GLuint shaderProgram = recurso.id();
+    glAttachShader(shaderProgram, vertexShader);
+    glAttachShader(shaderProgram, fragmentShader);
+    glLinkProgram(shaderProgram);
+    // Checando por erros de linkagem
+    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
+        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
+                  << infoLog << std::endl;
+    }
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    // Reflexão: locais dos uniforms soltos (arrays pelo nome sem "[0]") e o
+    // bloco Quadro preso ao seu binding point
+    ProgramaShader programa = { shaderProgram, {} };
+    GLint nUniforms = 0;
+    glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORMS, &nUniforms);
+    for (GLint i = 0; i < nUniforms; i++) {
+        GLchar nome[128];
+        GLint tamanho;
+        GLenum tipo;
+        glGetActiveUniform(shaderProgram, (GLuint) i, sizeof(nome), NULL, &tamanho, &tipo, nome);
+        GLint local = glGetUniformLocation(shaderProgram, nome);
+        if (local < 0) continue; // Membro de bloco
+        string n = nome;
+        if (n.size() > 3 && n.compare(n.size() - 3, 3, "[0]") == 0) n.resize(n.size() - 3);
+        programa.uniforms.push_back({ n, local });
+    }
+    GLuint bloco = glGetUniformBlockIndex(shaderProgram, "Quadro");
+    if (bloco != GL_INVALID_INDEX) glUniformBlockBinding(shaderProgram, bloco, PONTO_QUADRO);
+    programasShader.push_back(programa);
+    recursosGPU.programas.push_back({ vsSource, fsSource, recurso });
+
+    return shaderProgram;
+}
+
+// Local de um uniform refletido em setupShaderProgram (-1 se o programa não
+// o usa, como o glGetUniformLocation), sem ir ao driver
+GLint localUniform(GLuint programa, const char *nome)
+{
+    for (const ProgramaShader &p : programasShader) {
+        if (p.id != programa) continue;
+        for (const UniformShader &u : p.uniforms)
+            if (u.nome == nome) return u.local;
+        break;
+    }
+    return -1;
+}
+
+// Ligações pelo cache de estado: só chegam ao GL quando mudam alguma coisa
+void usarPrograma(GLuint programa)
+{
+    if (cacheEstado.programa == programa) { estatisticas.trocasEvitadas++; return; }
+    glUseProgram(programa);
+    cacheEstado.programa = programa;
+    estatisticas.trocasEstado++;
+}
+
+void ligarVAO(GLuint vao)
+{
+    if (cacheEstado.vao == vao) { estatisticas.trocasEvitadas++; return; }
+    glBindVertexArray(vao);
+    cacheEstado.vao = vao;
+    estatisticas.trocasEstado++;
+}
+
+void ligarTextura(GLuint textura)
+{
+    if (cacheEstado.textura == textura) { estatisticas.trocasEvitadas++; return; }
+    glBindTexture(GL_TEXTURE_2D, textura);
+    cacheEstado.textura = textura;
+    estatisticas.trocasEstado++;
+}
+
+// Buffers, framebuffers, mistura e profundidade vão sempre ao GL (a ligação
+// do EBO é estado do VAO), mas passam por aqui para serem contados
+void ligarBuffer(GLenum alvo, GLuint buffer)
+{
+    glBindBuffer(alvo, buffer);
+    estatisticas.trocasEstado++;
+}
+
+void ligarFramebuffer(GLuint fbo)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    estatisticas.trocasEstado++;
+}
+
+void escreverProfundidade(bool escreve)
+{
+    glDepthMask(escreve ? GL_TRUE : GL_FALSE);
+    estatisticas.trocasEstado++;
+}
+
+void funcaoProfundidade(GLenum funcao)
+{
+    glDepthFunc(funcao);
+    estatisticas.trocasEstado++;
+}
+
+void definirMistura(GLenum origem, GLenum destino, GLenum origemAlfa, GLenum destinoAlfa)
+{
+    glBlendFuncSeparate(origem, destino, origemAlfa, destinoAlfa);
+    estatisticas.trocasEstado++;
+}
+
+void definirMistura(GLenum origem, GLenum destino)
+{
+    definirMistura(origem, destino, origem, destino);
+}
+
+// Envios de uniform ao programa em uso, contados em uploadsUniform
+void enviarUniform(GLint local, int valor)
+{
+    glUniform1i(local, valor);
+    estatisticas.uploadsUniform++;
+}
+
+void enviarUniform(GLint local, float valor)
+{
+    glUniform1f(local, valor);
+    estatisticas.uploadsUniform++;
+}
+
+void enviarUniform(GLint local, vec2 valor)
+{
+    glUniform2f(local, valor.x, valor.y);
+    estatisticas.uploadsUniform++;
+}
+
+void enviarUniform(GLint local, const vec2 *valores, size_t n)
+{
+    glUniform2fv(local, (GLsizei) n, value_ptr(valores[0]));
+    estatisticas.uploadsUniform++;
+}
+
+void enviarUniform(GLint local, const mat4 &valor)
+{
+    glUniformMatrix4fv(local, 1, GL_FALSE, value_ptr(valor));
+    estatisticas.uploadsUniform++;
+}
+
+// Uniform buffer do bloco Quadro, ligado ao binding point de todos os
+// programas (criado uma vez; fica para as próximas cargas da cena)
+void setupQuadro()
+{
+    if (uboQuadro) return;
+    uboQuadro = criarRecursoGPU(GPU_BUFFER, CATEGORIA_UNIFORMES);
+    ligarBuffer(GL_UNIFORM_BUFFER, uboQuadro.id());
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(DadosQuadro), NULL, GL_DYNAMIC_DRAW);
+    definirBytesRecurso(uboQuadro, sizeof(DadosQuadro));
+    ligarBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, PONTO_QUADRO, uboQuadro.id());
+}
+
+// Escreve [offset, offset + bytes) do bloco Quadro (um upload de uniforms)
+void enviarBlocoQuadro(size_t offset, size_t bytes, const void *dados)
+{
+    ligarBuffer(GL_UNIFORM_BUFFER, uboQuadro.id());
+    glBufferSubData(GL_UNIFORM_BUFFER, offset, bytes, dados);
+    ligarBuffer(GL_UNIFORM_BUFFER, 0);
+    estatisticas.uploadsUniform++;
+}
+
+// Projeção e tempo do frame: um envio vale para todos os programas
+void enviarQuadro(const mat4 &projecao, float tempo)
+{
+    DadosQuadro dados = { projecao, tempo, { 0.0f, 0.0f, 0.0f } };
+    enviarBlocoQuadro(0, sizeof(DadosQuadro), &dados);
+}
+
+// Só a projeção (as páginas do chão são desenhadas com a projeção da página)
+void enviarProjecaoQuadro(const mat4 &projecao)
+{
+    enviarBlocoQuadro(offsetof(DadosQuadro, projection), sizeof(mat4), value_ptr(projecao));
+}
+
+void setupSpriteBatch(SpriteBatch &lote, bool persistente)
+{
+    lote.persistente = persistente;
+    lote.sujo = true;
+    lote.VAO = criarRecursoGPU(GPU_VAO, CATEGORIA_GEOMETRIA);
+    ligarVAO(lote.VAO.id());
+
+    lote.VBO = criarRecursoGPU(GPU_BUFFER, CATEGORIA_STREAMING);
+    ligarBuffer(GL_ARRAY_BUFFER, lote.VBO.id());
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VerticeSprite), (GLvoid *)offsetof(VerticeSprite, x));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VerticeSprite), (GLvoid *)offsetof(VerticeSprite, s));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(VerticeSprite), (GLvoid *)offsetof(VerticeSprite, passo));
+    glEnableVertexAttribArray(2);
+
+    // O EBO compartilhado fica associado ao VAO
+    ligarBuffer(GL_ELEMENT_ARRAY_BUFFER, eboQuads(0));
+
+    ligarVAO(0);
+    ligarBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Programa próprio: o frame da animação é calculado a partir do uniform 'tempo'
+    lote.shaderID = setupShaderProgram(spriteVertexShaderSource, spriteFragmentShaderSource);
+    usarPrograma(lote.shaderID);
+    enviarUniform(localUniform(lote.shaderID, "tex_buff"), 0);
+    lote.localModoAlfa = localUniform(lote.shaderID, "modoAlfa");
+    lote.modoAlfa = -1;
+    usarPrograma(0);
+}
+
+// Enfileira um sprite no lote. Mesma convenção do quad antigo: centrado na
+// posição, escalado por dimensions, frames com passo ds x dt a partir de uvBase;
+// position.z é a profundidade isométrica (profundidadeIsometrica).
+void adicionarSprite(SpriteBatch &lote, int camada, GLuint texID, vec3 position, vec3 dimensions, vec2 uvBase, float ds, float dt, AnimacaoSprite animacao)
+{
+    lote.itens.push_back({ camada, texID, position.z, vec2(position.x, position.y), vec2(dimensions.x, dimensions.y), uvBase, vec2(ds, dt), animacao });
+    lote.sujo = true;
+    lote.preparado = false; // Os vértices escritos não cobrem o item novo
+}
+
+// Quads dos itens [inicio, fim) do lote
+void escreverVerticesSprite(SpriteBatch &lote, size_t inicio, size_t fim)
+{
+    VerticeSprite *v = lote.vertices.data() + inicio * 4;
+    for (size_t i = inicio; i < fim; i++) {
+        const ItemSprite &it = lote.itens[i];
+        float x0 = it.centro.x - it.dimensoes.x / 2, x1 = it.centro.x + it.dimensoes.x / 2;
+        float y0 = it.centro.y - it.dimensoes.y / 2, y1 = it.centro.y + it.dimensoes.y / 2;
+        float s0 = it.uv0.s, s1 = it.uv0.s + it.duv.s;
+        float t0 = it.uv0.t + it.animacao.linha * it.duv.t, t1 = t0 + it.duv.t;
+        const AnimacaoSprite &a = it.animacao;
+        *v++ = { x0, y1, it.profundidade, s0, t1, it.duv.s, a.inicio, (float) a.nFrames, a.fps }; //V0
+        *v++ = { x0, y0, it.profundidade, s0, t0, it.duv.s, a.inicio, (float) a.nFrames, a.fps }; //V1
+        *v++ = { x1, y1, it.profundidade, s1, t1, it.duv.s, a.inicio, (float) a.nFrames, a.fps }; //V2
+        *v++ = { x1, y0, it.profundidade, s1, t0, it.duv.s, a.inicio, (float) a.nFrames, a.fps }; //V3
+    }
+}
+
+// Parte do lote que não usa o GL: ordena os itens por (camada, textura) e
+// escreve os quads, em faixas paralelas no escalonador. A ordem isométrica
+// fica com o depth buffer, então não há ordenação por profundidade a cada
+// frame (os itens já chegam agrupados por camada); só com ordemNaCpu os itens
+// vão de trás para a frente.
+void prepararSpriteBatch(SpriteBatch &lote)
+{
+    if (!lote.sujo || lote.preparado || lote.itens.empty()) return;
+    auto ordem = [](const ItemSprite &a, const ItemSprite &b) {
+        if (ordemNaCpu && a.profundidade != b.profundidade) return a.profundidade < b.profundidade;
+        return a.camada != b.camada ? a.camada < b.camada : a.texID < b.texID;
+    };
+    if (!is_sorted(lote.itens.begin(), lote.itens.end(), ordem))
+        stable_sort(lote.itens.begin(), lote.itens.end(), ordem);
+    lote.vertices.resize(lote.itens.size() * 4);
+    paraCadaFaixa(escalonador, lote.itens.size(), glm::max(graoGravacao(lote.itens.size()), (size_t) 2048),
+                  [&lote](size_t inicio, size_t fim) { escreverVerticesSprite(lote, inicio, fim); });
+    lote.preparado = true;
+}
+
+// Envia os quads do lote (preparando-os antes, se ninguém o fez) e desenha
+// uma chamada por troca de textura em cada passada pedida. Lotes persistentes
+// só reescrevem o buffer quando estão sujos; os do frame são esvaziados
+// depois da passada das bordas.
+void desenharSpriteBatch(SpriteBatch &lote, PassadaSprites passada)
+{
+    if (lote.itens.empty()) {
+        lote.sujo = false;
+        return;
+    }
+
+    ligarVAO(lote.VAO.id());
+    size_t nQuads = lote.itens.size();
+
+    if (lote.sujo) {
+        prepararSpriteBatch(lote);
+
+        // Padrão de índices (compartilhado) cresce junto com o maior lote já visto
+        eboQuads(nQuads);
+
+        // Lote por frame: buffer "órfão" para não esperar pelo frame anterior.
+        // Lote persistente: enviado uma vez e reaproveitado até mudar.
+        size_t bytes = lote.vertices.size() * sizeof(VerticeSprite);
+        ligarBuffer(GL_ARRAY_BUFFER, lote.VBO.id());
+        glBufferData(GL_ARRAY_BUFFER, bytes, NULL, lote.persistente ? GL_STATIC_DRAW : GL_STREAM_DRAW);
+        definirBytesRecurso(lote.VBO, bytes);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, lote.vertices.data());
+        ligarBuffer(GL_ARRAY_BUFFER, 0);
+        lote.sujo = false;
+        lote.preparado = false;
+    }
+
+    // Vértices já estão em coordenadas de mundo
+    usarPrograma(lote.shaderID);
+
+    for (int p = SPRITES_OPACOS; p <= SPRITES_BORDAS; p++) {
+        if (!(passada & p) || (ordemNaCpu && p == SPRITES_BORDAS)) continue;
+        int modo = ordemNaCpu ? 0 : p;
+        if (lote.modoAlfa != modo) {
+            enviarUniform(lote.localModoAlfa, modo);
+            lote.modoAlfa = modo;
+        }
+        if (!ordemNaCpu) escreverProfundidade(p == SPRITES_OPACOS);
+
+        // Uma chamada por sequência de itens com a mesma textura
+        size_t inicio = 0;
+        for (size_t i = 1; i <= nQuads; i++) {
+            if (i < nQuads && lote.itens[i].texID == lote.itens[inicio].texID) continue;
+            ligarTextura(lote.itens[inicio].texID);
+            glDrawElements(GL_TRIANGLES, (GLsizei)((i - inicio) * 6), GL_UNSIGNED_INT, (GLvoid *)(inicio * 6 * sizeof(GLuint)));
+            estatisticas.drawCalls++;
+            inicio = i;
+        }
+    }
+    escreverProfundidade(true);
+    if (!lote.persistente && (passada & SPRITES_BORDAS)) lote.itens.clear();
+}
+
+// Losango de um tile com UVs do primeiro tile do tileset, no pool de geometria
+RecursoGPU setupTile(int nTiles, vec2 uvTam, float &ds, float &dt)
+{
+    ds = uvTam.x / (float) nTiles;
+    dt = uvTam.y;
+    float th = 1.0, tw = 1.0;
+
+    GLfloat vertices[] = {
+        // x   y    z    s     t
+        0.0,  th/2.0f,   0.0, 0.0,    dt/2.0f, //A
+        tw/2.0f, th,     0.0, ds/2.0f, dt,     //B
+        tw/2.0f, 0.0,    0.0, ds/2.0f, 0.0,    //D
+        tw,     th/2.0f, 0.0, ds,     dt/2.0f  //C
+        };
+
+    RecursoGPU VAO = criarRecursoGPU(GPU_VAO, CATEGORIA_GEOMETRIA);
+    ligarVAO(VAO.id());
+    size_t inicio = alocarGeometria(VAO, vertices, sizeof(vertices));
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)inicio);
+    glEnableVertexAttribArray(0);
+
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)(inicio + 3 * sizeof(GLfloat)));
+    glEnableVertexAttribArray(1);
+
+    ligarBuffer(GL_ARRAY_BUFFER, 0);
+    ligarVAO(0);
+
+    return VAO;
+}
+
+// ------------------------------
+// Atlas de texturas com cache em disco
+// ------------------------------
+const char ATLAS_CACHE_MAGICA[4] = { 'A', 'T', 'L', 'S' };
+const uint32_t ATLAS_CACHE_VERSAO = 1;
+const int ATLAS_MARGEM = 2; // Pixels vazios entre spritesheets
+
+// Base do FNV-1a de 64 bits
+const uint64_t HASH_INICIAL = 1469598103934665603ULL;
+
+// Acumula bytes num hash FNV-1a de 64 bits
+uint64_t misturarHash(uint64_t h, const void *dados, size_t bytes) {
+    const unsigned char *p = (const unsigned char *) dados;
+    for (size_t i = 0; i < bytes; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// FNV-1a 64 bits do conteúdo do arquivo (0 se não abrir)
+uint64_t hashArquivo(const string& filename) {
+    ifstream file(filename, ios::binary);
+    if (!file.is_open()) return 0;
+    uint64_t h = HASH_INICIAL;
+    char buffer[1 << 16];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+        h = misturarHash(h, buffer, (size_t) file.gcount());
+    return h;
+}
+
+// Empacota os retângulos em prateleiras (mais altos primeiro) e define o tamanho do atlas
+void empacotarAtlas(Atlas &atlas) {
+    vector<RegiaoAtlas *> ordem;
+    long area = 0;
+    int maiorLargura = 0;
+    for (auto &r : atlas.regioes) {
+        ordem.push_back(&r);
+        area += (long)(r.w + ATLAS_MARGEM) * (r.h + ATLAS_MARGEM);
+        maiorLargura = glm::max(maiorLargura, r.w + ATLAS_MARGEM);
+    }
+    sort(ordem.begin(), ordem.end(), [](RegiaoAtlas *a, RegiaoAtlas *b) { return a->h > b->h; });
+
+    int largura = 1;
+    while (largura < maiorLargura || (long) largura * largura < area) largura *= 2;
+
+    int x = 0, y = 0, alturaPrateleira = 0;
+    for (RegiaoAtlas *r : ordem) {
+        if (x + r->w > largura) {
+            x = 0;
+            y += alturaPrateleira + ATLAS_MARGEM;
+            alturaPrateleira = 0;
+        }
+        r->x = x;
+        r->y = y;
+        x += r->w + ATLAS_MARGEM;
+        alturaPrateleira = glm::max(alturaPrateleira, r->h);
+    }
+    atlas.largura = largura;
+    atlas.altura = glm::max(y + alturaPrateleira, 1);
+}
+
+// Lê o cache se ele corresponder exatamente às fontes (mesmos nomes e hashes).
+// Tamanho acima do limite do GL ou retângulo fora do atlas: cache corrompido,
+// recusado antes de alocar os pixels.
+bool lerCacheAtlas(const string& cacheFile, Atlas &atlas, vector<unsigned char> &pixels) {
+    ifstream file(cacheFile, ios::binary);
+    if (!file.is_open()) return false;
+    char magica[4];
+    uint32_t versao, nFontes;
+    int32_t largura, altura;
+    file.read(magica, 4);
+    file.read((char *) &versao, sizeof(versao));
+    file.read((char *) &nFontes, sizeof(nFontes));
+    file.read((char *) &largura, sizeof(largura));
+    file.read((char *) &altura, sizeof(altura));
+    GLint maxTextura = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextura);
+    if (!file || memcmp(magica, ATLAS_CACHE_MAGICA, 4) != 0 || versao != ATLAS_CACHE_VERSAO
+        || nFontes != atlas.regioes.size() || largura <= 0 || altura <= 0 || largura > maxTextura || altura > maxTextura)
+        return false;
+    for (auto &r : atlas.regioes) {
+        uint32_t tamNome;
+        file.read((char *) &tamNome, sizeof(tamNome));
+        if (!file || tamNome > 4096) return false;
+        string nome(tamNome, '\0');
+        file.read(&nome[0], tamNome);
+        uint64_t hash;
+        int32_t ret[4];
+        file.read((char *) &hash, sizeof(hash));
+        file.read((char *) ret, sizeof(ret));
+        if (!file || nome != r.arquivo || hash != r.hash) return false;
+        if (ret[0] < 0 || ret[1] < 0 || ret[2] <= 0 || ret[3] <= 0 || ret[2] > largura - ret[0] || ret[3] > altura - ret[1])
+            return false;
+        r.x = ret[0]; r.y = ret[1]; r.w = ret[2]; r.h = ret[3];
+    }
+    atlas.largura = largura;
+    atlas.altura = altura;
+    pixels.resize((size_t) largura * altura * 4);
+    file.read((char *) pixels.data(), pixels.size());
+    return (bool) file;
+}
+
+void gravarCacheAtlas(const string& cacheFile, const Atlas &atlas, const vector<unsigned char> &pixels) {
+    ofstream file(cacheFile, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Erro ao criar " << cacheFile << endl;
+        return;
+    }
+    uint32_t nFontes = (uint32_t) atlas.regioes.size();
+    int32_t largura = atlas.largura, altura = atlas.altura;
+    file.write(ATLAS_CACHE_MAGICA, 4);
+    file.write((const char *) &ATLAS_CACHE_VERSAO, sizeof(ATLAS_CACHE_VERSAO));
+    file.write((const char *) &nFontes, sizeof(nFontes));
+    file.write((const char *) &largura, sizeof(largura));
+    file.write((const char *) &altura, sizeof(altura));
+    for (const auto &r : atlas.regioes) {
+        uint32_t tamNome = (uint32_t) r.arquivo.size();
+        int32_t ret[4] = { r.x, r.y, r.w, r.h };
+        file.write((const char *) &tamNome, sizeof(tamNome));
+        file.write(r.arquivo.data(), tamNome);
+        file.write((const char *) &r.hash, sizeof(r.hash));
+        file.write((const char *) ret, sizeof(ret));
+    }
+    file.write((const char *) pixels.data(), pixels.size());
+}
+
+// Número de threads de decodificação (0 = uma por núcleo)
+int numeroThreadsDecodificacao() {
+    if (threadsDecodificacao > 0) return threadsDecodificacao;
+    return glm::max((int) thread::hardware_concurrency(), 1);
+}
+
+// Executa f(i) para i em [0, n), distribuído entre nThreads threads
+template <typename F>
+void paraCadaParalelo(size_t n, int nThreads, F f) {
+    atomic<size_t> proximo{0};
+    vector<thread> threads;
+    for (int t = 0; t < nThreads; t++)
+        threads.emplace_back([&]() {
+            for (size_t i; (i = proximo++) < n; ) f(i);
+        });
+    for (auto &t : threads) t.join();
+}
+
+void calcularUVsAtlas(Atlas &atlas) {
+    for (auto &r : atlas.regioes) {
+        r.uv0 = vec2((float) r.x / atlas.largura, (float) r.y / atlas.altura);
+        r.uvTam = vec2((float) r.w / atlas.largura, (float) r.h / atlas.altura);
+    }
+}
+
+void criarTexturaAtlas(Atlas &atlas, const unsigned char *pixels) {
+    atlas.textura = criarRecursoGPU(GPU_TEXTURA, CATEGORIA_TEXTURAS);
+    ligarTextura(atlas.textura.id());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, atlas.largura, atlas.altura, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    definirBytesRecurso(atlas.textura, (size_t) atlas.largura * atlas.altura * 4);
+    ligarTextura(0);
+}
+
+// Thread de decodificação: pega o próximo asset livre, decodifica e avisa a thread do GL
+void decodificadorTexturas() {
+    PipelineTexturas &p = pipelineTexturas;
+    for (size_t i; (i = p.proximo++) < p.assets.size(); ) {
+        AssetTextura &asset = p.assets[i];
+        const RegiaoAtlas &r = p.atlas->regioes[asset.regiao];
+        auto t0 = chrono::steady_clock::now();
+        int w, h, nrChannels;
+        unsigned char *data = stbi_load(r.arquivo.c_str(), &w, &h, &nrChannels, 4);
+        if (data && (w != r.w || h != r.h)) { // Arquivo mudou entre a leitura do cabeçalho e a decodificação
+            stbi_image_free(data);
+            data = nullptr;
+        }
+        if (data) {
+            for (int linha = 0; linha < r.h; linha++)
+                memcpy(&p.pixelsAtlas[((size_t)(r.y + linha) * p.atlas->largura + r.x) * 4], data + (size_t) linha * r.w * 4, (size_t) r.w * 4);
+        } else {
+            std::cout << "Failed to load texture " << r.arquivo << std::endl;
+            p.falhou = true;
+        }
+        asset.pixels = data;
+        asset.msDecodificacao = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+        lock_guard<mutex> trava(p.mtx);
+        p.prontos.push_back((int) i);
+    }
+}
+
+// Chamada por frame na thread do GL: envia as imagens prontas dentro do orçamento de tempo
+void atualizarPipelineTexturas(double orcamentoMs) {
+    PipelineTexturas &p = pipelineTexturas;
+    if (!p.ativo) return;
+    {
+        lock_guard<mutex> trava(p.mtx);
+        p.paraEnviar.insert(p.paraEnviar.end(), p.prontos.begin(), p.prontos.end());
+        p.prontos.clear();
+    }
+
+    auto inicioFrame = chrono::steady_clock::now();
+    size_t k = 0;
+    for (; k < p.paraEnviar.size(); k++) {
+        if (chrono::duration<double, milli>(chrono::steady_clock::now() - inicioFrame).count() > orcamentoMs) break;
+        AssetTextura &asset = p.assets[p.paraEnviar[k]];
+        const RegiaoAtlas &r = p.atlas->regioes[asset.regiao];
+        auto t0 = chrono::steady_clock::now();
+        if (asset.pixels) {
+            size_t bytes = (size_t) r.w * r.h * 4;
+            ligarBuffer(GL_PIXEL_UNPACK_BUFFER, p.pbo[p.pboAtual].id());
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+            definirBytesRecurso(p.pbo[p.pboAtual], bytes);
+            void *destino = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            if (destino) {
+                memcpy(destino, asset.pixels, bytes);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                ligarTextura(p.atlas->textura.id());
+                glTexSubImage2D(GL_TEXTURE_2D, 0, r.x, r.y, r.w, r.h, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid *) 0);
+                ligarTextura(0);
+            }
+            ligarBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            p.pboAtual ^= 1;
+            stbi_image_free(asset.pixels);
+            asset.pixels = nullptr;
+        }
+        asset.msEnvio = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+        p.enviados++;
+        p.atlas->versao++;
+    }
+    p.paraEnviar.erase(p.paraEnviar.begin(), p.paraEnviar.begin() + k);
+
+    if (p.enviados < p.assets.size()) return;
+
+    // Tudo enviado: encerra as threads, grava o cache e mostra os tempos
+    for (auto &t : p.decodificadores) t.join();
+    p.decodificadores.clear();
+    p.pbo[0] = p.pbo[1] = RecursoGPU();
+    if (!p.falhou)
+        gravarCacheAtlas(p.cacheFile, *p.atlas, p.pixelsAtlas);
+    else
+        cout << "Atlas incompleto: cache nao gravado" << endl;
+    p.pixelsAtlas = vector<unsigned char>();
+    p.ativo = false;
+
+    double somaDecod = 0, somaEnvio = 0;
+    cout << "Texturas (" << p.assets.size() << " assets, " << numeroThreadsDecodificacao() << " threads):" << endl;
+    for (const AssetTextura &asset : p.assets) {
+        cout << "  " << p.atlas->regioes[asset.regiao].arquivo << ": decodificacao " << asset.msDecodificacao
+             << " ms, envio " << asset.msEnvio << " ms" << endl;
+        somaDecod += asset.msDecodificacao;
+        somaEnvio += asset.msEnvio;
+    }
+    cout << "  soma: decodificacao " << somaDecod << " ms, envio " << somaEnvio << " ms; todas prontas em "
+         << chrono::duration<double, milli>(chrono::steady_clock::now() - p.inicio).count() << " ms" << endl;
+}
+
+// Interrompe o pipeline (janela fechada antes de todas as texturas chegarem)
+void encerrarPipelineTexturas() {
+    PipelineTexturas &p = pipelineTexturas;
+    if (!p.ativo) return;
+    p.proximo = p.assets.size();
+    for (auto &t : p.decodificadores) t.join();
+    p.decodificadores.clear();
+    for (AssetTextura &asset : p.assets)
+        if (asset.pixels) stbi_image_free(asset.pixels);
+    p.pbo[0] = p.pbo[1] = RecursoGPU();
+    p.ativo = false;
+}
+
+// Monta o atlas com todos os spritesheets. Se o cache bater com os hashes das
+// fontes, pula a decodificação e o empacotamento. Senão, o empacotamento usa só
+// os cabeçalhos dos PNGs e as imagens chegam pelo pipeline assíncrono.
+void carregarAtlas(Atlas &atlas, const vector<string> &arquivos, const string& cacheFile) {
+    atlas.regioes.assign(arquivos.size(), RegiaoAtlas());
+    paraCadaParalelo(arquivos.size(), numeroThreadsDecodificacao(), [&](size_t i) {
+        atlas.regioes[i] = { arquivos[i], hashArquivo(arquivos[i]), 0, 0, 0, 0, vec2(0), vec2(0) };
+    });
+
+    vector<unsigned char> pixels;
+    if (lerCacheAtlas(cacheFile, atlas, pixels)) {
+        calcularUVsAtlas(atlas);
+        criarTexturaAtlas(atlas, pixels.data());
+        return;
+    }
+
+    // Tamanhos vêm só do cabeçalho de cada PNG
+    PipelineTexturas &p = pipelineTexturas;
+    p.falhou = false;
+    for (auto &r : atlas.regioes) {
+        int nrChannels;
+        if (!stbi_info(r.arquivo.c_str(), &r.w, &r.h, &nrChannels)) {
+            std::cout << "Failed to load texture " << r.arquivo << std::endl;
+            r.w = r.h = 1;
+            p.falhou = true;
+        }
+    }
+    empacotarAtlas(atlas);
+    calcularUVsAtlas(atlas);
+
+    // Atlas começa transparente, como pixelsAtlas e o cache, e cada região com a
+    // cor provisória; as margens do empacotamento nunca são tocadas pelo envio
+    criarTexturaAtlas(atlas, nullptr);
+    {
+        RecursoGPU fbo = criarRecursoGPU(GPU_FRAMEBUFFER, CATEGORIA_ALVOS);
+        ligarFramebuffer(fbo.id());
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, atlas.textura.id(), 0);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
+        glEnable(GL_SCISSOR_TEST);
+        for (const auto &r : atlas.regioes) {
+            glScissor(r.x, r.y, r.w, r.h);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+        glDisable(GL_SCISSOR_TEST);
+        ligarFramebuffer(framebufferTela);
+    }
+
+    p.atlas = &atlas;
+    p.cacheFile = cacheFile;
+    p.assets.clear();
+    for (size_t i = 0; i < atlas.regioes.size(); i++)
+        p.assets.push_back({ (int) i, nullptr, 0.0, 0.0 });
+    p.pixelsAtlas.assign((size_t) atlas.largura * atlas.altura * 4, 0);
+    p.proximo = 0;
+    p.enviados = 0;
+    p.prontos.clear();
+    p.paraEnviar.clear();
+    for (RecursoGPU &pbo : p.pbo) pbo = criarRecursoGPU(GPU_BUFFER, CATEGORIA_TRANSFERENCIA);
+    p.inicio = chrono::steady_clock::now();
+    p.ativo = true;
+    for (int t = 0; t < numeroThreadsDecodificacao(); t++)
+        p.decodificadores.emplace_back(decodificadorTexturas);
+}
+
+const RegiaoAtlas &regiaoAtlas(const string& arquivo) {
+    for (const auto &r : atlas.regioes)
+        if (r.arquivo == arquivo) return r;
+    return atlas.regioes[0];
+}
+
+int loadTexture(string filePath, int &width, int &height)
+{
+    GLuint texID;
+    glGenTextures(1, &texID);
+    ligarTextura(texID);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    int nrChannels;
+
+    unsigned char *data = stbi_load(filePath.c_str(), &width, &height, &nrChannels, 0);
+
+    if (data)
+    {
+        if (nrChannels == 3) // jpg, bmp
+        {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+        }
+        else // png
+        {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+        }
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    else
+    {
+        std::cout << "Failed to load texture" << std::endl;
+    }
+
+    stbi_image_free(data);
+
+    ligarTextura(0);
+
+    return texID;
+}
+
+void setupTileLayer(TileLayer &layer, const RegiaoAtlas &regiao, GLuint texID)
+{
+    layer.shaderID = setupShaderProgram(tileVertexShaderSource, fragmentShaderSource);
+    layer.origem = vec2(340, 100);
+    layer.nInstancias = 0;
+
+    // Geometria do losango compartilhada por todas as instâncias (UVs no espaço
+    // do atlas); os mesmos bytes do setupTile, então o bloco do pool é o mesmo
+    float ds = regiao.uvTam.x / (float) nTiles;
+    float dt = regiao.uvTam.y;
+    GLfloat vertices[] = {
+        // x   y    z    s     t
+        0.0,  0.5, 0.0, 0.0,    dt/2.0f, //A
+        0.5,  1.0, 0.0, ds/2.0f, dt,     //B
+        0.5,  0.0, 0.0, ds/2.0f, 0.0,    //D
+        1.0,  0.5, 0.0, ds,     dt/2.0f  //C
+        };
+
+    layer.VAO = criarRecursoGPU(GPU_VAO, CATEGORIA_GEOMETRIA);
+    ligarVAO(layer.VAO.id());
+
+    size_t inicio = alocarGeometria(layer.VAO, vertices, sizeof(vertices));
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)inicio);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)(inicio + 3 * sizeof(GLfloat)));
+    glEnableVertexAttribArray(1);
+
+    // Buffer de instâncias: um registro por tile desenhado
+    layer.VBOInstancias = criarRecursoGPU(GPU_BUFFER, CATEGORIA_STREAMING);
+    ligarBuffer(GL_ARRAY_BUFFER, layer.VBOInstancias.id());
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(InstanciaTile), (GLvoid *)offsetof(InstanciaTile, coluna));
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(InstanciaTile), (GLvoid *)offsetof(InstanciaTile, iTile));
+    glEnableVertexAttribArray(3);
+    glVertexAttribDivisor(3, 1);
+
+    ligarBuffer(GL_ARRAY_BUFFER, 0);
+    ligarVAO(0);
+
+    // Uniforms fixos da camada
+    usarPrograma(layer.shaderID);
+    enviarUniform(localUniform(layer.shaderID, "tex_buff"), 0);
+    enviarUniform(localUniform(layer.shaderID, "origem"), layer.origem);
+    enviarUniform(localUniform(layer.shaderID, "tileDim"), vec2(tileH, tileW));
+    enviarUniform(localUniform(layer.shaderID, "uvBase"), regiao.uv0);
+    enviarUniform(localUniform(layer.shaderID, "ds"), ds);
+    vector<vec2> animTile(64, vec2(1.0f, 0.0f));
+    for (size_t i = 0; i < tilesAnimados.size() && i < animTile.size(); i++)
+        animTile[i] = tilesAnimados[i];
+    enviarUniform(localUniform(layer.shaderID, "animTile"), animTile.data(), animTile.size());
+    usarPrograma(0);
+
+    layer.texID = texID;
+}
+
+// Caixa (uMin, vMin, uMax, vMax) da visão da câmera em coordenadas (u, v) do
+// mapa: os quatro cantos levados pela inversa de P (ver chunkVisivel)
+vec4 visaoEmCelulas(const TileLayer &layer)
+{
+    float w = tileH, h = tileW;
+    vec2 minVisao = camera.visao - camera.tamanho / 2.0f;
+    vec2 maxVisao = camera.visao + camera.tamanho / 2.0f;
+    vec4 caixa(1e30f, 1e30f, -1e30f, -1e30f);
+    vec2 cantos[4] = { minVisao, vec2(maxVisao.x, minVisao.y), maxVisao, vec2(minVisao.x, maxVisao.y) };
+    for (const vec2 &c : cantos) {
+        float a = (c.x - layer.origem.x - w/2) / (w/2); // u - v
+        float b = (c.y - layer.origem.y) / (h/2);       // u + v
+        float u = (a + b) / 2, v = (b - a) / 2;
+        caixa = vec4(glm::min(caixa.x, u), glm::min(caixa.y, v), glm::max(caixa.z, u), glm::max(caixa.w, v));
+    }
+    return caixa;
+}
+
+// Retângulo de chunks (inclusivo, já cortado pelo mapa) que contém a visão;
+// fora dele nenhum chunk é visível. Vazio quando minimo > maximo.
+void chunksSobVisao(const TileLayer &layer, ivec2 &minimo, ivec2 &maximo)
+{
+    vec4 caixa = visaoEmCelulas(layer);
+    minimo = ivec2(glm::max((int) ceil(caixa.x / CHUNK_TAM) - 1, 0), glm::max((int) ceil(caixa.y / CHUNK_TAM) - 1, 0));
+    maximo = ivec2(glm::min((int) floor(caixa.z / CHUNK_TAM), mapa.chunksX - 1),
+                   glm::min((int) floor(caixa.w / CHUNK_TAM), mapa.chunksY - 1));
+}
+
+// Testa se o losango isométrico do chunk (cx, cy) intersecta a visão da câmera.
+// A célula (u, v) do mapa vai para a tela por P(u,v) = origem + (w/2 + (u-v)*w/2, (u+v)*h/2);
+// o teste usa os eixos da tela (caixa envolvente) e os eixos do losango (u e v).
+bool chunkVisivel(const TileLayer &layer, int cx, int cy)
+{
+    float w = tileH, h = tileW;
+    float u0 = cx * CHUNK_TAM, u1 = glm::min(u0 + CHUNK_TAM, (float) tilemapWidth);
+    float v0 = cy * CHUNK_TAM, v1 = glm::min(v0 + CHUNK_TAM, (float) tilemapHeight);
+
+    vec2 minVisao = camera.visao - camera.tamanho / 2.0f;
+    vec2 maxVisao = camera.visao + camera.tamanho / 2.0f;
+
+    // Eixos da tela
+    float xMin = layer.origem.x + w/2 + (u0 - v1) * w/2;
+    float xMax = layer.origem.x + w/2 + (u1 - v0) * w/2;
+    float yMin = layer.origem.y + (u0 + v0) * h/2;
+    float yMax = layer.origem.y + (u1 + v1) * h/2;
+    if (xMax < minVisao.x || xMin > maxVisao.x || yMax < minVisao.y || yMin > maxVisao.y)
+        return false;
+
+    // Eixos do losango
+    vec4 caixa = visaoEmCelulas(layer);
+    return !(u1 < caixa.x || u0 > caixa.z || v1 < caixa.y || v0 > caixa.w);
+}
+
+// Move a câmera em direção ao personagem, sem sair dos limites do mapa.
+// dt < 0 posiciona a câmera imediatamente.
+void atualizarCamera(float dt)
+{
+    float w = personagem.dimensions.x, h = personagem.dimensions.y;
+    vec2 alvo = vec2(400 + (pos.x - pos.y) * w/2.0, 130 + (pos.x + pos.y) * h/2.0);
+
+    // Limites do mapa em coordenadas de mundo; eixos menores que a tela ficam centrados
+    vec2 origem = camadaMapa.origem;
+    vec2 minMapa = vec2(origem.x - (tilemapHeight - 1) * w/2, origem.y);
+    vec2 maxMapa = vec2(origem.x + (tilemapWidth + 1) * w/2, origem.y + (tilemapWidth + tilemapHeight) * h/2);
+    vec2 meia = camera.tamanho / 2.0f;
+    if (maxMapa.x - minMapa.x <= camera.tamanho.x) alvo.x = (minMapa.x + maxMapa.x) / 2;
+    else alvo.x = glm::clamp(alvo.x, minMapa.x + meia.x, maxMapa.x - meia.x);
+    if (maxMapa.y - minMapa.y <= camera.tamanho.y) alvo.y = (minMapa.y + maxMapa.y) / 2;
+    else alvo.y = glm::clamp(alvo.y, minMapa.y + meia.y, maxMapa.y - meia.y);
+
+    if (dt < 0) camera.centro = camera.centroAnterior = camera.visao = alvo;
+    else camera.centro += (alvo - camera.centro) * glm::min(1.0f, dt * 8.0f);
+}
+
+// Centro de desenho entre os dois últimos passos de simulação
+void interpolarCamera(float alfa)
+{
+    camera.visao = mix(camera.centroAnterior, camera.centro, alfa);
+}
+
+mat4 projecaoCamera()
+{
+    vec2 minVisao = camera.visao - camera.tamanho / 2.0f;
+    vec2 maxVisao = camera.visao + camera.tamanho / 2.0f;
+    return ortho(minVisao.x, maxVisao.x, maxVisao.y, minVisao.y, -1.0f, 1.0f);
+}
+
+// ------------------------------
+// Chão pré-renderizado (páginas em FBOs)
+// ------------------------------
+
+// Retângulo de mundo ocupado pelo tile (u, v) na camada: (xMin, yMin, xMax, yMax)
+inline vec4 retanguloTile(int u, int v) {
+    float w = tileH, h = tileW;
+    float x = camadaMapa.origem.x + (u - v) * w/2, y = camadaMapa.origem.y + (u + v) * h/2;
+    return vec4(x, y, x + w, y + h);
+}
+
+inline vec4 retanguloPaginaChao(ivec2 id) {
+    float x = camadaMapa.origem.x + id.x * (float) PAGINA_CHAO, y = camadaMapa.origem.y + id.y * (float) PAGINA_CHAO;
+    return vec4(x, y, x + PAGINA_CHAO, y + PAGINA_CHAO);
+}
+
+inline bool retangulosSeTocam(const vec4 &a, const vec4 &b) {
+    return a.x < b.z && a.z > b.x && a.y < b.w && a.w > b.y;
+}
+
+inline bool tileAnimado(int iTile) {
+    return iTile < (int) tilesAnimados.size() && tilesAnimados[iTile].y > 0.0f;
+}
+
+// Programa do quad das páginas e o VAO/VBO dos quads; as páginas são criadas
+// conforme a câmera passa por elas
+void setupChao(ChaoPreRenderizado &C)
+{
+    C.shaderID = setupShaderProgram(chaoVertexShaderSource, chaoFragmentShaderSource);
+    usarPrograma(C.shaderID);
+    enviarUniform(localUniform(C.shaderID, "tex_buff"), 0);
+    usarPrograma(0);
+
+    C.VAO = criarRecursoGPU(GPU_VAO, CATEGORIA_GEOMETRIA);
+    ligarVAO(C.VAO.id());
+    C.VBO = criarRecursoGPU(GPU_BUFFER, CATEGORIA_STREAMING);
+    ligarBuffer(GL_ARRAY_BUFFER, C.VBO.id());
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (GLvoid *)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (GLvoid *)(2 * sizeof(GLfloat)));
+    glEnableVertexAttribArray(1);
+    ligarBuffer(GL_ARRAY_BUFFER, 0);
+    ligarVAO(0);
+
+    for (PaginaChao &p : C.paginas) p.assada = false;
+    C.haAnimados = false;
+    for (int i = 0; i < nTiles; i++) C.haAnimados |= tileAnimado(i);
+    C.animadosChunk.assign((size_t) mapa.chunksX * mapa.chunksY, vector<InstanciaTile>());
+    C.animadosValidos.assign((size_t) mapa.chunksX * mapa.chunksY, 0);
+}
+
+// Página com o id dado: já em cache ou ocupando a menos usada que não está
+// na tela neste frame (sem nenhuma livre, o cache cresce)
+PaginaChao &paginaChao(ChaoPreRenderizado &C, ivec2 id)
+{
+    PaginaChao *livre = nullptr;
+    for (PaginaChao &p : C.paginas) {
+        if (p.id == id && p.fbo) return p;
+        if (p.ultimoUso != C.frame && (!livre || p.ultimoUso < livre->ultimoUso)) livre = &p;
+    }
+    if (!livre || C.paginas.size() < MAX_PAGINAS_CHAO) {
+        C.paginas.emplace_back();
+        livre = &C.paginas.back();
+        livre->textura = criarRecursoGPU(GPU_TEXTURA, CATEGORIA_TEXTURAS);
+        ligarTextura(livre->textura.id());
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, PAGINA_CHAO, PAGINA_CHAO, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        definirBytesRecurso(livre->textura, (size_t) PAGINA_CHAO * PAGINA_CHAO * 4);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        livre->fbo = criarRecursoGPU(GPU_FRAMEBUFFER, CATEGORIA_ALVOS);
+        ligarFramebuffer(livre->fbo.id());
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, livre->textura.id(), 0);
+        ligarFramebuffer(framebufferTela);
+    }
+    livre->id = id;
+    livre->assada = false;
+    livre->sujos.clear();
+    return *livre;
+}
+
+// Marca uma região de mundo para ser refeita nas páginas em cache que a
+// tocam. Muitas regiões numa página viram uma página inteira.
+void marcarRegiaoChaoSuja(const vec4 &regiao)
+{
+    for (PaginaChao &p : chao.paginas) {
+        if (!p.assada || !retangulosSeTocam(regiao, retanguloPaginaChao(p.id))) continue;
+        if (p.sujos.size() >= 32) {
+            p.assada = false;
+            p.sujos.clear();
+        } else p.sujos.push_back(regiao);
+    }
+}
+
+// O tile (x, y) mudou: refaz só o retângulo dele (com os vizinhos que o
+// invadem) nas páginas que o contêm
+void marcarChaoSujo(int x, int y)
+{
+    marcarRegiaoChaoSuja(retanguloTile(x, y));
+    size_t chunk = indiceTile(x, y) / (CHUNK_TAM * CHUNK_TAM);
+    if (chunk < chao.animadosValidos.size()) chao.animadosValidos[chunk] = 0;
+}
+
+// Chunk chegou do streaming: refaz a caixa do losango dele
+void marcarChunkChaoSujo(size_t chunk)
+{
+    int cx = (int)(chunk % mapa.chunksX), cy = (int)(chunk / mapa.chunksX);
+    int u0 = cx * CHUNK_TAM, v0 = cy * CHUNK_TAM;
+    int u1 = glm::min(u0 + CHUNK_TAM, tilemapWidth) - 1, v1 = glm::min(v0 + CHUNK_TAM, tilemapHeight) - 1;
+    vec4 a = retanguloTile(u0, v1), b = retanguloTile(u1, v0), c = retanguloTile(u0, v0), d = retanguloTile(u1, v1);
+    marcarRegiaoChaoSuja(vec4(a.x, c.y, b.z, d.w));
+    if (chunk < chao.animadosValidos.size()) chao.animadosValidos[chunk] = 0;
+}
+
+// Desenha na página os tiles estáticos que tocam 'regiao' (recortada pela
+// página); regiões parciais são limpas e redesenhadas sob scissor.
+// Supõe o FBO da página ligado e o estado de blend/viewport do bake.
+void assarRegiaoChao(ChaoPreRenderizado &C, const PaginaChao &p, vec4 regiao, bool parcial)
+{
+    vec4 pagina = retanguloPaginaChao(p.id);
+    regiao = vec4(glm::max(regiao.x, pagina.x), glm::max(regiao.y, pagina.y), glm::min(regiao.z, pagina.z), glm::min(regiao.w, pagina.w));
+    if (regiao.x >= regiao.z || regiao.y >= regiao.w) return;
+    if (parcial) {
+        // Linhas do FBO crescem para cima: a linha 0 é a base da página (y de mundo maior)
+        int x0 = (int) floor(regiao.x - pagina.x), x1 = (int) ceil(regiao.z - pagina.x);
+        int y0 = (int) floor(pagina.w - regiao.w), y1 = (int) ceil(pagina.w - regiao.y);
+        glScissor(x0, y0, x1 - x0, y1 - y0);
+    }
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // Tiles cujo retângulo toca a região: a = u - v e b = u + v com a mesma paridade
+    float w = tileH, h = tileW;
+    vec2 o = camadaMapa.origem;
+    int aMin = (int) floor(2 * (regiao.x - o.x) / w) - 1, aMax = (int) ceil(2 * (regiao.z - o.x) / w);
+    int bMin = (int) floor(2 * (regiao.y - o.y) / h) - 1, bMax = (int) ceil(2 * (regiao.w - o.y) / h);
+    C.instancias.clear();
+    for (int b = glm::max(bMin, 0); b <= bMax; b++)
+        for (int a = aMin + ((aMin + b) & 1); a <= aMax; a += 2) {
+            int u = (a + b) / 2, v = (b - a) / 2;
+            if (u < 0 || v < 0 || u >= tilemapWidth || v >= tilemapHeight) continue;
+            if (!retangulosSeTocam(retanguloTile(u, v), regiao)) continue;
+            size_t i = indiceTile(u, v);
+            if (!chunkResidente(i / (CHUNK_TAM * CHUNK_TAM))) continue;
+            int t = mapa.tiles[i];
+            if (tileAnimado(t)) continue; // Desenhados a cada frame
+            C.instancias.push_back({ (GLfloat) u, (GLfloat) v, (GLfloat) t });
+        }
+    if (C.instancias.empty()) return;
+
+    size_t bytes = C.instancias.size() * sizeof(InstanciaTile);
+    ligarBuffer(GL_ARRAY_BUFFER, camadaMapa.VBOInstancias.id());
+    glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+    definirBytesRecurso(camadaMapa.VBOInstancias, bytes);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, C.instancias.data());
+    ligarBuffer(GL_ARRAY_BUFFER, 0);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei) C.instancias.size());
+    estatisticas.drawCalls++;
+    estatisticas.tilesAssados += (int) C.instancias.size();
+}
+
+// Refaz o que está pendente nas páginas visíveis (inteiras ou só as regiões
+// sujas) e volta para a tela. Devolve quantas páginas foram tocadas.
+int assarPaginasChao(ChaoPreRenderizado &C, const vector<PaginaChao *> &visiveis)
+{
+    int tocadas = 0;
+    for (PaginaChao *p : visiveis) {
+        // Texturas ainda chegando ao atlas: a página é refeita quando mudarem
+        bool atlasMudou = p->versaoAtlas != atlas.versao;
+        if (p->assada && !atlasMudou && p->sujos.empty()) continue;
+        if (tocadas++ == 0) {
+            glGetIntegerv(GL_VIEWPORT, C.viewportTela);
+            glViewport(0, 0, PAGINA_CHAO, PAGINA_CHAO);
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            // Cor pré-multiplicada e alfa acumulado, compostos depois com (1, 1 - alfa)
+            definirMistura(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+            usarPrograma(camadaMapa.shaderID);
+            ligarVAO(camadaMapa.VAO.id());
+            ligarTextura(camadaMapa.texID);
+        }
+        ligarFramebuffer(p->fbo.id());
+        vec4 r = retanguloPaginaChao(p->id);
+        enviarProjecaoQuadro(ortho(r.x, r.z, r.w, r.y, -1.0f, 1.0f));
+        if (!p->assada || atlasMudou) {
+            assarRegiaoChao(C, *p, r, false);
+            estatisticas.paginasAssadas++;
+        } else {
+            glEnable(GL_SCISSOR_TEST);
+            for (const vec4 &s : p->sujos) assarRegiaoChao(C, *p, s, true);
+            glDisable(GL_SCISSOR_TEST);
+        }
+        p->assada = true;
+        p->versaoAtlas = atlas.versao;
+        p->sujos.clear();
+    }
+    if (tocadas) {
+        ligarFramebuffer(framebufferTela);
+        glViewport(C.viewportTela[0], C.viewportTela[1], C.viewportTela[2], C.viewportTela[3]);
+        definirMistura(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        enviarProjecaoQuadro(projecaoCamera());
+    }
+    return tocadas;
+}
+
+// Tiles animados de um chunk. As listas dos chunks carregados são montadas
+// na carga da cena (prepararAnimadosChunks); aqui só são refeitas as de
+// chunks alterados ou que chegaram pelo streaming depois. clear() mantém a
+// capacidade, então refazer só aloca se o chunk ganhar tiles animados.
+const vector<InstanciaTile> &animadosDoChunk(ChaoPreRenderizado &C, size_t chunk)
+{
+    vector<InstanciaTile> &lista = C.animadosChunk[chunk];
+    if (C.animadosValidos[chunk]) return lista;
+    lista.clear();
+    int cx = (int)(chunk % mapa.chunksX), cy = (int)(chunk / mapa.chunksX);
+    int xFim = glm::min((cx + 1) * CHUNK_TAM, tilemapWidth), yFim = glm::min((cy + 1) * CHUNK_TAM, tilemapHeight);
+    for (int i = cy * CHUNK_TAM; i < yFim; i++)
+        for (int j = cx * CHUNK_TAM; j < xFim; j++) {
+            int t = tileEm(j, i);
+            if (tileAnimado(t)) lista.push_back({ (GLfloat) j, (GLfloat) i, (GLfloat) t });
+        }
+    C.animadosValidos[chunk] = 1;
+    return lista;
+}
+
+// Monta, em paralelo, as listas de tiles animados de todos os chunks
+// residentes, para que a câmera entrar em chunks novos não aloque no frame
+void prepararAnimadosChunks(ChaoPreRenderizado &C)
+{
+    if (!C.haAnimados) return;
+    paraCadaFaixa(escalonador, C.animadosChunk.size(), 64, [&C](size_t inicio, size_t fim) {
+        for (size_t c = inicio; c < fim; c++)
+            if (chunkResidente(c)) animadosDoChunk(C, c);
+    });
+}
+
+// O chão estático sai das páginas pré-renderizadas: um quad por página na
+// tela, independente do número de tiles. Só os tiles animados dos chunks
+// visíveis (gravados por faixa em gravarListasQuadro) são desenhados por
+// instância a cada frame.
+void desenharMapa()
+{
+    ChaoPreRenderizado &C = chao;
+    C.frame++;
+
+    // Páginas sob a câmera, refeitas se preciso
+    vec2 minVisao = camera.visao - camera.tamanho / 2.0f - camadaMapa.origem;
+    vec2 maxVisao = camera.visao + camera.tamanho / 2.0f - camadaMapa.origem;
+    C.visiveis.clear();
+    for (int py = (int) floor(minVisao.y / PAGINA_CHAO); py <= (int) floor(maxVisao.y / PAGINA_CHAO); py++)
+        for (int px = (int) floor(minVisao.x / PAGINA_CHAO); px <= (int) floor(maxVisao.x / PAGINA_CHAO); px++) {
+            PaginaChao &p = paginaChao(C, ivec2(px, py));
+            p.ultimoUso = C.frame;
+            C.visiveis.push_back(&p);
+        }
+    assarPaginasChao(C, C.visiveis);
+
+    // Composição: um quad texturizado por página, numa chamada por textura
+    C.quads.clear();
+    for (PaginaChao *p : C.visiveis) {
+        vec4 r = retanguloPaginaChao(p->id);
+        GLfloat quad[6][4] = { { r.x, r.y, 0, 1 }, { r.z, r.y, 1, 1 }, { r.x, r.w, 0, 0 },
+                               { r.x, r.w, 0, 0 }, { r.z, r.y, 1, 1 }, { r.z, r.w, 1, 0 } };
+        for (auto &v : quad) C.quads.insert(C.quads.end(), v, v + 4);
+    }
+    usarPrograma(C.shaderID);
+    ligarVAO(C.VAO.id());
+    ligarBuffer(GL_ARRAY_BUFFER, C.VBO.id());
+    glBufferData(GL_ARRAY_BUFFER, C.quads.size() * sizeof(GLfloat), C.quads.data(), GL_STREAM_DRAW);
+    definirBytesRecurso(C.VBO, C.quads.size() * sizeof(GLfloat));
+    ligarBuffer(GL_ARRAY_BUFFER, 0);
+    definirMistura(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    for (size_t k = 0; k < C.visiveis.size(); k++) {
+        ligarTextura(C.visiveis[k]->textura.id());
+        glDrawArrays(GL_TRIANGLES, (GLint)(k * 6), 6);
+        estatisticas.drawCalls++;
+        estatisticas.drawCallsMapa++;
+    }
+    definirMistura(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    // Tiles animados por cima, numa chamada instanciada: as faixas vão direto
+    // das arenas para o buffer, uma após a outra
+    const GravacaoQuadro &G = gravacao;
+    if (G.totalAnimados) {
+        size_t bytes = G.totalAnimados * sizeof(InstanciaTile), offset = 0;
+        ligarBuffer(GL_ARRAY_BUFFER, camadaMapa.VBOInstancias.id());
+        glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+        definirBytesRecurso(camadaMapa.VBOInstancias, bytes);
+        for (const FaixaGravada &F : G.mapa) {
+            if (!F.animados.n) continue;
+            glBufferSubData(GL_ARRAY_BUFFER, offset, F.animados.n * sizeof(InstanciaTile), F.animados.dados);
+            offset += F.animados.n * sizeof(InstanciaTile);
+        }
+        ligarBuffer(GL_ARRAY_BUFFER, 0);
+        usarPrograma(camadaMapa.shaderID);
+        ligarVAO(camadaMapa.VAO.id());
+        ligarTextura(camadaMapa.texID);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei) G.totalAnimados);
+        estatisticas.drawCalls++;
+        estatisticas.drawCallsMapa++;
+    }
+    camadaMapa.nInstancias = (int) G.totalAnimados;
+}
+
+void desenharPersonagem(float alfa)
+{
+    float x0 = 400; // Posição inicial do personagem no eixo x necessária para centralizar
+    float y0 = 130;
+
+    // Interpola entre a célula do passo anterior e a atual
+    vec2 p = mix(posAnterior, pos, alfa);
+    float x = x0 + (p.x-p.y) * personagem.dimensions.x/2.0;
+    float y = y0 + (p.x+p.y) * personagem.dimensions.y/2.0;
+
+    // O frame do personagem avança com as teclas, então a animação fica parada (fps 0)
+    vec2 uvFrame = personagem.uvBase + vec2(personagem.iFrame * personagem.ds, 0.0);
+    AnimacaoSprite animacao = { 0.0f, 1, 0.0f, personagem.iAnimation };
+
+    adicionarSprite(loteSprites, 2, personagem.texID, vec3(x,y,profundidadeIsometrica(p)), personagem.dimensions, uvFrame, personagem.ds, personagem.dt, animacao);
+}
+
+void desenharAtualTile(GLuint shaderID)
+{
+    const Tile &curr_tile = tileset[6]; //tile rosa
+
+    float x0 = 340;
+    float y0 = 100;
+
+    float x = x0 + (pos.x-pos.y) * curr_tile.dimensions.x/2.0;
+    float y = y0 + (pos.x+pos.y) * curr_tile.dimensions.y/2.0;
+
+    mat4 model = mat4(1);
+    model = translate(model, vec3(x,y,0.0));
+    model = scale(model,curr_tile.dimensions);
+    usarPrograma(shaderID);
+    enviarUniform(localModel, model);
+
+    vec2 offsetTex;
+
+    offsetTex.s = curr_tile.uvBase.s + curr_tile.iTile * curr_tile.ds;
+    offsetTex.t = curr_tile.uvBase.t;
+    enviarUniform(localOffsetTex, offsetTex);
+
+    ligarVAO(curr_tile.VAO.id()); // Conectando ao buffer de geometria
+    ligarTextura(curr_tile.texID); // Conectando ao buffer de textura
+
+    // Chamada de desenho - drawcall
+    // Poligono Preenchido - GL_TRIANGLES
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    estatisticas.drawCalls++;
+}
+
+// ------------------------------
+// Snapshots da partida (salvar, carregar e rebobinar)
+// ------------------------------
+inline size_t alinharSnapshot(size_t bytes) {
+    return (bytes + 7) & ~(size_t)7;
+}
+
+SecoesSnapshot secoesSnapshot(const CabecalhoSnapshot &cab) {
+    SecoesSnapshot S;
+    size_t nAtores = cab.nAtores, nAlteradas = cab.nCelulasAlteradas;
+    S.moedas = sizeof(CabecalhoSnapshot);
+    S.celulas = S.moedas + (cab.nMoedas + 63) / 64 * sizeof(uint64_t);
+    S.destinos = S.celulas + nAtores * sizeof(ivec2);
+    S.progressoBase = S.destinos + nAtores * sizeof(ivec2);
+    S.inicioPasso = S.progressoBase + alinharSnapshot(nAtores * sizeof(float));
+    S.sementes = S.inicioPasso + alinharSnapshot(nAtores * sizeof(uint32_t));
+    S.linhas = S.sementes + alinharSnapshot(nAtores * sizeof(uint32_t));
+    S.caminho = S.linhas + alinharSnapshot(nAtores);
+    S.indicesMapa = S.caminho + cab.nCaminho * sizeof(ivec2);
+    S.tiposMapa = S.indicesMapa + alinharSnapshot(nAlteradas * sizeof(uint32_t));
+    S.total = S.tiposMapa + alinharSnapshot(nAlteradas * sizeof(uint16_t));
+    return S;
+}
+
+// Valores que o progresso de um ator assume depois de voltar a 0: k somas de
+// VELOCIDADE_ATOR * dt, feitas como no sistema de IA
+const vector<float> &valoresProgresso() {
+    static vector<float> valores;
+    if (valores.empty()) {
+        float dt = (float) PASSO_SIMULACAO;
+        for (float p = 0.0f; p < 1.0f; p += VELOCIDADE_ATOR * dt) valores.push_back(p);
+    }
+    return valores;
+}
+
+// Células cujo tipo difere do arquivo carregado, em ordem de índice (y * largura + x)
+void celulasAlteradas(vector<pair<uint32_t, uint16_t>> &saida) {
+    saida.clear();
+    for (const auto &o : mapa.tiposOriginais) {
+        uint16_t tipo = (uint16_t) tileEm(o.first % tilemapWidth, o.first / tilemapWidth);
+        if (tipo != o.second) saida.push_back({ o.first, tipo });
+    }
+    sort(saida.begin(), saida.end());
+}
+
+// Serializa a partida em 'blob', reaproveitando a capacidade dele. Os bytes
+// de preenchimento são zerados: o mesmo estado gera sempre os mesmos bytes.
+// O progresso de cada ator, que muda a todo tick, vai como (base, tick de
+// início): base 0 e o tick em que voltou a 0, ou, se o valor não é um dos
+// valoresProgresso (primeiro passo da partida), o próprio valor e o tick
+// atual. Assim o par só muda quando o ator completa um passo, junto com a
+// célula e o destino.
+void gravarSnapshot(vector<uint8_t> &blob) {
+    const Entidades &E = entidades;
+    static vector<pair<uint32_t, uint16_t>> alteradas;
+    celulasAlteradas(alteradas);
+
+    CabecalhoSnapshot cab = {};
+    memcpy(cab.magica, SNAPSHOT_MAGICA, 4);
+    cab.versao = SNAPSHOT_VERSAO;
+    strncpy(cab.tileset, tilesetFile.c_str(), sizeof(cab.tileset) - 1);
+    cab.nTiles = nTiles; cab.largura = tilemapWidth; cab.altura = tilemapHeight;
+    cab.hashMapa = hashConteudoMapa();
+    cab.flagReached = flagReached;
+    cab.tick = tickSimulacao;
+    cab.nMoedas = E.inicioAtores;
+    cab.nAtores = E.n - E.inicioAtores;
+    cab.nCaminho = caminhoAtual.size();
+    cab.passoCaminho = passoCaminho;
+    cab.nCelulasAlteradas = alteradas.size();
+    cab.pos = pos;
+    cab.ultimaDirecao = ultimaDirecao;
+    cab.iAnimation = personagem.iAnimation;
+    cab.iFrame = personagem.iFrame;
+    cab.ticksAtePasso = ticksAtePasso;
+    SecoesSnapshot S = secoesSnapshot(cab);
+    cab.bytes = S.total;
+
+    blob.resize(S.total);
+    uint8_t *d = blob.data();
+    memcpy(d, &cab, sizeof(cab));
+    // Zera a última palavra da seção (onde cai o preenchimento) e copia
+    auto copiar = [&](size_t inicio, size_t fim, const void *origem, size_t bytes) {
+        if (fim > inicio) memset(d + fim - 8, 0, 8);
+        if (bytes) memcpy(d + inicio, origem, bytes);
+    };
+
+    // Moedas: bit ligado = coletada (faixas de palavras em paralelo, como os
+    // laços por ator abaixo)
+    size_t nMoedas = cab.nMoedas;
+    uint64_t *bits = (uint64_t *)(d + S.moedas);
+    paraCadaFaixa(escalonador, (nMoedas + 63) / 64, 4096, [&](size_t inicio, size_t fim) {
+        for (size_t w = inicio; w < fim; w++) {
+            uint64_t palavra = 0;
+            size_t ultima = glm::min(nMoedas, (w + 1) * 64);
+            for (size_t i = w * 64; i < ultima; i++) palavra |= (uint64_t) !E.viva[i] << (i & 63);
+            bits[w] = palavra;
+        }
+    });
+
+    size_t base = E.inicioAtores, nAtores = cab.nAtores;
+    copiar(S.celulas, S.destinos, E.celula.data() + base, nAtores * sizeof(ivec2));
+    copiar(S.destinos, S.progressoBase, E.destino.data() + base, nAtores * sizeof(ivec2));
+    copiar(S.progressoBase, S.inicioPasso, nullptr, 0);
+    copiar(S.inicioPasso, S.sementes, nullptr, 0);
+    const vector<float> &valores = valoresProgresso();
+    const float passosPorUnidade = 1.0f / (valores.size() > 1 ? valores[1] : 1.0f);
+    float *progressoBase = (float *)(d + S.progressoBase);
+    uint32_t *inicioPasso = (uint32_t *)(d + S.inicioPasso);
+    paraCadaFaixa(escalonador, nAtores, 65536, [&](size_t inicio, size_t fim) {
+        for (size_t k = inicio; k < fim; k++) {
+            // valores[j] fica a menos de meio passo de j * passo: o índice sai do arredondamento
+            float p = E.progresso[base + k];
+            size_t j = (size_t)(p * passosPorUnidade + 0.5f);
+            bool noCiclo = j < valores.size() && valores[j] == p;
+            progressoBase[k] = noCiclo ? 0.0f : p;
+            inicioPasso[k] = (uint32_t)(cab.tick - (noCiclo ? j : 0));
+        }
+    });
+    copiar(S.sementes, S.linhas, E.semente.data() + base, nAtores * sizeof(uint32_t));
+    copiar(S.linhas, S.caminho, E.linha.data() + base, nAtores);
+    copiar(S.caminho, S.indicesMapa, caminhoAtual.data(), caminhoAtual.size() * sizeof(ivec2));
+
+    copiar(S.indicesMapa, S.tiposMapa, nullptr, 0);
+    copiar(S.tiposMapa, S.total, nullptr, 0);
+    uint32_t *indices = (uint32_t *)(d + S.indicesMapa);
+    uint16_t *tipos = (uint16_t *)(d + S.tiposMapa);
+    for (size_t k = 0; k < alteradas.size(); k++) {
+        indices[k] = alteradas[k].first;
+        tipos[k] = alteradas[k].second;
+    }
+}
+
+// Confere um snapshot lido de arquivo contra a partida atual: formato,
+// versão, mapa de referência (inclusive o hash do conteúdo), número de moedas e atores e se toda célula cai
+// dentro do mapa. Retorna false com o motivo em 'erro'.
+bool validarSnapshot(const uint8_t *d, size_t bytes, string &erro) {
+    if (bytes < sizeof(CabecalhoSnapshot)) { erro = "arquivo curto demais"; return false; }
+    const CabecalhoSnapshot &cab = *(const CabecalhoSnapshot *) d;
+    if (memcmp(cab.magica, SNAPSHOT_MAGICA, 4) != 0) { erro = "não é um snapshot"; return false; }
+    if (cab.versao != SNAPSHOT_VERSAO) { erro = "versão " + to_string(cab.versao) + " não suportada"; return false; }
+    if (strncmp(cab.tileset, tilesetFile.c_str(), sizeof(cab.tileset)) != 0 || cab.nTiles != nTiles
+        || cab.largura != tilemapWidth || cab.altura != tilemapHeight) {
+        erro = "snapshot de outro mapa";
+        return false;
+    }
+    if (cab.hashMapa != hashConteudoMapa()) {
+        erro = "o mapa mudou desde que o snapshot foi gravado (hash do conteúdo diferente)";
+        return false;
+    }
+    if (cab.nMoedas != entidades.inicioAtores || cab.nAtores != entidades.n - entidades.inicioAtores) {
+        erro = "número de moedas ou atores diferente desta partida (--moedas, --atores)";
+        return false;
+    }
+    if (cab.nCaminho > bytes / sizeof(ivec2) || cab.passoCaminho > cab.nCaminho
+        || cab.nCelulasAlteradas > bytes / sizeof(uint32_t) || cab.bytes != bytes || secoesSnapshot(cab).total != bytes) {
+        erro = "tamanho não confere com o cabeçalho (arquivo truncado?)";
+        return false;
+    }
+    if (streaming.ativo && cab.nCelulasAlteradas > 0) {
+        erro = "células alteradas não se aplicam ao mapa em streaming";
+        return false;
+    }
+
+    SecoesSnapshot S = secoesSnapshot(cab);
+    auto dentro = [](ivec2 c) { return c.x >= 0 && c.y >= 0 && c.x < tilemapWidth && c.y < tilemapHeight; };
+    bool valido = cab.pos.x >= 0 && cab.pos.y >= 0 && cab.pos.x < tilemapWidth && cab.pos.y < tilemapHeight;
+    const ivec2 *caminho = (const ivec2 *)(d + S.caminho);
+    for (size_t k = 0; k < cab.nCaminho && valido; k++) valido = dentro(caminho[k]);
+    if (!valido) { erro = "personagem ou caminho fora do mapa"; return false; }
+
+    const ivec2 *celulas = (const ivec2 *)(d + S.celulas), *destinos = (const ivec2 *)(d + S.destinos);
+    const float *progressoBase = (const float *)(d + S.progressoBase);
+    const uint32_t *inicioPasso = (const uint32_t *)(d + S.inicioPasso);
+    size_t nValores = valoresProgresso().size();
+    for (size_t k = 0; k < cab.nAtores && valido; k++) {
+        uint32_t passos = (uint32_t) cab.tick - inicioPasso[k];
+        valido = dentro(celulas[k]) && dentro(destinos[k]) && progressoBase[k] >= 0.0f && progressoBase[k] < 1.0f
+              && (progressoBase[k] == 0.0f ? passos < nValores : passos == 0);
+    }
+    if (!valido) { erro = "ator fora do mapa ou com progresso inválido"; return false; }
+
+    const uint32_t *indices = (const uint32_t *)(d + S.indicesMapa);
+    const uint16_t *tipos = (const uint16_t *)(d + S.tiposMapa);
+    for (size_t k = 0; k < cab.nCelulasAlteradas && valido; k++)
+        valido = indices[k] < (size_t) tilemapWidth * tilemapHeight && (k == 0 || indices[k] > indices[k - 1])
+              && tipos[k] < nTiles;
+    if (!valido) { erro = "célula alterada inválida"; return false; }
+    return true;
+}
+
+// Restaura a partida a partir de um snapshot válido. Só o que mudou é refeito:
+// moedas que trocaram de estado entram ou saem da grade, atores que trocaram
+// de célula são movidos nela e só as células do mapa com outro tipo passam
+// por alterarTile. O progresso dos atores sai de valoresProgresso e a posição
+// de desenho, da célula, do destino e do progresso, como no sistema de IA.
+void aplicarSnapshot(const uint8_t *d) {
+    const CabecalhoSnapshot &cab = *(const CabecalhoSnapshot *) d;
+    SecoesSnapshot S = secoesSnapshot(cab);
+    Entidades &E = entidades;
+    if (roteiroGravacao.is_open()) {
+        roteiroGravacao.close();
+        cerr << "Gravação do roteiro encerrada no tick " << tickSimulacao << ": a partida voltou no tempo" << endl;
+    }
+
+    pos = cab.pos;
+    ultimaDirecao = cab.ultimaDirecao;
+    personagem.iAnimation = cab.iAnimation;
+    personagem.iFrame = cab.iFrame;
+    flagReached = cab.flagReached != 0;
+    tickSimulacao = cab.tick;
+
+    const uint64_t *bits = (const uint64_t *)(d + S.moedas);
+    for (size_t i = 0; i < E.inicioAtores; i++) {
+        uint8_t viva = !((bits[i >> 6] >> (i & 63)) & 1);
+        if (viva == E.viva[i]) continue;
+        E.viva[i] = viva;
+        if (viva) inserirNaGrade(gradeEntidades, (int) i, E.celula[i]);
+        else removerDaGrade(gradeEntidades, (int) i);
+        loteMoedas.sujo = true;
+    }
+
+    size_t base = E.inicioAtores, nAtores = cab.nAtores;
+    const ivec2 *celulas = (const ivec2 *)(d + S.celulas);
+    for (size_t k = 0; k < nAtores; k++) {
+        if (E.celula[base + k] == celulas[k]) continue;
+        E.celula[base + k] = celulas[k];
+        moverNaGrade(gradeEntidades, (int)(base + k), celulas[k]);
+    }
+    memcpy(E.destino.data() + base, d + S.destinos, nAtores * sizeof(ivec2));
+    const vector<float> &valores = valoresProgresso();
+    const float *progressoBase = (const float *)(d + S.progressoBase);
+    const uint32_t *inicioPasso = (const uint32_t *)(d + S.inicioPasso);
+    memcpy(E.semente.data() + base, d + S.sementes, nAtores * sizeof(uint32_t));
+    memcpy(E.linha.data() + base, d + S.linhas, nAtores);
+    paraCadaFaixa(escalonador, nAtores, 65536, [&](size_t inicio, size_t fim) {
+        for (size_t k = inicio; k < fim; k++) {
+            size_t i = base + k;
+            E.progresso[i] = progressoBase[k] != 0.0f ? progressoBase[k] : valores[(uint32_t) cab.tick - inicioPasso[k]];
+            E.posicao[i] = mix(vec2(E.celula[i].x, E.celula[i].y), vec2(E.destino[i].x, E.destino[i].y), E.progresso[i]);
+        }
+    });
+
+    const ivec2 *caminho = (const ivec2 *)(d + S.caminho);
+    caminhoAtual.assign(caminho, caminho + cab.nCaminho);
+    passoCaminho = cab.passoCaminho;
+    ticksAtePasso = cab.ticksAtePasso;
+
+    // Mapa: células já alteradas voltam ao tipo do snapshot (ou ao do arquivo,
+    // se não estão nele); depois, as do snapshot que esta partida não alterou.
+    // alterarTile não insere em tiposOriginais chaves que já estão lá.
+    const uint32_t *indices = (const uint32_t *)(d + S.indicesMapa);
+    const uint16_t *tipos = (const uint16_t *)(d + S.tiposMapa);
+    size_t nAlteradas = cab.nCelulasAlteradas;
+    for (const auto &o : mapa.tiposOriginais) {
+        const uint32_t *p = lower_bound(indices, indices + nAlteradas, o.first);
+        int alvo = (p != indices + nAlteradas && *p == o.first) ? tipos[p - indices] : o.second;
+        int x = o.first % tilemapWidth, y = o.first / tilemapWidth;
+        if (tileEm(x, y) != alvo) alterarTile(x, y, alvo);
+    }
+    for (size_t k = 0; k < nAlteradas; k++) {
+        int x = indices[k] % tilemapWidth, y = indices[k] / tilemapWidth;
+        if (tileEm(x, y) != tipos[k]) alterarTile(x, y, tipos[k]);
+    }
+}
+
+// Varint sem sinal (7 bits por byte, o bit alto diz que há mais)
+inline void escreverVarint(vector<uint8_t> &v, uint64_t x) {
+    for (; x >= 0x80; x >>= 7) v.push_back((uint8_t)(x | 0x80));
+    v.push_back((uint8_t) x);
+}
+
+inline uint64_t lerVarint(const uint8_t *&p) {
+    uint64_t x = 0;
+    for (int desloc = 0; ; desloc += 7) {
+        uint8_t b = *p++;
+        x |= (uint64_t)(b & 0x7f) << desloc;
+        if (!(b & 0x80)) return x;
+    }
+}
+
+// Delta que reconstrói 'alvo' a partir de 'base': o tamanho de 'alvo' e, sobre
+// o XOR byte a byte ('base' completado com zeros), pares (bytes nulos, bytes
+// diferentes) seguidos dos bytes diferentes. Snapshots seguidos mudam pouco,
+// então quase tudo são bytes nulos, pulados de 8 em 8. Um trecho diferente só
+// termina em dois bytes nulos seguidos (um par custa pelo menos dois bytes).
+void codificarDeltaSnapshot(const vector<uint8_t> &base, const vector<uint8_t> &alvo, vector<uint8_t> &delta) {
+    size_t nBase = base.size() / 8, n = alvo.size();
+    const uint64_t *b = (const uint64_t *) base.data(), *a = (const uint64_t *) alvo.data();
+    auto palavra = [&](size_t w) { return a[w] ^ (w < nBase ? b[w] : 0); };
+    auto byte = [&](size_t i) { return (uint8_t)(palavra(i / 8) >> (i % 8 * 8)); };
+    delta.clear();
+    escreverVarint(delta, n);
+    for (size_t i = 0; i < n; ) {
+        size_t inicioNulos = i;
+        while (i < n) {
+            if (i % 8 == 0 && palavra(i / 8) == 0) i += 8;
+            else if (byte(i) == 0) i++;
+            else break;
+        }
+        size_t inicio = glm::min(i, n);
+        i = inicio;
+        while (i < n && (byte(i) != 0 || (i + 1 < n && byte(i + 1) != 0))) i++;
+        escreverVarint(delta, inicio - inicioNulos);
+        escreverVarint(delta, i - inicio);
+        for (size_t k = inicio; k < i; k++) delta.push_back(byte(k));
+    }
+}
+
+void decodificarDeltaSnapshot(const vector<uint8_t> &base, const uint8_t *delta, vector<uint8_t> &saida) {
+    const uint8_t *p = delta;
+    size_t bytes = lerVarint(p);
+    saida.resize(bytes);
+    size_t comum = glm::min(bytes, base.size());
+    memcpy(saida.data(), base.data(), comum);
+    memset(saida.data() + comum, 0, bytes - comum);
+    for (size_t i = 0; i < bytes; ) {
+        i += lerVarint(p);
+        size_t diferentes = lerVarint(p);
+        for (size_t k = 0; k < diferentes; k++) saida[i++] ^= *p++;
+    }
+}
+
+// Liga o histórico com até 'segundos' de passos em 'orcamentoMB' de deltas e
+// grava o snapshot do estado atual como ponto de partida. Com 'orcamentoMs' > 0
+// o histórico se desliga sozinho se guardar um passo passar disso em média.
+void iniciarHistorico(HistoricoSnapshots &H, double segundos, size_t orcamentoMB, double orcamentoMs) {
+    H = HistoricoSnapshots();
+    size_t maxEntradas = (size_t)(segundos / PASSO_SIMULACAO);
+    if (maxEntradas == 0 || orcamentoMB == 0) return;
+    H.entradas.resize(maxEntradas);
+    H.capacidade = orcamentoMB << 20;
+    H.dados.reset(new uint8_t[H.capacidade]);
+    H.orcamentoMs = orcamentoMs;
+    gravarSnapshot(H.atual);
+    H.ativo = true;
+}
+
+// Desliga o histórico e devolve a memória dele
+void desligarHistorico(HistoricoSnapshots &H, const string& motivo) {
+    cerr << "Rebobinar desligado: " << motivo << endl;
+    H = HistoricoSnapshots();
+}
+
+void descartarMaisAntigo(HistoricoSnapshots &H) {
+    H.bytesUsados -= H.entradas[H.primeira].bytes;
+    H.primeira = (H.primeira + 1) % H.entradas.size();
+    H.nEntradas--;
+    H.descartados++;
+}
+
+// Guarda o passo atual: o snapshot novo passa a ser 'atual' e o anterior vira
+// um delta reverso no anel. Os deltas ficam em ordem no anel de bytes, então
+// os que serão sobrescritos são sempre os mais antigos.
+void registrarSnapshot(HistoricoSnapshots &H) {
+    auto inicioRegistro = chrono::steady_clock::now();
+    gravarSnapshot(H.rascunho);
+    codificarDeltaSnapshot(H.rascunho, H.atual, H.delta);
+    swap(H.atual, H.rascunho);
+
+    size_t bytes = H.delta.size(), inicio = 0;
+    if (bytes > H.capacidade) { // Maior que o anel: o histórico recomeça daqui
+        while (H.nEntradas > 0) descartarMaisAntigo(H);
+        return;
+    }
+    if (H.nEntradas > 0) {
+        const EntradaHistorico &ultima = H.entradas[(H.primeira + H.nEntradas - 1) % H.entradas.size()];
+        inicio = ultima.inicio + ultima.bytes;
+        if (inicio + bytes > H.capacidade) {
+            // Volta ao começo do anel: o que está depois do último é mais antigo
+            while (H.nEntradas > 0 && H.entradas[H.primeira].inicio >= inicio) descartarMaisAntigo(H);
+            inicio = 0;
+        }
+    }
+    while (H.nEntradas > 0 && (H.nEntradas == H.entradas.size()
+           || (H.entradas[H.primeira].inicio < inicio + bytes && H.entradas[H.primeira].inicio + H.entradas[H.primeira].bytes > inicio)))
+        descartarMaisAntigo(H);
+    memcpy(H.dados.get() + inicio, H.delta.data(), bytes);
+    H.entradas[(H.primeira + H.nEntradas) % H.entradas.size()] = { inicio, bytes };
+    H.nEntradas++;
+    H.bytesUsados += bytes;
+
+    // Média móvel dos últimos ~30 passos; os primeiros só aquecem a média
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - inicioRegistro).count();
+    H.msMedio = H.registros == 0 ? ms : H.msMedio + (ms - H.msMedio) / 30.0;
+    if (++H.registros >= 30 && H.orcamentoMs > 0 && H.msMedio > H.orcamentoMs) {
+        ostringstream motivo;
+        motivo << "guardar cada passo custa " << H.msMedio << " ms (orçamento " << H.orcamentoMs
+               << " ms) e " << H.capacidade / glm::max(H.bytesUsados / H.nEntradas, (size_t) 1)
+               << " passos cabem no anel (--rebobinar explícito não tem esse limite)";
+        desligarHistorico(H, motivo.str());
+    }
+}
+
+// Um passo para trás: reconstrói o snapshot anterior com o delta mais novo e
+// o aplica. Retorna false quando não há mais histórico.
+bool voltarSnapshot(HistoricoSnapshots &H) {
+    if (H.nEntradas == 0) return false;
+    const EntradaHistorico &e = H.entradas[(H.primeira + H.nEntradas - 1) % H.entradas.size()];
+    decodificarDeltaSnapshot(H.atual, H.dados.get() + e.inicio, H.rascunho);
+    H.bytesUsados -= e.bytes;
+    H.nEntradas--;
+    swap(H.atual, H.rascunho);
+    aplicarSnapshot(H.atual.data());
+    return true;
+}
+
+// F5: grava a partida em um arquivo
+bool salvarSnapshot(const string& filename) {
+    static vector<uint8_t> blob;
+    gravarSnapshot(blob);
+    ofstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Erro ao criar " << filename << endl;
+        return false;
+    }
+    file.write((const char *) blob.data(), blob.size());
+    if (!file) {
+        cerr << "Erro ao gravar " << filename << endl;
+        return false;
+    }
+    cout << "Partida salva em " << filename << " (tick " << tickSimulacao << ", " << blob.size() << " bytes)" << endl;
+    return true;
+}
+
+// F9: carrega a partida de um arquivo. Com o histórico ligado, a carga vira
+// mais um passo dele (rebobinar volta para antes dela).
+bool carregarSnapshot(const string& filename) {
+    ifstream file(filename, ios::binary | ios::ate);
+    if (!file.is_open()) {
+        cerr << "Erro ao abrir " << filename << endl;
+        return false;
+    }
+    vector<uint8_t> blob((size_t) file.tellg());
+    file.seekg(0);
+    file.read((char *) blob.data(), blob.size());
+    string erro;
+    if (!file || !validarSnapshot(blob.data(), blob.size(), erro)) {
+        cerr << "Snapshot " << filename << " ignorado: " << (erro.empty() ? "erro de leitura" : erro) << endl;
+        return false;
+    }
+    aplicarSnapshot(blob.data());
+    posAnterior = pos; // Sem interpolar a partir do estado de antes da carga
+    if (historico.ativo) registrarSnapshot(historico);
+    cout << "Partida carregada de " << filename << " (tick " << tickSimulacao << ")" << endl;
+    return true;
+}
+
+// ------------------------------
+// Modo headless: só as regras, sem janela nem GL
+// ------------------------------
+
+// Hash do estado da partida (tick, personagem, moedas, atores e bandeira), para
+// comparar execuções entre versões e máquinas
+uint64_t hashEstadoSimulacao()
+{
+    int32_t estado[5] = { (int32_t) pos.x, (int32_t) pos.y, personagem.iAnimation, personagem.iFrame, flagReached };
+    uint64_t h = misturarHash(HASH_INICIAL, &tickSimulacao, sizeof(tickSimulacao));
+    h = misturarHash(h, estado, sizeof(estado));
+    uint64_t bits = 0;
+    size_t nMoedas = entidades.inicioAtores;
+    for (size_t i = 0; i < nMoedas; i++) {
+        bits |= (uint64_t) !entidades.viva[i] << (i & 63);
+        if ((i & 63) == 63 || i + 1 == nMoedas) {
+            h = misturarHash(h, &bits, sizeof(bits));
+            bits = 0;
+        }
+    }
+    size_t nAtores = entidades.n - nMoedas;
+    if (nAtores > 0) {
+        h = misturarHash(h, &entidades.celula[nMoedas], nAtores * sizeof(ivec2));
+        h = misturarHash(h, &entidades.destino[nMoedas], nAtores * sizeof(ivec2));
+        h = misturarHash(h, &entidades.progresso[nMoedas], nAtores * sizeof(float));
+    }
+    return h;
+}
+
+// Lê um roteiro de entrada: linhas "tick teclas" (ex.: "120 W" ou "121 WWA"),
+// em ordem de tick; '#' inicia comentário
+bool carregarRoteiro(const string& filename, vector<pair<uint64_t, int>> &roteiro)
+{
+    ifstream file(filename);
+    if (!file.is_open()) {
+        cerr << "Erro ao abrir " << filename << endl;
+        return false;
+    }
+    string linha;
+    while (getline(file, linha)) {
+        linha = linha.substr(0, linha.find('#'));
+        istringstream ss(linha);
+        uint64_t tick;
+        string teclas;
+        if (!(ss >> tick >> teclas)) continue;
+        if (!roteiro.empty() && tick < roteiro.back().first) {
+            cerr << "Roteiro fora de ordem no tick " << tick << endl;
+            return false;
+        }
+        for (char c : teclas) roteiro.push_back({ tick, toupper((unsigned char) c) });
+    }
+    return true;
+}
+
+// Roda a partida no máximo de ticks por segundo e imprime o hash final.
+// Uso: trabalhogb --headless [mapa] [--roteiro arquivo | --passeio semente]
+//                 [--ticks N] [--moedas N] [--atores N] [--threads N] [--hash-a-cada N]
+//                 [--log arquivo]
+int simulacaoHeadless(int argc, char **argv)
+{
+    string arquivoMapa = "map.txt", arquivoRoteiro, arquivoLog;
+    uint64_t semente = 1, ticks = 0, hashACada = 0;
+    int moedasExtras = 0, nAtores = 0;
+    for (int a = 2; a < argc; a++) {
+        string arg = argv[a];
+        if (arg == "--roteiro" && a + 1 < argc) arquivoRoteiro = argv[++a];
+        else if (arg == "--passeio" && a + 1 < argc) semente = strtoull(argv[++a], nullptr, 10);
+        else if (arg == "--ticks" && a + 1 < argc) ticks = strtoull(argv[++a], nullptr, 10);
+        else if (arg == "--moedas" && a + 1 < argc) moedasExtras = atoi(argv[++a]);
+        else if (arg == "--atores" && a + 1 < argc) nAtores = atoi(argv[++a]);
+        else if (arg == "--multidao") multidao = true;
+        else if (arg == "--threads" && a + 1 < argc) threadsSimulacao = atoi(argv[++a]);
+        else if (arg == "--hash-a-cada" && a + 1 < argc) hashACada = strtoull(argv[++a], nullptr, 10);
+        else if (arg == "--log" && a + 1 < argc) arquivoLog = argv[++a];
+        else if (arg[0] != '-') arquivoMapa = arg;
+    }
 
-        glLineWidth(10);
-        glPointSize(20);
+    if (!loadMapConfig(arquivoMapa)) return -1;
+    if (bloqueadosNoMapa) aplicarTilesBloqueados();
+    else carregarTilesBloqueados("tiles_bloqueados.txt");
+    logSimulacao = false;
+    if (!iniciarLog(logEventos, false, arquivoLog)) return -1;
+    iniciarEscalonador(escalonador, numeroThreadsSimulacao());
+    iniciarSimulacao(moedasExtras, nAtores);
 
-        // Desenho dos elementos
-        desenharMapa(shaderID);
-        desenharAtualTile(shaderID);
-        desenharMoedas(shaderID);
-        desenharFlag(shaderID);
-        desenharPersonagem(shaderID);
+    // Entrada: roteiro gravado ou passeio aleatório (uma tecla por tick)
+    vector<pair<uint64_t, int>> roteiro;
+    if (!arquivoRoteiro.empty()) {
+        if (!carregarRoteiro(arquivoRoteiro, roteiro)) return -1;
+        if (ticks == 0) ticks = roteiro.empty() ? 0 : roteiro.back().first + 1;
+    } else if (ticks == 0) ticks = 10000000;
+    mt19937_64 rng(semente);
+    const int teclas[8] = { GLFW_KEY_W, GLFW_KEY_A, GLFW_KEY_S, GLFW_KEY_D, GLFW_KEY_Q, GLFW_KEY_E, GLFW_KEY_Z, GLFW_KEY_X };
 
-        glfwSwapBuffers(window);
+    auto inicio = chrono::steady_clock::now();
+    size_t proximo = 0;
+    vector<int> doTick; // Todas as teclas do tick, sem limite (o roteiro pode ter muitas no mesmo tick)
+    while (tickSimulacao < ticks && !flagReached) {
+        doTick.clear();
+        if (arquivoRoteiro.empty()) doTick.push_back(teclas[rng() & 7]);
+        else
+            while (proximo < roteiro.size() && roteiro[proximo].first == tickSimulacao)
+                doTick.push_back(roteiro[proximo++].second);
+        tickRegras(doTick.data(), doTick.size());
+        if (hashACada && tickSimulacao % hashACada == 0)
+            cout << "tick " << tickSimulacao << " hash " << hex << hashEstadoSimulacao() << dec << endl;
     }
-    // Finaliza GLFW
-    glfwTerminate();
+    double s = chrono::duration<double>(chrono::steady_clock::now() - inicio).count();
+
+    encerrarEscalonador(escalonador);
+    encerrarLog(logEventos);
+
+    size_t coletadas = 0, nMoedas = entidades.inicioAtores;
+    for (size_t i = 0; i < nMoedas; i++) coletadas += !entidades.viva[i];
+    cout << "ticks: " << tickSimulacao << " em " << s * 1000.0 << " ms ("
+         << (tickSimulacao / glm::max(s, 1e-9)) / 1e6 << " Mticks/s)" << endl;
+    cout << "posicao: (" << pos.x << "," << pos.y << ") moedas: " << coletadas << "/" << nMoedas
+         << " bandeira: " << (flagReached ? "sim" : "nao") << endl;
+    cout << "hash: " << hex << hashEstadoSimulacao() << dec << endl;
     return 0;
 }
 
 // ------------------------------
-// Função de callback de teclado
+// Benchmarks (modo sem janela)
 // ------------------------------
-void key_callback(GLFWwindow *window, int key, int scancode, int action, int mode)
+
+// Compara consultas de caminhabilidade no layout antigo (vector<vector<int>> +
+// tileset[...].caminhavel) com o bitset do mapa em chunks, em ordem sequencial
+// e aleatória. Uso: trabalhogb --bench-mapa [lado]
+void benchmarkMapa(int lado)
 {
-    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, GL_TRUE);
+    const int nTiposTile = 7;
+    mt19937 rng(1234);
 
-    vec2 aux = pos;
-    int oldAnimation = personagem.iAnimation;
+    // Tileset sintético: tiles 3, 4 e 6 bloqueados, como em tiles_bloqueados.txt
+    tileset.assign(nTiposTile, Tile());
+    tiposCaminhaveis.assign(nTiposTile, 0);
+    for (int t = 0; t < nTiposTile; t++) {
+        tiposCaminhaveis[t] = !(t == 3 || t == 4 || t == 6);
+        tileset[t].caminhavel = tiposCaminhaveis[t];
+    }
 
-    // Movimentação do personagem
-    if (key == GLFW_KEY_W && action == GLFW_PRESS) { if (pos.x > 0) pos.x--; if (pos.y > 0) pos.y--; personagem.iAnimation = 1; }
-    if (key == GLFW_KEY_A && action == GLFW_PRESS) { if (pos.x > 0) pos.x--; if (pos.y <= tilemapHeight - 2) pos.y++; personagem.iAnimation = 2; }
-    if (key == GLFW_KEY_S && action == GLFW_PRESS) { if (pos.x <= tilemapWidth -2) pos.x++; if (pos.y <= tilemapHeight - 2) pos.y++; personagem.iAnimation = 0; }
-    if (key == GLFW_KEY_D && action == GLFW_PRESS) { if (pos.x <= tilemapWidth -2) pos.x++; if (pos.y > 0) pos.y--; personagem.iAnimation = 3; }
-    if (key == GLFW_KEY_Q && action == GLFW_PRESS) { if (pos.x > 0) pos.x--; personagem.iAnimation = 2; }
-    if (key == GLFW_KEY_E && action == GLFW_PRESS) { if (pos.y > 0) pos.y--; personagem.iAnimation = 3; }
-    if (key == GLFW_KEY_Z && action == GLFW_PRESS) { if (pos.y <= tilemapHeight - 2) pos.y++; personagem.iAnimation = 2; }
-    if (key == GLFW_KEY_X && action == GLFW_PRESS) { if (pos.x <= tilemapWidth -2) pos.x++; personagem.iAnimation = 3; }
+    vector<vector<int>> antigo(lado, vector<int>(lado));
+    alocarMapa(lado, lado);
+    for (int y = 0; y < lado; y++)
+        for (int x = 0; x < lado; x++) {
+            int t = rng() % nTiposTile;
+            antigo[y][x] = t;
+            mapa.tiles[indiceTile(x, y)] = (uint16_t) t;
+        }
+    reconstruirCaminhabilidade();
 
-    // Checa se o tile é caminhável
-    if (!tileset[mapConfig[(int)pos.y][(int)pos.x]].caminhavel)
-    {
-        pos = aux; 
+    const size_t nConsultas = (size_t) 1 << 24;
+    vector<ivec2> aleatorias(nConsultas);
+    for (auto &c : aleatorias) c = ivec2(rng() % lado, rng() % lado);
+    vector<uint8_t> resultado(nConsultas);
+    vector<uint64_t> linha(((size_t) lado + 63) / 64);
+
+    // Sequencial: varreduras completas em y/x (sem divisão por consulta) até
+    // somar pelo menos nConsultas
+    const size_t passadas = glm::max(nConsultas / ((size_t) lado * lado), (size_t) 1);
+    const size_t nSequenciais = passadas * lado * lado;
+
+    auto medir = [&](const char *nome, size_t n, auto consulta) {
+        auto inicio = chrono::steady_clock::now();
+        size_t total = consulta();
+        double s = chrono::duration<double>(chrono::steady_clock::now() - inicio).count();
+        cout << "  " << nome << ": " << (n / s) / 1e6 << " Mconsultas/s"
+             << " (caminhaveis: " << total << ")" << endl;
+    };
+
+    cout << "Mapa " << lado << "x" << lado << ", " << nConsultas << " consultas aleatorias, "
+         << passadas << " varreduras sequenciais" << endl;
+    medir("antigo, sequencial", nSequenciais, [&]() {
+        size_t total = 0;
+        for (size_t p = 0; p < passadas; p++)
+            for (int y = 0; y < lado; y++)
+                for (int x = 0; x < lado; x++)
+                    total += tileset[antigo[y][x]].caminhavel;
+        return total;
+    });
+    medir("bitset, sequencial", nSequenciais, [&]() {
+        size_t total = 0;
+        for (size_t p = 0; p < passadas; p++)
+            for (int y = 0; y < lado; y++)
+                for (int x = 0; x < lado; x++)
+                    total += celulaCaminhavel(x, y);
+        return total;
+    });
+    medir("bitset, em linhas ", nSequenciais, [&]() {
+        size_t total = 0;
+        for (size_t p = 0; p < passadas; p++)
+            for (int y = 0; y < lado; y++)
+                total += consultarCaminhaveisLinha(0, y, lado, linha.data());
+        return total;
+    });
+    medir("antigo, aleatorio ", nConsultas, [&]() {
+        size_t total = 0;
+        for (const ivec2 &c : aleatorias) total += tileset[antigo[c.y][c.x]].caminhavel;
+        return total;
+    });
+    medir("bitset, aleatorio ", nConsultas, [&]() {
+        size_t total = 0;
+        for (const ivec2 &c : aleatorias) total += celulaCaminhavel(c.x, c.y);
+        return total;
+    });
+    medir("bitset, em lote   ", nConsultas, [&]() {
+        return consultarCaminhaveis(aleatorias.data(), aleatorias.size(), resultado.data());
+    });
+}
+
+// Mede a carga de mapas sintéticos de 1M e 16M células nos formatos texto e
+// binário. Uso: trabalhogb --bench-carga
+void benchmarkCargaMapa()
+{
+    const int lados[] = { 1000, 4000 };
+    const string arqTexto = "bench_mapa.txt", arqBin = "bench_mapa.tmap";
+    mt19937 rng(42);
+
+    for (int lado : lados) {
+        // Gera o mapa e grava nos dois formatos
+        tilesetFile = "tilesetIso.png"; nTiles = 7; tileW = 57; tileH = 114;
+        alocarMapa(lado, lado);
+        for (int y = 0; y < lado; y++)
+            for (int x = 0; x < lado; x++)
+                mapa.tiles[indiceTile(x, y)] = (uint16_t)(rng() % nTiles);
+        tilesBloqueados = { 3, 4, 6 };
+        salvarMapaTexto(arqTexto);
+        salvarMapaBinario(arqBin);
+
+        for (const string &arq : { arqTexto, arqBin }) {
+            auto inicio = chrono::steady_clock::now();
+            bool ok = loadMapConfig(arq);
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+            // Toca todas as células para contar também as falhas de página do mapeamento
+            uint64_t soma = 0;
+            for (size_t i = 0; i < mapa.nCelulas; i++) soma += mapa.tiles[i];
+            double msTotal = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+            cout << (size_t) lado * lado << " celulas, " << arq << ": carga " << ms << " ms, carga + leitura "
+                 << msTotal << " ms" << (ok ? "" : " (falhou)") << " [" << soma << "]" << endl;
+        }
+        liberarMapa();
     }
-    else if (personagem.iAnimation == oldAnimation) {
-        personagem.iFrame = (personagem.iFrame + 1) % personagem.nFrames;
-    } else {
-        personagem.iFrame = 0;
+    remove(arqTexto.c_str());
+    remove(arqBin.c_str());
+}
+
+// Compara a checagem antiga de coleta (varredura linear com distância em tela)
+// com a grade espacial, e mede atualizações incrementais de atores em movimento.
+// Uso: trabalhogb --bench-colisao [nMoedas]
+void benchmarkColisao(size_t nMoedas)
+{
+    const int lado = 2048;
+    if (!tileW || !tileH) { tileW = 57; tileH = 114; } // Sem mapa carregado: os do tilesetIso.png
+    const float w = (float) tileH, h = (float) tileW; // Largura e altura do losango na tela
+    mt19937 rng(99);
+
+    vector<ivec2> celulas(nMoedas);
+    vector<vec3> posicoes(nMoedas);
+    GradeEspacial grade;
+    reservarGrade(grade, nMoedas);
+    for (size_t i = 0; i < nMoedas; i++) {
+        ivec2 p(rng() % lado, rng() % lado);
+        posicoes[i] = vec3(340 + (p.x - p.y) * w/2, 100 + (p.x + p.y) * h/2 - 10, 0);
+        celulas[i] = p + deslocamentoColetaMoeda();
+        inserirNaGrade(grade, (int) i, celulas[i]);
     }
 
-    // Colisão com moedas
-    float x0 = 400;
-    float y0 = 100;
-    vec3 personagemPos = vec3(
-        x0 + (pos.x-pos.y) * personagem.dimensions.x/2.0,
-        y0 + (pos.x+pos.y) * personagem.dimensions.y/2.0,
-        0.0
-    );
-    for (auto& moeda : moedas) {
-        if (!moeda.coletada) {
-            float distancia = distance(personagemPos, moeda.position);
-            if (distancia < 20.0f) {
-                moeda.coletada = true;
-                cout << "Moeda coletada!" << endl;
-            }
-        }
+    // Posições do personagem: metade sobre moedas, metade aleatórias
+    const size_t nConsultas = 1 << 20;
+    vector<ivec2> consultas(nConsultas);
+    for (size_t k = 0; k < nConsultas; k++)
+        consultas[k] = (k & 1) ? celulas[rng() % nMoedas] : ivec2(rng() % lado, rng() % lado);
+
+    cout << nMoedas << " moedas num mapa " << lado << "x" << lado << endl;
+
+    // Varredura linear: uma fração das consultas (custa O(n) cada)
+    size_t nLinear = glm::max((size_t) 16, glm::min(nConsultas, ((size_t) 1 << 28) / glm::max(nMoedas, (size_t) 1)));
+    auto inicio = chrono::steady_clock::now();
+    size_t acertosLinear = 0;
+    for (size_t k = 0; k < nLinear; k++) {
+        ivec2 c = consultas[k];
+        vec3 personagemPos = vec3(400 + (c.x - c.y) * w/2, 100 + (c.x + c.y) * h/2, 0);
+        for (size_t i = 0; i < nMoedas; i++)
+            if (distance(personagemPos, posicoes[i]) < 20.0f) acertosLinear++;
     }
+    double nsLinear = chrono::duration<double, nano>(chrono::steady_clock::now() - inicio).count() / nLinear;
 
-    // Colisão com a flag
-    float distanciaFlag = distance(personagemPos, flag.position);
-    if (!flagReached && distanciaFlag < 30.0f) {
-        flagReached = true;
-        cout << "Você chegou na bandeira! Fim de jogo." << endl;
-        glfwSetWindowShouldClose(window, GL_TRUE);
+    // Grade: todas as consultas; confere com a varredura no mesmo subconjunto
+    inicio = chrono::steady_clock::now();
+    size_t acertosGrade = 0, acertosConferencia = 0;
+    for (size_t k = 0; k < nConsultas; k++) {
+        paraCadaNaCelula(grade, consultas[k], [&](int) { acertosGrade++; });
+        if (k + 1 == nLinear) acertosConferencia = acertosGrade;
     }
+    double nsGrade = chrono::duration<double, nano>(chrono::steady_clock::now() - inicio).count() / nConsultas;
+
+    cout << "  linear: " << nsLinear << " ns/consulta (" << nLinear << " consultas, " << acertosLinear << " acertos)" << endl;
+    cout << "  grade:  " << nsGrade << " ns/consulta (" << nConsultas << " consultas, "
+         << acertosConferencia << " acertos nas primeiras " << nLinear << ")"
+         << (acertosConferencia == acertosLinear ? "" : "  *** DIVERGE ***") << endl;
 
-    cout << "(" << pos.x <<"," << pos.y << ")" << endl;
+    // Atores em movimento: um passo de tile por atualização
+    const size_t nAtores = glm::min(nMoedas, (size_t) 100000);
+    const int passos = 20;
+    inicio = chrono::steady_clock::now();
+    for (int p = 0; p < passos; p++)
+        for (size_t i = 0; i < nAtores; i++) {
+            ivec2 c = grade.celula[i] + ivec2((int)(rng() % 3) - 1, (int)(rng() % 3) - 1);
+            moverNaGrade(grade, (int) i, c);
+        }
+    double nsMover = chrono::duration<double, nano>(chrono::steady_clock::now() - inicio).count() / (nAtores * passos);
+    cout << "  mover:  " << nsMover << " ns/atualização (" << nAtores << " atores x " << passos << " passos)" << endl;
+
+    // Coleta: remove metade das moedas
+    inicio = chrono::steady_clock::now();
+    for (size_t i = 0; i < nMoedas; i += 2) removerDaGrade(grade, (int) i);
+    double nsRemover = chrono::duration<double, nano>(chrono::steady_clock::now() - inicio).count() / ((nMoedas + 1) / 2);
+    cout << "  coleta: " << nsRemover << " ns/remoção, " << grade.nPresentes << " restantes" << endl;
 }
 
-// ------------------------------
-// Funções utilitárias de setup e desenho
-// ------------------------------
-int setupShader()
+// Mede um tick dos sistemas das entidades (IA, animação e trocas na grade)
+// com nAtores atores num mapa todo caminhável, para 1, 2, 4... threads até
+// maxThreads (padrão: núcleos da máquina). Uso: trabalhogb --bench-entidades [n] [threads]
+void benchmarkEntidades(size_t nAtores, int maxThreads)
 {
-    // Vertex shader
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-    glCompileShader(vertexShader);
-    // Checando erros de compilação (exibição via log no terminal)
-    GLint success;
-    GLchar infoLog[512];
-    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
-                  << infoLog << std::endl;
-    }
-    // Fragment shader
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-    glCompileShader(fragmentShader);
-    // Checando erros de compilação (exibição via log no terminal)
-    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n"
-                  << infoLog << std::endl;
+    const int lado = 1024;
+    if (maxThreads <= 0) maxThreads = glm::max((int) thread::hardware_concurrency(), 1);
+    tilemapWidth = tilemapHeight = lado;
+    alocarMapa(lado, lado);
+    tiposCaminhaveis.assign(1, 1);
+    reconstruirCaminhabilidade();
+
+    cout << nAtores << " atores num mapa " << lado << "x" << lado << " (orçamento: 4 ms/tick)" << endl;
+    uint64_t hashReferencia = 0;
+    for (int nThreads = 1; ; nThreads = glm::min(nThreads * 2, maxThreads)) {
+        iniciarSimulacao(0, (int) nAtores);
+        iniciarEscalonador(escalonador, nThreads);
+        const int ticks = 120;
+        double total = 0, pior = 0;
+        for (int t = 0; t < ticks; t++) {
+            auto inicio = chrono::steady_clock::now();
+            atualizarEntidades((float) PASSO_SIMULACAO);
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+            total += ms;
+            pior = glm::max(pior, ms);
+        }
+        encerrarEscalonador(escalonador);
+
+        // O resultado não pode depender do número de threads
+        uint64_t h = hashEstadoSimulacao();
+        if (nThreads == 1) hashReferencia = h;
+        cout << "  " << nThreads << " thread(s): " << total / ticks << " ms/tick (pior " << pior << " ms)"
+             << (h == hashReferencia ? "" : "  *** ESTADO DIVERGE ***") << endl;
+        if (nThreads >= maxThreads) break;
     }
-    // Linkando os shaders e criando o identificador do programa de shader
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-    // Checando por erros de linkagem
-    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-    if (!success)
-    {
-        glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
-                  << infoLog << std::endl;
+}
+
+// Mapa lado x lado dos benchmarks de navegação: tile 0 livre e tile 1 em
+// paredes curtas e blocos aleatórios até ~25% do mapa. Retorna quantas células
+// ficaram bloqueadas.
+size_t gerarMapaObstaculos(int lado, mt19937 &rng)
+{
+    alocarMapa(lado, lado);
+    tiposCaminhaveis = { 1, 0 };
+    size_t nCelulas = (size_t) lado * lado, bloqueadas = 0;
+    while (bloqueadas < nCelulas / 4) {
+        // Dois terços de paredes de um tile de espessura, um terço de blocos
+        int w, h;
+        if (rng() % 3) {
+            int comprimento = 4 + rng() % 21, espessura = 1;
+            if (rng() & 1) { w = comprimento; h = espessura; }
+            else { w = espessura; h = comprimento; }
+        } else {
+            w = 2 + rng() % 9;
+            h = 2 + rng() % 9;
+        }
+        int x0 = rng() % lado, y0 = rng() % lado;
+        for (int y = y0; y < glm::min(y0 + h, lado); y++)
+            for (int x = x0; x < glm::min(x0 + w, lado); x++) {
+                uint16_t &t = mapa.tiles[indiceTile(x, y)];
+                if (t == 0) { t = 1; bloqueadas++; }
+            }
     }
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    reconstruirCaminhabilidade();
+    return bloqueadas;
+}
 
-    return shaderProgram;
+// Confere que o caminho liga inicio a fim em passos das 8 direções só por
+// células caminháveis e devolve o custo (-1 se inválido)
+float custoCaminho(const vector<ivec2> &caminho, ivec2 inicio, ivec2 fim) {
+    if (caminho.empty() || caminho.front() != inicio || caminho.back() != fim) return -1;
+    float custo = 0;
+    for (size_t k = 1; k < caminho.size(); k++) {
+        ivec2 d = caminho[k] - caminho[k - 1];
+        if (abs(d.x) > 1 || abs(d.y) > 1 || d == ivec2(0, 0)) return -1;
+        if (!celulaCaminhavel(caminho[k].x, caminho[k].y)) return -1;
+        custo += (d.x != 0 && d.y != 0) ? CUSTO_DIAGONAL : 1.0f;
+    }
+    return custo;
 }
 
-int setupSprite(int nAnimations, int nFrames, float &ds, float &dt)
+// Busca de caminhos num mapa lado x lado com paredes e blocos aleatórios
+// (~25% bloqueado): A* contra JPS contra a busca hierárquica por chunks, em
+// pares distantes (pelo menos meio mapa) sorteados na mesma componente
+// conexa. Uso: trabalhogb --bench-caminhos [lado] [pares]
+void benchmarkCaminhos(int lado, int nPares)
 {
-    ds = 1.0 / (float) nFrames;
-    dt = 1.0 / (float) nAnimations;
-    GLfloat vertices[] = {
-        // x   y    z    s     t
-        -0.5,  0.5, 0.0, 0.0, dt, //V0
-        -0.5, -0.5, 0.0, 0.0, 0.0, //V1
-         0.5,  0.5, 0.0, ds, dt, //V2
-         0.5, -0.5, 0.0, ds, 0.0  //V3
-        };
+    mt19937 rng(99);
+    size_t nCelulas = (size_t) lado * lado, bloqueadas = gerarMapaObstaculos(lado, rng);
 
-    GLuint VBO, VAO;
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    // Maior componente conexa (buscas em largura a partir de cada célula livre
+    // ainda não visitada): os pares são sorteados nela
+    vector<ivec2> componente, atual;
+    vector<uint8_t> visitada(nCelulas, 0);
+    for (int y = 0; y < lado; y++)
+        for (int x = 0; x < lado; x++) {
+            if (!celulaCaminhavel(x, y) || visitada[(size_t) y * lado + x]) continue;
+            atual.assign(1, ivec2(x, y));
+            visitada[(size_t) y * lado + x] = 1;
+            for (size_t k = 0; k < atual.size(); k++)
+                for (const ivec2 &d : DIRECOES_PASSO) {
+                    ivec2 v = atual[k] + d;
+                    if (!celulaCaminhavel(v.x, v.y) || visitada[(size_t) v.y * lado + v.x]) continue;
+                    visitada[(size_t) v.y * lado + v.x] = 1;
+                    atual.push_back(v);
+                }
+            if (atual.size() > componente.size()) componente.swap(atual);
+        }
+    vector<ivec2> inicios, fins;
+    while ((int) inicios.size() < nPares) {
+        ivec2 a = componente[rng() % componente.size()], b = componente[rng() % componente.size()];
+        if (distanciaOctil(a, b) < lado / 2) continue;
+        inicios.push_back(a);
+        fins.push_back(b);
+    }
 
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
+    iniciarEscalonador(escalonador, numeroThreadsSimulacao());
+    auto inicio = chrono::steady_clock::now();
+    construirGrafoAbstrato(grafoAbstrato);
+    double msGrafo = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+    size_t nArestas = 0;
+    for (auto &a : grafoAbstrato.arestas) nArestas += a.size();
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)0);
-    glEnableVertexAttribArray(0);
+    cout << "Mapa " << lado << "x" << lado << ", " << bloqueadas * 100 / nCelulas << "% bloqueado, "
+         << componente.size() << " células na componente usada" << endl;
+    cout << "  grafo abstrato: " << grafoAbstrato.celula.size() << " nós, " << nArestas << " arestas, montado em "
+         << msGrafo << " ms (" << numeroThreadsSimulacao() << " thread(s))" << endl;
 
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)(3 * sizeof(GLfloat)));
-    glEnableVertexAttribArray(1);
+    vector<ivec2> caminho;
+    vector<float> otimo(nPares);
+    auto relatar = [&](const char *nome, int n, double total, double pior, size_t expandidos, const string &extra) {
+        cout << "  " << nome << total / n << " ms/busca (pior " << pior << " ms), ";
+        if (expandidos) cout << expandidos / n << " nós expandidos, ";
+        cout << n << " pares" << extra << endl;
+    };
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    // JPS em todos os pares: dá o custo ótimo de referência
+    double total = 0, pior = 0;
+    size_t expandidos = 0, invalidos = 0;
+    for (int i = 0; i < nPares; i++) {
+        caminho.clear();
+        inicio = chrono::steady_clock::now();
+        otimo[i] = buscarJPS(inicios[i], fins[i], poolBusca, &caminho);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+        total += ms;
+        pior = glm::max(pior, ms);
+        expandidos += poolBusca.expandidos;
+        if (custoCaminho(caminho, inicios[i], fins[i]) < 0) invalidos++;
+    }
+    relatar("JPS:                     ", nPares, total, pior, expandidos,
+            invalidos ? "  *** " + to_string(invalidos) + " CAMINHOS INVÁLIDOS ***" : "");
 
-    return VAO;
+    // A*: uma fração dos pares (é o mais lento); o custo tem que bater com a JPS
+    int nAEstrela = glm::min(nPares, 20);
+    total = pior = 0;
+    expandidos = 0;
+    size_t divergentes = 0;
+    for (int i = 0; i < nAEstrela; i++) {
+        inicio = chrono::steady_clock::now();
+        float custo = buscarAEstrela(inicios[i], fins[i], janelaMapa(), poolBusca, nullptr);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+        total += ms;
+        pior = glm::max(pior, ms);
+        expandidos += poolBusca.expandidos;
+        if (glm::abs(custo - otimo[i]) > 1e-4f * otimo[i]) divergentes++;
+    }
+    relatar("A*:                      ", nAEstrela, total, pior, expandidos,
+            divergentes ? "  *** " + to_string(divergentes) + " CUSTOS DIVERGEM DA JPS ***" : "");
+
+    // Hierárquica: só o grafo abstrato (custo aproximado) e com o caminho refinado
+    total = pior = 0;
+    expandidos = 0;
+    for (int i = 0; i < nPares; i++) {
+        inicio = chrono::steady_clock::now();
+        buscarHierarquico(inicios[i], fins[i], nullptr);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+        total += ms;
+        pior = glm::max(pior, ms);
+        expandidos += grafoAbstrato.pool.expandidos;
+    }
+    relatar("hierárquica (abstrata): ", nPares, total, pior, expandidos, "");
+
+    total = pior = 0;
+    invalidos = 0;
+    int falhas = 0;
+    double excesso = 0, piorExcesso = 0;
+    for (int i = 0; i < nPares; i++) {
+        caminho.clear();
+        inicio = chrono::steady_clock::now();
+        float custo = buscarHierarquico(inicios[i], fins[i], &caminho);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+        total += ms;
+        pior = glm::max(pior, ms);
+        if (custo < 0) { falhas++; continue; }
+        if (custoCaminho(caminho, inicios[i], fins[i]) < 0) invalidos++;
+        double e = custo / otimo[i] - 1.0;
+        excesso += e;
+        piorExcesso = glm::max(piorExcesso, e);
+    }
+    ostringstream extra;
+    extra.precision(3);
+    extra << ", custo " << 100 * excesso / glm::max(nPares - falhas, 1) << "% acima do ótimo (pior " << 100 * piorExcesso << "%)";
+    if (falhas) extra << ", " << falhas << " sem caminho abstrato (caem na JPS)";
+    if (invalidos) extra << "  *** " << invalidos << " CAMINHOS INVÁLIDOS ***";
+    relatar("hierárquica (refinada): ", nPares, total, pior, 0, extra.str());
+    // Meta do clique para mover: menos de 1 ms por busca longa com o caminho
+    // refinado. A montagem do grafo fica de fora: ela é refeita no primeiro
+    // clique depois de cada mudança de caminhabilidade.
+    cout << "  meta < 1 ms com o caminho refinado: " << (total / nPares < 1.0 ? "atingida" : "NÃO atingida")
+         << " (" << total / nPares << " ms/busca; montagem do grafo à parte: " << msGrafo << " ms)" << endl;
+    encerrarEscalonador(escalonador);
 }
 
-int setupTile(int nTiles, float &ds, float &dt)
+// Campo de fluxo num mapa 2048x2048 com obstáculos (o de --bench-caminhos) e
+// a bandeira no canto: montagem completa com 1, 2, 4... threads, atualização
+// incremental ao fechar e reabrir paredes e o tick de 1k até maxAtores atores
+// seguindo o campo. Uso: trabalhogb --bench-fluxo [maxAtores] [threads]
+void benchmarkFluxo(size_t maxAtores, int maxThreads)
 {
-    ds = 1.0 / (float) nTiles;
-    dt = 1.0;
-    float th = 1.0, tw = 1.0;
+    const int lado = 2048;
+    if (maxThreads <= 0) maxThreads = glm::max((int) thread::hardware_concurrency(), 1);
+    mt19937 rng(99);
+    gerarMapaObstaculos(lado, rng);
+    ivec2 objetivo(lado - 1, lado - 2); // Célula da bandeira (iniciarSimulacao)
+    mapa.tiles[indiceTile(objetivo.x, objetivo.y)] = 0;
+    reconstruirCaminhabilidade();
+    size_t nChunks = (size_t) mapa.chunksX * mapa.chunksY;
+    cout << "Campo de fluxo num mapa " << lado << "x" << lado << " (" << nChunks << " chunks)" << endl;
 
-    GLfloat vertices[] = {
-        // x   y    z    s     t
-        0.0,  th/2.0f,   0.0, 0.0,    dt/2.0f, //A
-        tw/2.0f, th,     0.0, ds/2.0f, dt,     //B
-        tw/2.0f, 0.0,    0.0, ds/2.0f, 0.0,    //D
-        tw,     th/2.0f, 0.0, ds,     dt/2.0f  //C
-        };
+    // Montagem completa: o campo não pode depender do número de threads
+    uint64_t hashReferencia = 0;
+    for (int nThreads = 1; ; nThreads = glm::min(nThreads * 2, maxThreads)) {
+        iniciarEscalonador(escalonador, nThreads);
+        auto inicio = chrono::steady_clock::now();
+        construirCampoFluxo(campoFluxo, objetivo);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+        encerrarEscalonador(escalonador);
+        uint64_t h = misturarHash(HASH_INICIAL, campoFluxo.custo.data(), campoFluxo.custo.size() * sizeof(float));
+        h = misturarHash(h, campoFluxo.direcao.data(), campoFluxo.direcao.size());
+        if (nThreads == 1) hashReferencia = h;
+        cout << "  montagem, " << nThreads << " thread(s): " << ms << " ms (" << campoFluxo.chunksRelaxados
+             << " relaxamentos de chunk)" << (h == hashReferencia ? "" : "  *** CAMPO DIVERGE ***") << endl;
+        if (nThreads >= maxThreads) break;
+    }
 
-    GLuint VBO, VAO;
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    // Incremental: fecha uma parede de 12 tiles, atualiza, reabre e atualiza de novo
+    iniciarEscalonador(escalonador, maxThreads);
+    const int nParedes = 50;
+    double msFechar = 0, msAbrir = 0;
+    size_t chunksFechar = 0, chunksAbrir = 0;
+    vector<ivec2> parede;
+    for (int p = 0; p < nParedes; p++) {
+        int x0 = rng() % (lado - 12), y0 = rng() % lado;
+        parede.clear();
+        for (int x = x0; x < x0 + 12; x++)
+            if (celulaCaminhavel(x, y0) && ivec2(x, y0) != objetivo) parede.push_back(ivec2(x, y0));
+        for (ivec2 c : parede) alterarTile(c.x, c.y, 1);
+        auto inicio = chrono::steady_clock::now();
+        atualizarCampoFluxo(campoFluxo);
+        msFechar += chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+        chunksFechar += campoFluxo.chunksRelaxados;
+        for (ivec2 c : parede) alterarTile(c.x, c.y, 0);
+        inicio = chrono::steady_clock::now();
+        atualizarCampoFluxo(campoFluxo);
+        msAbrir += chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+        chunksAbrir += campoFluxo.chunksRelaxados;
+    }
+    // Depois de fechar e reabrir tudo, o campo tem que voltar ao de uma montagem do zero
+    vector<float> custoIncremental = campoFluxo.custo;
+    construirCampoFluxo(campoFluxo, objetivo);
+    size_t divergentes = 0;
+    for (size_t i = 0; i < custoIncremental.size(); i++)
+        if (custoIncremental[i] != campoFluxo.custo[i] &&
+            !(glm::abs(custoIncremental[i] - campoFluxo.custo[i]) <= 1e-4f * campoFluxo.custo[i])) divergentes++;
+    cout << "  incremental (" << nParedes << " paredes): fechar " << msFechar / nParedes << " ms ("
+         << chunksFechar / nParedes << " relaxamentos), reabrir " << msAbrir / nParedes << " ms ("
+         << chunksAbrir / nParedes << " relaxamentos)"
+         << (divergentes ? "  *** " + to_string(divergentes) + " CÉLULAS DIVERGEM DA MONTAGEM COMPLETA ***" : "") << endl;
 
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
+    // Atores: cada um só lê a direção da própria célula a cada troca de tile
+    multidao = true;
+    for (size_t n = 1000; n <= maxAtores; n *= 10) {
+        iniciarSimulacao(0, (int) n);
+        const int ticks = 120;
+        double total = 0, pior = 0;
+        for (int t = 0; t < ticks; t++) {
+            auto inicio = chrono::steady_clock::now();
+            atualizarEntidades((float) PASSO_SIMULACAO);
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+            total += ms;
+            pior = glm::max(pior, ms);
+        }
+        size_t comCaminho = 0;
+        for (size_t i = entidades.inicioAtores; i < entidades.n; i++)
+            comCaminho += campoFluxo.custo[indiceTile(entidades.celula[i].x, entidades.celula[i].y)] < INFINITY;
+        cout << "  " << n << " atores: " << total / ticks << " ms/tick (pior " << pior << " ms, "
+             << total / ticks * 1e6 / n << " ns/ator), " << comCaminho * 100 / n << "% com caminho até a bandeira" << endl;
+    }
+    multidao = false;
+    encerrarEscalonador(escalonador);
+}
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)0);
-    glEnableVertexAttribArray(0);
+// Custo de uma chamada de log na thread que registra, com o escritor gravando
+// os registros em arquivo, em 1 e em 4 threads; para comparar, a saída antiga
+// (texto com endl a cada evento) num arquivo. Os eventos saem em rajadas de
+// 4096 com uma pausa entre elas (fora da medida) para o escritor alcançar.
+void benchmarkLog(size_t nChamadas)
+{
+    const string arquivoBin = "bench_log.bin", arquivoTexto = "bench_log.txt";
+    if (!iniciarLog(logEventos, false, arquivoBin)) return;
+    cout << nChamadas << " eventos por thread" << endl;
+    for (int nThreads : { 1, 4 }) {
+        uint64_t descartadosAntes = 0;
+        for (auto &anel : logEventos.aneis) descartadosAntes += anel->descartados.load();
+        vector<double> ns(nThreads);
+        vector<thread> threads;
+        for (int t = 0; t < nThreads; t++)
+            threads.emplace_back([&, t]() {
+                double total = 0;
+                for (size_t i = 0; i < nChamadas; ) {
+                    size_t fim = glm::min(i + 4096, nChamadas);
+                    auto inicio = chrono::steady_clock::now();
+                    for (; i < fim; i++)
+                        LOG_EVENTO(LOG_INFO, EVENTO_MOVIMENTO, (int32_t)(i & 1023), (int32_t)(i >> 10));
+                    total += chrono::duration<double, nano>(chrono::steady_clock::now() - inicio).count();
+                    this_thread::sleep_for(chrono::microseconds(500));
+                }
+                ns[t] = total / nChamadas;
+            });
+        for (thread &t : threads) t.join();
+        this_thread::sleep_for(chrono::milliseconds(20)); // O escritor alcança os anéis
+        uint64_t descartados = 0;
+        for (auto &anel : logEventos.aneis) descartados += anel->descartados.load();
+        double media = 0;
+        for (double v : ns) media += v / nThreads;
+        cout << "  anel, " << nThreads << " thread(s): " << media << " ns/evento, "
+             << descartados - descartadosAntes << " descartados" << endl;
+    }
+    encerrarLog(logEventos);
+    remove(arquivoBin.c_str());
 
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)(3 * sizeof(GLfloat)));
-    glEnableVertexAttribArray(1);
+    size_t nTexto = glm::max(nChamadas / 10, (size_t) 1);
+    ofstream texto(arquivoTexto);
+    auto inicio = chrono::steady_clock::now();
+    for (size_t i = 0; i < nTexto; i++) texto << "(" << (i & 1023) << "," << (i >> 10) << ")" << endl;
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - inicio).count() / nTexto;
+    texto.close();
+    remove(arquivoTexto.c_str());
+    cout << "  texto com endl: " << ns << " ns/evento (" << nTexto << " eventos)" << endl;
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+#ifdef COM_EGL
+// Contexto GL 4.x sem janela: EGL sem superfície (Mesa, inclusive llvmpipe em
+// máquinas sem GPU) e um framebuffer largura x altura no lugar da tela
+bool criarContextoOffscreen(int largura, int altura)
+{
+    auto obterDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLDisplay display = obterDisplay ? obterDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL)
+                                      : eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    EGLint maior, menor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &maior, &menor)) {
+        cerr << "Falha ao inicializar o EGL" << endl;
+        return false;
+    }
+    eglBindAPI(EGL_OPENGL_API);
+    EGLint atributosConfig[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLConfig config;
+    EGLint nConfigs = 0;
+    eglChooseConfig(display, atributosConfig, &config, 1, &nConfigs);
+    EGLint atributosContexto[] = { EGL_CONTEXT_MAJOR_VERSION, 4, EGL_CONTEXT_MINOR_VERSION, 0,
+                                   EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE };
+    EGLContext contexto = eglCreateContext(display, nConfigs ? config : EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, atributosContexto);
+    if (contexto == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, contexto)) {
+        cerr << "Falha ao criar o contexto EGL (erro 0x" << hex << eglGetError() << dec << ")" << endl;
+        return false;
+    }
+    if (!gladLoadGLLoader((GLADloadproc) eglGetProcAddress)) {
+        cerr << "Falha ao inicializar GLAD" << endl;
+        return false;
+    }
 
-    return VAO;
+    RecursoGPU fbo = criarRecursoGPU(GPU_FRAMEBUFFER, CATEGORIA_ALVOS);
+    RecursoGPU rbCor = criarRecursoGPU(GPU_RENDERBUFFER, CATEGORIA_ALVOS);
+    RecursoGPU rbProfundidade = criarRecursoGPU(GPU_RENDERBUFFER, CATEGORIA_ALVOS);
+    ligarFramebuffer(fbo.id());
+    glBindRenderbuffer(GL_RENDERBUFFER, rbCor.id());
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, largura, altura);
+    definirBytesRecurso(rbCor, (size_t) largura * altura * 4);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rbCor.id());
+    glBindRenderbuffer(GL_RENDERBUFFER, rbProfundidade.id());
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, largura, altura);
+    definirBytesRecurso(rbProfundidade, (size_t) largura * altura * 4);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rbProfundidade.id());
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        cerr << "Framebuffer offscreen incompleto" << endl;
+        return false;
+    }
+    framebufferTela = fbo.id();
+    alvoOffscreen = { fbo, rbCor, rbProfundidade };
+    glViewport(0, 0, largura, altura);
+    return true;
 }
+#endif
 
-int loadTexture(string filePath, int &width, int &height)
+// Lê um JSON plano ({"chave": valor, ...}) como o gravado por benchmarkRender;
+// só os valores numéricos entram em 'valores'
+bool lerJsonPlano(const string& filename, vector<pair<string, double>> &valores)
 {
-    GLuint texID;
-    glGenTextures(1, &texID);
-    glBindTexture(GL_TEXTURE_2D, texID);
+    ifstream file(filename);
+    if (!file.is_open()) {
+        cerr << "Erro ao abrir " << filename << endl;
+        return false;
+    }
+    stringstream conteudo;
+    conteudo << file.rdbuf();
+    string s = conteudo.str();
+    for (size_t i = s.find('"'); i != string::npos; i = s.find('"', i)) {
+        size_t fim = s.find('"', i + 1);
+        if (fim == string::npos) break;
+        string chave = s.substr(i + 1, fim - i - 1);
+        size_t p = s.find_first_not_of(" \t\r\n", fim + 1);
+        if (p == string::npos) break;
+        if (s[p] != ':') { i = fim + 1; continue; } // Era um valor de texto
+        p = s.find_first_not_of(" \t\r\n", p + 1);
+        if (p == string::npos) break;
+        if (s[p] == '"') { i = s.find('"', p + 1) + 1; if (i == 0) break; continue; }
+        char *depois;
+        double v = strtod(s.c_str() + p, &depois);
+        if (depois != s.c_str() + p) valores.push_back({ chave, v });
+        i = p;
+    }
+    return true;
+}
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+// Mapa sintético com o tileset do jogo: ~10% de tiles bloqueados (3, 4 e 6),
+// gravado em texto e lido de volta por loadMapConfig (msCarga mede a leitura).
+// Com 'manterArquivo', bench_render.txt fica no disco para quem chamou.
+bool carregarMapaSintetico(int lado, mt19937 &rng, double &msCarga, bool manterArquivo = false)
+{
+    const string arquivoMapa = "bench_render.txt";
+    tilesetFile = "tilesetIso.png"; nTiles = 7; tileW = 57; tileH = 114;
+    alocarMapa(lado, lado);
+    const uint16_t livres[] = { 0, 1, 2, 5 }, bloqueados[] = { 3, 4, 6 };
+    for (int y = 0; y < lado; y++)
+        for (int x = 0; x < lado; x++)
+            mapa.tiles[indiceTile(x, y)] = (rng() % 10 || (x < 2 && y < 2)) ? livres[rng() % 4] : bloqueados[rng() % 3];
+    if (!salvarMapaTexto(arquivoMapa)) return false;
+    auto inicio = chrono::steady_clock::now();
+    bool carregou = loadMapConfig(arquivoMapa);
+    msCarga = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+    if (!manterArquivo) remove(arquivoMapa.c_str());
+    return carregou;
+}
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+// Renderiza sem janela um mapa e entidades sintéticos pelas mesmas funções do
+// jogo e grava em JSON os percentis do tempo de frame (CPU até o glFinish), as
+// chamadas de desenho, a carga do mapa e o pico de memória. Com --baseline,
+// compara com um resultado anterior e retorna 1 se algo piorou além da
+// tolerância. Uso: trabalhogb --bench-render [--lado N] [--moedas N] [--atores N]
+//     [--frames N] [--saida arquivo.json] [--baseline arquivo.json] [--tolerancia %]
+int benchmarkRender(int argc, char **argv)
+{
+#ifndef COM_EGL
+    cerr << "--bench-render precisa de EGL (indisponível nesta compilação)" << endl;
+    return -1;
+#else
+    int lado = 512, moedas = 2000, atores = 2000, frames = 600;
+    string arquivoSaida = "bench_render.json", arquivoBaseline;
+    double tolerancia = 10.0;
+    for (int a = 2; a < argc; a++) {
+        string arg = argv[a];
+        if (arg == "--lado" && a + 1 < argc) lado = glm::max(atoi(argv[++a]), 2);
+        else if (arg == "--moedas" && a + 1 < argc) moedas = atoi(argv[++a]);
+        else if (arg == "--atores" && a + 1 < argc) atores = atoi(argv[++a]);
+        else if (arg == "--frames" && a + 1 < argc) frames = glm::max(atoi(argv[++a]), 1);
+        else if (arg == "--saida" && a + 1 < argc) arquivoSaida = argv[++a];
+        else if (arg == "--baseline" && a + 1 < argc) arquivoBaseline = argv[++a];
+        else if (arg == "--tolerancia" && a + 1 < argc) tolerancia = atof(argv[++a]);
+    }
+    const int LARGURA = 800, ALTURA = 600; // Como a janela do jogo
+    if (!criarContextoOffscreen(LARGURA, ALTURA)) return -1;
+    string renderer = (const char *) glGetString(GL_RENDERER);
+    logSimulacao = false;
 
-    int nrChannels;
+    mt19937 rng(7);
+    double msCarga;
+    if (!carregarMapaSintetico(lado, rng, msCarga)) return -1;
 
-    unsigned char *data = stbi_load(filePath.c_str(), &width, &height, &nrChannels, 0);
+    // Cena completa; as texturas precisam estar no atlas antes de medir
+    auto inicio = chrono::steady_clock::now();
+    GLuint shaderID = iniciarCena(moedas, atores, 0, vec2(LARGURA, ALTURA));
+    while (pipelineTexturas.ativo) {
+        atualizarPipelineTexturas(1000.0);
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    glFinish();
+    double msPreparo = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
 
-    if (data)
-    {
-        if (nrChannels == 3) // jpg, bmp
-        {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        }
-        else // png
-        {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+    // O personagem caminha (clique para mover) até alvos sorteados, um passo
+    // de simulação por frame, para a câmera percorrer o mapa
+    const int framesAquecimento = 30;
+    vector<double> msFrames;
+    msFrames.reserve(frames);
+    double drawCalls = 0, trocasEstado = 0, trocasEvitadas = 0, uploadsUniform = 0;
+    for (int f = 0; f < framesAquecimento + frames; f++) {
+        while (passoCaminho >= caminhoAtual.size()) {
+            ivec2 alvo(rng() % lado, rng() % lado);
+            if (celulaCaminhavel(alvo.x, alvo.y) && encontrarCaminho(ivec2((int) pos.x, (int) pos.y), alvo, caminhoAtual)) {
+                passoCaminho = 1;
+                ticksAtePasso = 0;
+            }
         }
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else
-    {
-        std::cout << "Failed to load texture" << std::endl;
+        auto inicioFrame = chrono::steady_clock::now();
+        passoSimulacao((float) PASSO_SIMULACAO);
+        desenharCena(shaderID, 1.0f, f * PASSO_SIMULACAO);
+        glFinish(); // Sem troca de buffers: espera a GPU terminar o frame
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - inicioFrame).count();
+        if (f < framesAquecimento) continue;
+        msFrames.push_back(ms);
+        drawCalls += estatisticas.drawCalls;
+        trocasEstado += estatisticas.trocasEstado;
+        trocasEvitadas += estatisticas.trocasEvitadas;
+        uploadsUniform += estatisticas.uploadsUniform;
     }
+    encerrarCena();
+    encerrarRecursos();
 
-    stbi_image_free(data);
+    double media = 0;
+    for (double ms : msFrames) media += ms;
+    media /= frames;
+    sort(msFrames.begin(), msFrames.end());
+    auto percentil = [&](double q) { return msFrames[(size_t)(q * (frames - 1) + 0.5)]; };
+    struct rusage uso;
+    getrusage(RUSAGE_SELF, &uso);
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+    // Configuração, depois as métricas; as marcadas entram na comparação com o
+    // baseline (o máximo, o preparo, que depende do cache do atlas, e as trocas evitadas,
+    // em que mais é melhor, são só informativos)
+    struct Metrica {
+        string chave;
+        double valor;
+        bool comparar;
+    };
+    vector<Metrica> resultado = {
+        { "lado", (double) lado, false }, { "moedas", (double) moedas, false },
+        { "atores", (double) atores, false }, { "frames", (double) frames, false },
+        { "carga_mapa_ms", msCarga, true }, { "preparo_cena_ms", msPreparo, false },
+        { "frame_ms_media", media, true }, { "frame_ms_p50", percentil(0.50), true },
+        { "frame_ms_p90", percentil(0.90), true }, { "frame_ms_p99", percentil(0.99), true },
+        { "frame_ms_max", msFrames.back(), false }, { "draw_calls", drawCalls / frames, true },
+        { "trocas_estado", trocasEstado / frames, true }, { "trocas_evitadas", trocasEvitadas / frames, false },
+        { "uploads_uniform", uploadsUniform / frames, true },
+        { "memoria_pico_kb", (double) uso.ru_maxrss, true }
+    };
+    ofstream saida(arquivoSaida);
+    saida.setf(ios::fixed);
+    saida.precision(3);
+    saida << "{\n  \"renderer\": \"" << renderer << "\"";
+    for (auto &r : resultado) saida << ",\n  \"" << r.chave << "\": " << r.valor;
+    saida << "\n}\n";
+    if (!saida) {
+        cerr << "Erro ao gravar " << arquivoSaida << endl;
+        return -1;
+    }
+    cout << "Mapa " << lado << "x" << lado << ", " << moedas << " moedas, " << atores << " atores, " << frames
+         << " frames (" << renderer << ")" << endl;
+    cout << "  frame: media " << media << " ms, p50 " << percentil(0.50) << ", p90 " << percentil(0.90)
+         << ", p99 " << percentil(0.99) << ", max " << msFrames.back() << endl;
+    cout << "  draw calls/frame: " << drawCalls / frames << ", carga do mapa: " << msCarga
+         << " ms, pico de memória: " << uso.ru_maxrss / 1024 << " MB" << endl;
+    cout << "Resultado salvo em " << arquivoSaida << endl;
+    if (arquivoBaseline.empty()) return 0;
 
-    return texID;
+    // Comparação: a configuração precisa ser a mesma; nas métricas, menor é melhor
+    vector<pair<string, double>> base;
+    if (!lerJsonPlano(arquivoBaseline, base)) return -1;
+    auto valorBase = [&](const string &chave, double &v) {
+        for (auto &b : base)
+            if (b.first == chave) { v = b.second; return true; }
+        return false;
+    };
+    for (int k = 0; k < 4; k++) {
+        double v;
+        if (!valorBase(resultado[k].chave, v) || v != resultado[k].valor) {
+            cerr << "Baseline " << arquivoBaseline << " tem outra configuração (" << resultado[k].chave << ")" << endl;
+            return -1;
+        }
+    }
+    int regressoes = 0;
+    cout << "Comparação com " << arquivoBaseline << " (tolerância " << tolerancia << "%):" << endl;
+    for (const Metrica &m : resultado) {
+        double v;
+        if (!m.comparar || !valorBase(m.chave, v)) continue;
+        double variacao = v > 0 ? (m.valor / v - 1.0) * 100.0 : 0.0;
+        bool piorou = variacao > tolerancia;
+        regressoes += piorou;
+        cout << "  " << m.chave << ": " << v << " -> " << m.valor
+             << " (" << (variacao >= 0 ? "+" : "") << variacao << "%)" << (piorou ? "  *** REGRESSÃO ***" : "") << endl;
+    }
+    cout << (regressoes ? to_string(regressoes) + " regressão(ões)" : string("Sem regressões")) << endl;
+    return regressoes ? 1 : 0;
+#endif
 }
 
-void desenharMapa(GLuint shaderID)
+// Ordem de desenho dos sprites: desenha a mesma cena com a ordem do depth
+// buffer e com a ordem de pintor na CPU (referência) e compara as imagens;
+// depois mede as duas ordens num lote grande. Retorna 1 se as imagens
+// diferem. Uso: trabalhogb --bench-ordem [--lado N] [--atores N] [--sprites N]
+int benchmarkOrdem(int argc, char **argv)
 {
-    float x0 = 340;
-    float y0 = 100;
-
-    for(int i=0; i<tilemapHeight; i++)
-    {
-        for (int j=0; j < tilemapWidth; j++)
-        {
-            mat4 model = mat4(1);
-            Tile curr_tile = tileset[mapConfig[i][j]];
+#ifndef COM_EGL
+    cerr << "--bench-ordem precisa de EGL (indisponível nesta compilação)" << endl;
+    return -1;
+#else
+    int lado = 64, atores = 3000, nSprites = 100000;
+    for (int a = 2; a < argc; a++) {
+        string arg = argv[a];
+        if (arg == "--lado" && a + 1 < argc) lado = glm::max(atoi(argv[++a]), 8);
+        else if (arg == "--atores" && a + 1 < argc) atores = atoi(argv[++a]);
+        else if (arg == "--sprites" && a + 1 < argc) nSprites = glm::max(atoi(argv[++a]), 1);
+    }
+    const int LARGURA = 800, ALTURA = 600;
+    if (!criarContextoOffscreen(LARGURA, ALTURA)) return -1;
+    logSimulacao = false;
+    mt19937 rng(11);
+    double msCarga;
+    if (!carregarMapaSintetico(lado, rng, msCarga)) return -1;
+    GLuint shaderID = iniciarCena(lado * lado / 8, atores, 0, vec2(LARGURA, ALTURA));
+    while (pipelineTexturas.ativo) {
+        atualizarPipelineTexturas(1000.0);
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
 
-            float x = x0 + (j-i) * curr_tile.dimensions.x/2.0;
-            float y = y0 + (j+i) * curr_tile.dimensions.y/2.0;
+    // Personagem e câmera no meio do mapa; alguns passos para os atores
+    // saírem das células iniciais e ficarem entre dois tiles
+    pos = posAnterior = vec2(lado / 2, lado / 2);
+    for (int i = 0; i < 45; i++) passoSimulacao((float) PASSO_SIMULACAO);
+    atualizarCamera(-1.0f);
 
-            model = translate(model, vec3(x,y,0.0));
-            model = scale(model,curr_tile.dimensions);
-            glUniformMatrix4fv(glGetUniformLocation(shaderID, "model"), 1, GL_FALSE, value_ptr(model));
+    // Imagem de cada ordem e o tempo do frame inteiro (CPU até o glFinish),
+    // que é o que a ordem muda de fato
+    const int framesCena = 30;
+    vector<uint8_t> imagens[2];
+    double msFrame[2];
+    for (int cpu = 0; cpu < 2; cpu++) {
+        ordemNaCpu = cpu;
+        loteMoedas.sujo = true;
+        desenharCena(shaderID, 1.0f, 0.0);
+        imagens[cpu].resize((size_t) LARGURA * ALTURA * 4);
+        glReadPixels(0, 0, LARGURA, ALTURA, GL_RGBA, GL_UNSIGNED_BYTE, imagens[cpu].data());
+        vector<double> ms;
+        for (int f = 0; f < framesCena; f++) {
+            auto t0 = chrono::steady_clock::now();
+            desenharCena(shaderID, 1.0f, 0.0);
+            glFinish();
+            ms.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count());
+        }
+        sort(ms.begin(), ms.end());
+        msFrame[cpu] = ms[framesCena / 2];
+    }
+    size_t diferentes = 0;
+    for (size_t p = 0; p < imagens[0].size(); p += 4)
+        diferentes += memcmp(&imagens[0][p], &imagens[1][p], 4) != 0;
+    cout << "Cena " << lado << "x" << lado << " com " << entidades.n << " entidades: " << diferentes
+         << " de " << LARGURA * ALTURA << " pixels diferem entre depth buffer e ordem de pintor" << endl;
+    cout << "  frame inteiro (mediana de " << framesCena << "): depth buffer " << msFrame[0] << " ms, ordem de pintor "
+         << msFrame[1] << " ms" << endl;
 
-            vec2 offsetTex;
-            offsetTex.s = curr_tile.iTile * curr_tile.ds;
-            offsetTex.t = 0.0;
-            glUniform2f(glGetUniformLocation(shaderID, "offsetTex"),offsetTex.s, offsetTex.t);
+    // Lote grande com sprites sorteados pela área visível, já agrupados por
+    // camada como no jogo. Tempos: chaves de profundidade, ordenação de pintor
+    // e o lote inteiro (CPU até o glFinish) em cada ordem
+    const AparenciaEntidade &ap = aparencias[ENTIDADE_ATOR];
+    AnimacaoSprite animacao = { 0.0f, ap.nFrames, ap.fps, 0 };
+    vector<vec2> celulas(nSprites);
+    for (vec2 &c : celulas)
+        c = pos + vec2((float)(rng() % 1600) / 100.0f - 8.0f, (float)(rng() % 1600) / 100.0f - 8.0f);
+    vector<float> chaves(nSprites);
+    auto inicio = chrono::steady_clock::now();
+    for (int i = 0; i < nSprites; i++) chaves[i] = profundidadeIsometrica(celulas[i]);
+    double msChaves = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+    auto encherLote = [&]() {
+        for (int i = 0; i < nSprites; i++) {
+            vec2 c = celulas[i];
+            vec3 p(400 + (c.x - c.y) * tileH / 2.0f, 130 + (c.x + c.y) * tileW / 2.0f, chaves[i]);
+            adicionarSprite(loteSprites, 1, ap.texID, p, vec3(ap.dimensoes, 1.0), ap.uvBase, ap.duv.x, ap.duv.y, animacao);
+        }
+    };
+    ordemNaCpu = true;
+    encherLote();
+    vector<ItemSprite> copia = loteSprites.itens;
+    inicio = chrono::steady_clock::now();
+    stable_sort(copia.begin(), copia.end(), [](const ItemSprite &a, const ItemSprite &b) { return a.profundidade < b.profundidade; });
+    double msOrdenacao = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+    loteSprites.itens.clear();
 
-            glBindVertexArray(curr_tile.VAO);
-            glBindTexture(GL_TEXTURE_2D, curr_tile.texID);
-            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    const int repeticoes = 5;
+    double msLote[2];
+    for (int cpu = 0; cpu < 2; cpu++) {
+        ordemNaCpu = cpu;
+        funcaoProfundidade(cpu ? GL_ALWAYS : GL_LEQUAL);
+        vector<double> ms;
+        for (int r = 0; r < repeticoes; r++) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            encherLote();
+            glFinish();
+            inicio = chrono::steady_clock::now();
+            desenharSpriteBatch(loteSprites);
+            glFinish();
+            ms.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count());
         }
+        sort(ms.begin(), ms.end());
+        msLote[cpu] = ms[repeticoes / 2];
     }
+    ordemNaCpu = false;
+    funcaoProfundidade(GL_ALWAYS);
+    encerrarCena();
+    encerrarRecursos();
+
+    cout << nSprites << " sprites: chaves de profundidade " << msChaves << " ms, ordenação de pintor "
+         << msOrdenacao << " ms" << endl;
+    cout << "  lote (mediana de " << repeticoes << "): depth buffer " << msLote[0] << " ms, ordem de pintor "
+         << msLote[1] << " ms" << endl;
+    return diferentes ? 1 : 0;
+#endif
 }
 
-void desenharPersonagem(GLuint shaderID)
+// Objetos e bytes por categoria, sem os que a cena deixa de propósito para as
+// próximas cargas: programas, bloco Quadro, EBO dos quads e pool de geometria
+vector<size_t> recursosForaDaCena()
 {
-    float x0 = 400; // Posição inicial do personagem no eixo x necessária para centralizar
-    float y0 = 130;
+    vector<size_t> contagem;
+    for (int k = 0; k < N_CATEGORIAS_GPU; k++) {
+        contagem.push_back(recursosGPU.objetos[k]);
+        contagem.push_back(recursosGPU.bytes[k]);
+    }
+    auto descontar = [&](const RecursoGPU &r) {
+        if (!r) return;
+        const EntradaRecursoGPU &e = recursosGPU.entradas[r.indice];
+        contagem[2 * e.categoria]--;
+        contagem[2 * e.categoria + 1] -= e.bytes;
+    };
+    for (const ProgramaCompilado &p : recursosGPU.programas) descontar(p.programa);
+    descontar(uboQuadro);
+    descontar(recursosGPU.indicesQuads);
+    descontar(recursosGPU.poolVertices);
+    return contagem;
+}
+
+// Carrega e descarrega a cena várias vezes sem janela, desenhando alguns
+// frames em cada carga, e confere que depois de cada descarga só sobram os
+// objetos que ficam de propósito (recursosForaDaCena volta ao que era antes da
+// primeira carga). Retorna 1 se algo ficou para trás.
+// Uso: trabalhogb --bench-recargas [--cargas N] [--lado N] [--frames N]
+int benchmarkRecargas(int argc, char **argv)
+{
+#ifndef COM_EGL
+    cerr << "--bench-recargas precisa de EGL (indisponível nesta compilação)" << endl;
+    return -1;
+#else
+    int cargas = 20, lado = 128, frames = 30;
+    for (int a = 2; a < argc; a++) {
+        string arg = argv[a];
+        if (arg == "--cargas" && a + 1 < argc) cargas = glm::max(atoi(argv[++a]), 2);
+        else if (arg == "--lado" && a + 1 < argc) lado = glm::max(atoi(argv[++a]), 8);
+        else if (arg == "--frames" && a + 1 < argc) frames = glm::max(atoi(argv[++a]), 1);
+    }
+    const int LARGURA = 800, ALTURA = 600;
+    if (!criarContextoOffscreen(LARGURA, ALTURA)) return -1;
+    logSimulacao = false;
+    mt19937 rng(5);
+    double msCarga;
+    if (!carregarMapaSintetico(lado, rng, msCarga)) return -1;
+    cout << "Antes da cena: " << resumoRecursosGPU() << endl;
 
-    float x = x0 + (pos.x-pos.y) * personagem.dimensions.x/2.0;
-    float y = y0 + (pos.x+pos.y) * personagem.dimensions.y/2.0;
+    const vector<size_t> base = recursosForaDaCena();
+    size_t bytesCarregadaBase = 0;
+    int sobras = 0;
+    double msTotal = 0;
+    for (int c = 0; c < cargas; c++) {
+        auto inicio = chrono::steady_clock::now();
+        GLuint shaderID = iniciarCena(lado * lado / 16, lado * lado / 32, 0, vec2(LARGURA, ALTURA));
+        while (pipelineTexturas.ativo) {
+            atualizarPipelineTexturas(1000.0);
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        for (int f = 0; f < frames; f++) {
+            passoSimulacao((float) PASSO_SIMULACAO);
+            desenharCena(shaderID, 1.0f, f * PASSO_SIMULACAO);
+        }
+        glFinish();
+        if (c == 0) cout << "Cena carregada: " << resumoRecursosGPU() << endl;
+        size_t bytesCarregada = bytesGPU();
+        encerrarCena();
+        glFinish();
+        msTotal += chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
 
-    mat4 model = mat4(1);
-    model = translate(model, vec3(x,y,0.0));
-    model = scale(model, personagem.dimensions);
-    glUniformMatrix4fv(glGetUniformLocation(shaderID, "model"), 1, GL_FALSE, value_ptr(model));
+        // Contagem por categoria depois da descarga, comparada com a de antes
+        // da primeira carga; a memória com a cena carregada não pode crescer
+        if (c == 0) {
+            bytesCarregadaBase = bytesCarregada;
+            cout << "Cena descarregada: " << resumoRecursosGPU() << endl;
+        }
+        if (recursosForaDaCena() != base || bytesCarregada != bytesCarregadaBase) {
+            sobras++;
+            cout << "  carga " << c + 1 << ": " << bytesCarregada / 1024 << " KB carregada; depois: " << resumoRecursosGPU() << endl;
+        }
+    }
+    cout << cargas << " cargas de um mapa " << lado << "x" << lado << " (" << msTotal / cargas << " ms por carga e descarga): "
+         << (sobras ? to_string(sobras) + " deixaram objetos ou memória para trás" : string("memória de GPU estável"))
+         << endl;
+    encerrarRecursos();
+    return sobras ? 1 : 0;
+#endif
+}
 
-    // Calcula o offset do frame atual
-    vec2 offsetTex;
-    offsetTex.s = personagem.iFrame * personagem.ds;
-    offsetTex.t = personagem.iAnimation * personagem.dt;
-    glUniform2f(glGetUniformLocation(shaderID, "offsetTex"), offsetTex.s, offsetTex.t);
+// Mede a recarga a quente sem janela: grava um mapa sintético em texto, passa
+// a observá-lo e, no meio da sequência de frames, outra thread regrava o
+// arquivo com um tile trocado ao lado do personagem (invertendo a
+// caminhabilidade). Mostra a latência da gravação até a troca chegar ao mapa
+// e o tempo de frame antes e durante a recarga. Retorna 1 se a troca não chegou.
+// Uso: trabalhogb --bench-recarga-quente [--lado N] [--frames N]
+int benchmarkRecargaQuente(int argc, char **argv)
+{
+#ifndef COM_EGL
+    cerr << "--bench-recarga-quente precisa de EGL (indisponível nesta compilação)" << endl;
+    return -1;
+#else
+    int lado = 4096, frames = 240;
+    for (int a = 2; a < argc; a++) {
+        string arg = argv[a];
+        if (arg == "--lado" && a + 1 < argc) lado = glm::max(atoi(argv[++a]), 8);
+        else if (arg == "--frames" && a + 1 < argc) frames = glm::max(atoi(argv[++a]), 8);
+    }
+    const int LARGURA = 800, ALTURA = 600;
+    const string arquivoMapa = "bench_render.txt";
+    if (!criarContextoOffscreen(LARGURA, ALTURA)) return -1;
+    logSimulacao = false;
+    mt19937 rng(11);
+    double msCarga;
+    recargaQuente.guardarTexto = true;
+    if (!carregarMapaSintetico(lado, rng, msCarga, true)) return -1;
+    GLuint shaderID = iniciarCena(0, 0, 0, vec2(LARGURA, ALTURA));
+    while (pipelineTexturas.ativo) {
+        atualizarPipelineTexturas(1000.0);
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    iniciarRecargaQuente(arquivoMapa);
 
-    glBindVertexArray(personagem.VAO);
-    glBindTexture(GL_TEXTURE_2D, personagem.texID);
+    // Versão editada do arquivo: um dígito trocado na célula ao lado do personagem
+    ivec2 alvo(glm::min((int) pos.x + 1, lado - 1), (int) pos.y);
+    bool caminhavelAntes = celulaCaminhavel(alvo.x, alvo.y);
+    int novoTipo = caminhavelAntes ? 3 : 0;
+    string texto;
+    lerTextoArquivo(arquivoMapa, texto);
+    size_t p = 0;
+    for (int l = 0; l < alvo.y + 2; l++) p = texto.find('\n', p) + 1;
+    for (int k = 0; k < alvo.x; k++) p = texto.find(' ', p) + 1;
+    texto[p] = (char)('0' + novoTipo);
 
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    const int frameGravacao = frames / 4;
+    vector<double> msFrames;
+    int frameAplicado = -1;
+    double msLatencia = 0;
+    chrono::steady_clock::time_point inicioGravacao;
+    thread escritor;
+    for (int f = 0; f < frames; f++) {
+        if (f == frameGravacao) {
+            inicioGravacao = chrono::steady_clock::now();
+            escritor = thread([&]() { ofstream(arquivoMapa, ios::binary) << texto; });
+        }
+        auto t0 = chrono::steady_clock::now();
+        passoSimulacao((float) PASSO_SIMULACAO);
+        bool aplicou = atualizarRecargaQuente();
+        desenharCena(shaderID, 1.0f, f * PASSO_SIMULACAO);
+        glFinish();
+        auto t1 = chrono::steady_clock::now();
+        msFrames.push_back(chrono::duration<double, milli>(t1 - t0).count());
+        if (aplicou && frameAplicado < 0) {
+            frameAplicado = f;
+            msLatencia = chrono::duration<double, milli>(t1 - inicioGravacao).count();
+        }
+    }
+    escritor.join();
+    bool chegou = tileEm(alvo.x, alvo.y) == novoTipo && celulaCaminhavel(alvo.x, alvo.y) != caminhavelAntes;
+    double msAplicacao = recargaQuente.msUltimaAplicacao;
+    encerrarRecargaQuente();
+    encerrarCena();
+    encerrarRecursos();
+    remove(arquivoMapa.c_str());
+
+    // Frames antes da gravação x frames da gravação até a troca aparecer
+    auto mediana = [](vector<double> v) { sort(v.begin(), v.end()); return v.empty() ? 0.0 : v[v.size() / 2]; };
+    vector<double> antes(msFrames.begin() + 1, msFrames.begin() + frameGravacao);
+    int fimRecarga = frameAplicado < 0 ? frames : glm::min(frameAplicado + 1, frames);
+    vector<double> durante(msFrames.begin() + frameGravacao, msFrames.begin() + fimRecarga);
+    cout << "Mapa " << lado << "x" << lado << ", tile (" << alvo.x << ", " << alvo.y << ") trocado para " << novoTipo
+         << " no frame " << frameGravacao << endl;
+    if (!chegou) {
+        cout << "  a troca não chegou ao mapa" << endl;
+        return 1;
+    }
+    cout << "  aplicada no frame " << frameAplicado << ", " << msLatencia << " ms depois de começar a gravação ("
+         << msAplicacao << " ms na thread principal)" << endl;
+    cout << "  frame: mediana antes " << mediana(antes) << " ms; durante a recarga mediana " << mediana(durante)
+         << " ms, pior " << *max_element(durante.begin(), durante.end()) << " ms" << endl;
+    return 0;
+#endif
 }
 
-void desenharAtualTile(GLuint shaderID)
+// Mede as duas fases do frame (gravação das listas e submissão ao GL) com 1,
+// 2, 4... threads numa cena grande e confere que a imagem não depende do
+// número de threads. O lote das moedas é refeito a cada frame, como se uma
+// fosse coletada por frame. Retorna 1 se alguma imagem diferir.
+// Uso: trabalhogb --bench-gravacao [--lado N] [--moedas N] [--atores N] [--frames N] [--threads N]
+int benchmarkGravacao(int argc, char **argv)
 {
-    Tile curr_tile = tileset[6]; //tile rosa
+#ifndef COM_EGL
+    cerr << "--bench-gravacao precisa de EGL (indisponível nesta compilação)" << endl;
+    return -1;
+#else
+    int lado = 2048, moedas = 500000, atores = 100000, frames = 60;
+    int maxThreads = numeroThreadsSimulacao();
+    for (int a = 2; a < argc; a++) {
+        string arg = argv[a];
+        if (arg == "--lado" && a + 1 < argc) lado = glm::max(atoi(argv[++a]), 8);
+        else if (arg == "--moedas" && a + 1 < argc) moedas = atoi(argv[++a]);
+        else if (arg == "--atores" && a + 1 < argc) atores = atoi(argv[++a]);
+        else if (arg == "--frames" && a + 1 < argc) frames = glm::max(atoi(argv[++a]), 1);
+        else if (arg == "--threads" && a + 1 < argc) maxThreads = glm::max(atoi(argv[++a]), 1);
+    }
+    const int LARGURA = 800, ALTURA = 600;
+    if (!criarContextoOffscreen(LARGURA, ALTURA)) return -1;
+    logSimulacao = false;
+    mt19937 rng(13);
+    double msCarga;
+    if (!carregarMapaSintetico(lado, rng, msCarga)) return -1;
+    GLuint shaderID = iniciarCena(moedas, atores, 0, vec2(LARGURA, ALTURA));
+    while (pipelineTexturas.ativo) {
+        atualizarPipelineTexturas(1000.0);
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    pos = posAnterior = vec2(lado / 2, lado / 2);
+    atualizarCamera(-1.0f);
 
-    float x0 = 340;
-    float y0 = 100;
+    cout << "Cena " << lado << "x" << lado << " com " << entidades.inicioAtores << " moedas e "
+         << entidades.n - entidades.inicioAtores << " atores (por frame: gravação / submissão):" << endl;
+    const int framesAquecimento = 10;
+    vector<uint8_t> referencia, imagem((size_t) LARGURA * ALTURA * 4);
+    int diferentes = 0;
+    for (int n = 1; ; n = glm::min(n * 2, maxThreads)) {
+        encerrarEscalonador(escalonador);
+        iniciarEscalonador(escalonador, n);
+        double msGravacao = 0, msSubmissao = 0;
+        size_t crescimentosAntes = 0;
+        for (int f = 0; f < framesAquecimento + frames; f++) {
+            loteMoedas.sujo = true;
+            desenharCena(shaderID, 1.0f, 0.0);
+            glFinish();
+            if (f == framesAquecimento - 1) crescimentosAntes = crescimentosArenas();
+            if (f < framesAquecimento) continue;
+            msGravacao += gravacao.msGravacao;
+            msSubmissao += gravacao.msSubmissao;
+        }
+        glReadPixels(0, 0, LARGURA, ALTURA, GL_RGBA, GL_UNSIGNED_BYTE, imagem.data());
+        bool igual = referencia.empty() || imagem == referencia;
+        if (referencia.empty()) referencia = imagem;
+        diferentes += !igual;
+        cout << "  " << n << " thread(s): " << msGravacao / frames << " / " << msSubmissao / frames << " ms; "
+             << crescimentosArenas() - crescimentosAntes << " alocações nas arenas depois do aquecimento"
+             << (igual ? "" : "; imagem diferente da de 1 thread") << endl;
+        if (n >= maxThreads) break;
+    }
+    encerrarCena();
+    encerrarRecursos();
+    return diferentes ? 1 : 0;
+#endif
+}
 
-    float x = x0 + (pos.x-pos.y) * curr_tile.dimensions.x/2.0;
-    float y = y0 + (pos.x+pos.y) * curr_tile.dimensions.y/2.0;
+// Snapshots numa partida sintética sem janela: grava um por tick num passeio
+// aleatório (com paredes postas e tiradas no meio), volta tick a tick até
+// onde o histórico alcança conferindo o hash do estado (regras e células
+// alteradas) em cada passo e mede salvar e carregar um snapshot inteiro.
+// Sai com código 1 se algum estado restaurado divergir.
+// Uso: trabalhogb --bench-snapshots [--lado N] [--moedas N] [--atores N] [--ticks N]
+//     [--segundos N] [--orcamento MB]
+int benchmarkSnapshots(int argc, char **argv)
+{
+    int lado = 512, moedas = 500, atores = 100;
+    uint64_t ticks = 18000;
+    double segundos = 300;
+    size_t orcamentoMB = 8;
+    for (int a = 2; a < argc; a++) {
+        string arg = argv[a];
+        if (arg == "--lado" && a + 1 < argc) lado = glm::max(atoi(argv[++a]), 8);
+        else if (arg == "--moedas" && a + 1 < argc) moedas = atoi(argv[++a]);
+        else if (arg == "--atores" && a + 1 < argc) atores = atoi(argv[++a]);
+        else if (arg == "--ticks" && a + 1 < argc) ticks = strtoull(argv[++a], nullptr, 10);
+        else if (arg == "--segundos" && a + 1 < argc) segundos = atof(argv[++a]);
+        else if (arg == "--orcamento" && a + 1 < argc) orcamentoMB = (size_t) glm::max(atoi(argv[++a]), 1);
+    }
+    logSimulacao = false;
+    mt19937 rng(17);
+    double msCarga;
+    if (!carregarMapaSintetico(lado, rng, msCarga)) return -1;
+    iniciarEscalonador(escalonador, numeroThreadsSimulacao());
+    iniciarSimulacao(moedas, atores);
+    iniciarHistorico(historico, segundos, orcamentoMB, 0);
+    if (!historico.ativo) return -1;
 
-    mat4 model = mat4(1);
-    model = translate(model, vec3(x,y,0.0));
-    model = scale(model,curr_tile.dimensions);
-    glUniformMatrix4fv(glGetUniformLocation(shaderID, "model"), 1, GL_FALSE, value_ptr(model));
+    auto hashCompleto = [&]() {
+        static vector<pair<uint32_t, uint16_t>> alteradas;
+        celulasAlteradas(alteradas);
+        uint64_t h = hashEstadoSimulacao();
+        for (const auto &c : alteradas) {
+            h = misturarHash(h, &c.first, sizeof(c.first));
+            h = misturarHash(h, &c.second, sizeof(c.second));
+        }
+        return h;
+    };
+    auto msDesde = [](chrono::steady_clock::time_point t) {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - t).count();
+    };
 
-    vec2 offsetTex;
+    cout << "Snapshots numa partida " << lado << "x" << lado << " com " << entidades.inicioAtores << " moedas e "
+         << entidades.n - entidades.inicioAtores << " atores:" << endl;
+
+    // Histórico: um snapshot por tick; hashes[t] = estado no tick t
+    vector<uint64_t> hashes = { hashCompleto() };
+    vector<ivec2> paredes;
+    for (int k = 0; k < 64; k++) paredes.push_back(ivec2(rng() % lado, rng() % lado));
+    const int teclas[8] = { GLFW_KEY_W, GLFW_KEY_A, GLFW_KEY_S, GLFW_KEY_D, GLFW_KEY_Q, GLFW_KEY_E, GLFW_KEY_Z, GLFW_KEY_X };
+    double msRegistro = 0, msRegistroMax = 0;
+    for (uint64_t t = 0; t < ticks && !flagReached; t++) {
+        if (t == ticks / 3) for (ivec2 c : paredes) alterarTile(c.x, c.y, 3);
+        if (t == 2 * ticks / 3) for (size_t k = 0; k < paredes.size() / 2; k++) alterarTile(paredes[k].x, paredes[k].y, 0);
+        int tecla = teclas[rng() & 7];
+        tickRegras(&tecla, 1);
+        auto inicio = chrono::steady_clock::now();
+        registrarSnapshot(historico);
+        double ms = msDesde(inicio);
+        msRegistro += ms;
+        msRegistroMax = glm::max(msRegistroMax, ms);
+        hashes.push_back(hashCompleto());
+    }
+    uint64_t gravados = tickSimulacao;
+    cout << "  histórico: " << gravados << " ticks, " << msRegistro * 1000.0 / gravados << " us por snapshot (máx "
+         << msRegistroMax * 1000.0 << " us); " << historico.nEntradas << " deltas em " << historico.bytesUsados / 1024
+         << " KB (" << historico.bytesUsados / glm::max(historico.nEntradas, (size_t) 1) << " bytes/tick, "
+         << historico.descartados << " descartados)" << endl;
 
-    offsetTex.s = curr_tile.iTile * curr_tile.ds;
-    offsetTex.t = 0.0;
-    glUniform2f(glGetUniformLocation(shaderID, "offsetTex"),offsetTex.s, offsetTex.t);
+    // Rebobina tudo o que coube no histórico
+    size_t passos = 0, divergentes = 0;
+    double msVolta = 0, msVoltaMax = 0;
+    for (;;) {
+        auto inicio = chrono::steady_clock::now();
+        if (!voltarSnapshot(historico)) break;
+        double ms = msDesde(inicio);
+        msVolta += ms;
+        msVoltaMax = glm::max(msVoltaMax, ms);
+        passos++;
+        divergentes += hashCompleto() != hashes[tickSimulacao];
+    }
+    cout << "  rebobinar: " << passos << " passos até o tick " << tickSimulacao << ", "
+         << msVolta * 1000.0 / glm::max(passos, (size_t) 1) << " us por passo (máx " << msVoltaMax * 1000.0 << " us); "
+         << divergentes << " estados divergentes" << endl;
 
-    glBindVertexArray(curr_tile.VAO); // Conectando ao buffer de geometria
-    glBindTexture(GL_TEXTURE_2D, curr_tile.texID); // Conectando ao buffer de textura
+    // Snapshot inteiro (F5/F9 sem o disco): grava aqui, avança alguns ticks e
+    // volta carregando-o, com validação
+    const int repeticoes = 20;
+    vector<uint8_t> blob;
+    double msSalvar = 0, msCarregar = 0;
+    int falhas = 0;
+    for (int r = 0; r < repeticoes; r++) {
+        auto inicio = chrono::steady_clock::now();
+        gravarSnapshot(blob);
+        msSalvar += msDesde(inicio);
+        uint64_t esperado = hashCompleto();
+        for (int t = 0; t < 30; t++) {
+            int tecla = teclas[rng() & 7];
+            tickRegras(&tecla, 1);
+        }
+        inicio = chrono::steady_clock::now();
+        string erro;
+        bool valido = validarSnapshot(blob.data(), blob.size(), erro);
+        if (valido) aplicarSnapshot(blob.data());
+        msCarregar += msDesde(inicio);
+        falhas += !valido || hashCompleto() != esperado;
+    }
+    cout << "  snapshot inteiro: " << blob.size() << " bytes; salvar " << msSalvar / repeticoes << " ms, carregar "
+         << msCarregar / repeticoes << " ms" << (falhas ? "; *** CARGA DIVERGE ***" : "") << endl;
 
-    // Chamada de desenho - drawcall
-    // Poligono Preenchido - GL_TRIANGLES
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-}
\ No newline at end of file
+    encerrarEscalonador(escalonador);
+    return divergentes || falhas ? 1 : 0;
+}